@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "append.h"
+#include "decode.h"
+#include "encode.h"
+#include "common.h"
+#include "types.h"
+#include "bmp.h"
+#include "kernel.h"
+#include "crc32c.h"
+#include "log.h"
+
+/*
+ * Function: append_patch_field
+ * ----------------------------
+ * Re-embeds a 4 or 8 byte little endian header field over the
+ * field_size * 8 image bytes at pos, the same way
+ * encode_data_to_image wrote it.
+ */
+Status append_patch_field(FILE *fptr_stego, off_t pos, uint64 value, uint field_size, EmbedMode mode, KeyStream *ks)
+{
+  unsigned char field[8];
+  unsigned char image_buffer[64];
+  uint image_bytes = field_size * 8;
+  for (uint i = 0; i < field_size; i++)
+    field[i] = (value >> (i * 8)) & 0xff;
+
+  if (fseeko(fptr_stego, pos, SEEK_SET) != 0 || fread(image_buffer, sizeof(char), image_bytes, fptr_stego) != image_bytes)
+    return e_failure;
+  embed_bytes(mode, 0, field, field_size, image_buffer, ks);
+  if (fseeko(fptr_stego, pos, SEEK_SET) != 0 || fwrite(image_buffer, sizeof(char), image_bytes, fptr_stego) != image_bytes)
+    return e_failure;
+  return e_success;
+}
+
+/*
+ * Function: do_append
+ * -------------------
+ * Appends argv[3] to the secret in argv[2], rewriting only:
+ *  - the last, partially filled kernel chunk of the secret.
+ *    Its existing bytes are extracted and embedded again,
+ *    which changes no pixel, so matrix blocks that the old
+ *    end left half used get the new bits.
+ *  - the image bytes of the appended data
+ *  - the size and CRC-32C header fields. The digest is
+ *    extended over the new bytes, not recomputed.
+ * Every part is embedded with the key stream at the position
+ * the encoder had reached there, so LSB matching and matrix
+ * embedding never reuse the words of the magic string or of
+ * the existing data, and choose as a fresh encode would.
+ *
+ * Returns: e_success, or e_failure if the image has no room
+ */
+Status do_append(char *argv[], DecodeInfo *decInfo)
+{
+  char magic_buffer[20];
+  char *dot;
+  if ((dot = strstr(argv[2], ".")) == NULL || strcmp(dot, ".bmp") != 0)
+  {
+    log_error(e_err_args, "stego image file should be .bmp");
+    return e_failure;
+  }
+  decInfo->stego_image_fname = argv[2];
+
+  FILE *fptr_append = fopen(argv[3], "rb");
+  if (fptr_append == NULL)
+  {
+    log_error(e_err_io, "Unable to open file %s: %s", argv[3], strerror(errno));
+    return e_failure;
+  }
+  uint64 append_size = get_file_size(fptr_append);
+  if (fseeko(fptr_append, 0, SEEK_SET) != 0)
+  {
+    log_error(e_err_io, "Unable to seek in %s: %s", argv[3], strerror(errno));
+    fclose(fptr_append);
+    return e_failure;
+  }
+
+  decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "r+b");
+  if (decInfo->fptr_stego_image == NULL)
+  {
+    log_error(e_err_io, "unable to open file %s: %s", decInfo->stego_image_fname, strerror(errno));
+    fclose(fptr_append);
+    return e_failure;
+  }
+
+  // the magic string also seeds the key stream of LSB matching
+  const char *caller_magic = decInfo->magic_string;
+  if (decInfo->magic_string == NULL)
+  {
+    log_flush();
+    printf("Enter magic string:");
+    scanf("%19s", magic_buffer);
+    decInfo->magic_string = magic_buffer;
+  }
+  KeyStream field_keystream, data_keystream;
+  keystream_init(&field_keystream, decInfo->magic_string);
+
+  Status status = e_failure;
+  if (decode_stego_header(decInfo) != e_success)
+  {
+    log_failure(e_err_header, "failed to decode stego header");
+  }
+  else if (decInfo->format_flags & STEGO_FLAG_CONTAINER)
+  {
+    log_error(e_err_container, "appending to a container would leave the bytes outside its directory");
+  }
+  else if (decInfo->format_flags & STEGO_FLAG_STRIDE)
+  {
+    log_error(e_err_capacity, "the secret data of %s is spread for its size, encode the secret again", decInfo->stego_image_fname);
+  }
+  else
+  {
+    EmbedMode mode = decInfo->embed_mode;
+    uint param = decInfo->embed_param;
+    EmbedMode header_mode = embed_header_mode(mode);
+    uint size_field = STEGO_SIZE_FIELD_BYTES(decInfo->format_flags);
+    off_t data_pos = ftello(decInfo->fptr_stego_image);
+    off_t size_pos = data_pos - decInfo->data_pad - size_field * 8 - ((decInfo->format_flags & STEGO_FLAG_DIGEST) ? 32 : 0);
+    uint64 old_size = decInfo->size_secret_file;
+    uint64 total = old_size + append_size;
+    uint64 image_size = get_image_size_for_bmp(decInfo->fptr_stego_image);
+
+    // the encoder drew key stream words for the magic string, the
+    // format word and the extension, one embed call each, then for
+    // the size and digest fields, then for every data chunk
+    uint magic_len = strlen(decInfo->magic_string);
+    uint extn_len = (uint)((size_pos - BMP_HEADER_SIZE) / 8) - magic_len - sizeof(int);
+    keystream_skip(&field_keystream, embed_keystream_words(header_mode, 0, magic_len) +
+                                     embed_keystream_words(header_mode, 0, sizeof(int)) +
+                                     embed_keystream_words(header_mode, 0, extn_len));
+    data_keystream = field_keystream;
+    keystream_skip(&data_keystream, embed_keystream_words(header_mode, 0, size_field));
+    KeyStream digest_keystream = data_keystream;
+    if (decInfo->format_flags & STEGO_FLAG_DIGEST)
+      keystream_skip(&data_keystream, embed_keystream_words(header_mode, 0, 4));
+
+    // the size field cannot grow in place, a 4 byte one caps the total
+    if (size_field == 4 && total > STEGO_MAX_SIZE32)
+    {
+      log_error(e_err_capacity, "the size field of %s holds at most %llu bytes, encode the secret again", decInfo->stego_image_fname, STEGO_MAX_SIZE32);
+    }
+    else if (total > get_payload_capacity(image_size, mode, param))
+    {
+      log_error(e_err_capacity, "dont have enough capacity to append %llu bytes", append_size);
+    }
+    else if (decInfo->image_chunk == NULL &&
+             ((decInfo->image_chunk = arena_alloc(&decInfo->arena, STEGO_CHUNK_SIZE * 8)) == NULL ||
+              (decInfo->secret_chunk = arena_alloc(&decInfo->arena, STEGO_CHUNK_SIZE)) == NULL))
+    {
+      log_error(e_err_memory, "Memory alocation failed");
+    }
+    else
+    {
+      uint chunk_size = embed_chunk_size(mode, param);
+      uint64 pos = old_size / chunk_size * chunk_size;
+      off_t image_pos = data_pos + (off_t)(pos / chunk_size * embed_image_bytes(mode, param, chunk_size));
+      uint crc = crc32c_resume(decInfo->digest_secret_file);
+      keystream_skip(&data_keystream, pos / chunk_size * embed_keystream_words(mode, param, chunk_size));
+      status = e_success;
+
+      while (pos < total && status == e_success)
+      {
+        uint count = total - pos < chunk_size ? (uint)(total - pos) : chunk_size;
+        uint image_bytes = embed_image_bytes(mode, param, count);
+        uint keep = pos < old_size ? (uint)(old_size - pos) : 0;
+
+        if (fseeko(decInfo->fptr_stego_image, image_pos, SEEK_SET) != 0 ||
+            fread(decInfo->image_chunk, sizeof(char), image_bytes, decInfo->fptr_stego_image) != image_bytes ||
+            fread(decInfo->secret_chunk + keep, sizeof(char), count - keep, fptr_append) != count - keep)
+        {
+          log_error(e_err_io, "failed to read the chunk at %llu", pos);
+          status = e_failure;
+          break;
+        }
+        if (keep)
+          decInfo->kernel->extract(decInfo->image_chunk, keep, decInfo->secret_chunk);
+        crc = crc32c_update(crc, decInfo->secret_chunk + keep, count - keep);
+        decInfo->kernel->embed(decInfo->secret_chunk, count, decInfo->image_chunk, &data_keystream);
+
+        if (fseeko(decInfo->fptr_stego_image, image_pos, SEEK_SET) != 0 ||
+            fwrite(decInfo->image_chunk, sizeof(char), image_bytes, decInfo->fptr_stego_image) != image_bytes)
+        {
+          log_error(e_err_io, "failed to write the chunk at %llu: %s", pos, strerror(errno));
+          status = e_failure;
+        }
+        image_pos += image_bytes;
+        pos += count;
+      }
+
+      if (status == e_success)
+      {
+        decInfo->size_secret_file = total;
+        decInfo->digest_secret_file = crc32c_final(crc);
+        status = append_patch_field(decInfo->fptr_stego_image, size_pos, total, size_field, header_mode, &field_keystream);
+        // images from before the digest field have none to patch
+        if (status == e_success && (decInfo->format_flags & STEGO_FLAG_DIGEST))
+          status = append_patch_field(decInfo->fptr_stego_image, size_pos + size_field * 8, decInfo->digest_secret_file, 4, header_mode, &digest_keystream);
+      }
+      if (status == e_success)
+        printf("appended %llu bytes, secret is now %llu bytes, crc32c %08x\n", append_size, total, decInfo->digest_secret_file);
+      else
+        log_failure(e_err_io, "failed to append, %s may be damaged", decInfo->stego_image_fname);
+    }
+  }
+
+  fclose(fptr_append);
+  if (fclose(decInfo->fptr_stego_image) != 0)
+    status = e_failure;
+  decInfo->fptr_stego_image = NULL;
+  decInfo->magic_string = caller_magic;
+  return status;
+}
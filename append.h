@@ -0,0 +1,26 @@
+#ifndef APPEND_H
+#define APPEND_H
+
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+#include "decode.h"
+
+/*
+ * In-place append to the secret of a stego image.
+ * The new bytes are embedded right after the existing secret
+ * data, and the size and CRC-32C fields of the header are
+ * patched in place. Only the header fields, the appended
+ * range and the rest of the last kernel chunk are read and
+ * rewritten, so an append costs time proportional to its size
+ * instead of the image size.
+ */
+
+/* Append function prototype */
+
+/* Patch a 4 or 8 byte header field at image offset pos */
+Status append_patch_field(FILE *fptr_stego, off_t pos, uint64 value, uint field_size, EmbedMode mode, KeyStream *ks);
+
+/* Append "-a stego.bmp more.txt" */
+Status do_append(char *argv[], DecodeInfo *decInfo);
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "log.h"
+#include "types.h"
+
+/*
+ * Function: arena_init
+ * --------------------
+ * Allocates the backing block of the arena. This is the only
+ * call to malloc for the lifetime of the arena.
+ *
+ * arena: Pointer to Arena struct
+ * size: Size of the backing block in bytes
+ *
+ * Returns: e_success, or e_failure if the block can't be allocated
+ */
+Status arena_init(Arena *arena, size_t size)
+{
+  memset(arena, 0, sizeof(*arena));
+  arena->base = malloc(size);
+  if (arena->base == NULL)
+  {
+    log_error(e_err_memory, "Unable to allocate arena of %zu bytes", size);
+    return e_failure;
+  }
+  arena->size = size;
+  arena->n_sys_allocs++;
+  return e_success;
+}
+
+/*
+ * Function: arena_alloc
+ * ---------------------
+ * Returns size bytes from the arena, aligned to ARENA_ALIGN.
+ *
+ * Returns: pointer into the arena, or NULL if it is exhausted
+ */
+void *arena_alloc(Arena *arena, size_t size)
+{
+  // round the current offset up to the alignment
+  size_t start = (arena->used + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+  if (arena->base == NULL || start > arena->size || size > arena->size - start)
+  {
+    arena->n_failed++;
+    return NULL;
+  }
+  arena->used = start + size;
+  if (arena->used > arena->high_water)
+    arena->high_water = arena->used;
+  arena->n_allocs++;
+  return arena->base + start;
+}
+
+/*
+ * Function: arena_strdup
+ * ----------------------
+ * Copies a '\0' terminated string into the arena.
+ */
+char *arena_strdup(Arena *arena, const char *str)
+{
+  size_t len = strlen(str);
+  char *copy = arena_alloc(arena, len + 1);
+  if (copy)
+    memcpy(copy, str, len + 1);
+  return copy;
+}
+
+/*
+ * Function: arena_reset
+ * ---------------------
+ * Drops every allocation at once. Called between jobs so the
+ * same block serves the next image without touching malloc.
+ */
+void arena_reset(Arena *arena)
+{
+  arena->used = 0;
+}
+
+/*
+ * Function: arena_free
+ * --------------------
+ * Releases the backing block.
+ */
+void arena_free(Arena *arena)
+{
+  free(arena->base);
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Per-job bump allocator.
+ * One block is allocated up front by arena_init and every
+ * buffer a job needs (file names, header scratch, chunk
+ * buffers) is carved out of it with arena_alloc.
+ * Nothing is freed individually: arena_reset releases the
+ * whole job at once so the block can be reused for the next
+ * image, and arena_free gives the block back at exit.
+ */
+
+#define ARENA_DEFAULT_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct _Arena
+{
+    char *base;
+    size_t size;
+    size_t used;
+    size_t high_water;
+
+    /* Counters, so callers can check the job path stays malloc free */
+    uint n_sys_allocs;
+    uint n_allocs;
+    uint n_failed;
+
+} Arena;
+
+
+/* Arena function prototype */
+
+/* Allocate the backing block */
+Status arena_init(Arena *arena, size_t size);
+
+/* Carve size bytes out of the arena, NULL when exhausted */
+void *arena_alloc(Arena *arena, size_t size);
+
+/* Copy a string into the arena */
+char *arena_strdup(Arena *arena, const char *str);
+
+/* Release every allocation of the current job */
+void arena_reset(Arena *arena);
+
+/* Give the backing block back to the system */
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "kernel.h"
+#include "crc32c.h"
+#include "decode.h"
+#include "common.h"
+#include "bmp.h"
+#include "log.h"
+#include "types.h"
+
+/*
+ * Function: bench_now
+ * -------------------
+ * Monotonic time in seconds
+ */
+static double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Function: bench_embed
+ * ---------------------
+ * Best of BENCH_ROUNDS runs of one embedding mode, filling as
+ * much of the image buffer as the mode can.
+ *
+ * Returns: throughput in MB/s of image data
+ */
+static double bench_embed(EmbedMode mode, uint param, const unsigned char *data, unsigned char *image, uint image_size)
+{
+  KeyStream ks;
+  double best = 0;
+  uint size = image_size / 8;
+  if (mode == e_embed_matrix)
+    size = image_size / ((1u << param) - 1) * param / 8;
+  else if (mode == e_embed_pixel)
+    size = image_size / pixel_group_bytes(param) * 3;
+  uint used = embed_image_bytes(mode, param, size);
+
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    keystream_init(&ks, "bench");
+    double start = bench_now();
+    embed_bytes(mode, param, data, size, image, &ks);
+    double elapsed = bench_now() - start;
+    if (elapsed > 0 && (best == 0 || elapsed < best))
+      best = elapsed;
+  }
+  return best > 0 ? used / best / 1e6 : 0;
+}
+
+/*
+ * Function: bench_pixel_runtime
+ * -----------------------------
+ * Same as bench_embed for the pixel kernel body with its
+ * layout only known at run time
+ */
+static double bench_pixel_runtime(uint param, const unsigned char *data, unsigned char *image, uint image_size)
+{
+  double best = 0;
+  uint size = image_size / pixel_group_bytes(param) * 3;
+  uint used = embed_image_bytes(e_embed_pixel, param, size);
+
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    double start = bench_now();
+    embed_pixel_runtime(data, size, image, param);
+    double elapsed = bench_now() - start;
+    if (elapsed > 0 && (best == 0 || elapsed < best))
+      best = elapsed;
+  }
+  return best > 0 ? used / best / 1e6 : 0;
+}
+
+/*
+ * Function: bench_spread_extract
+ * ------------------------------
+ * Extraction of spread LSB data at the given stride: every
+ * STEGO_SPREAD_WINDOW of the image is gathered into a dense
+ * chunk and run through extract_lsb, as decode does.
+ *
+ * Returns: throughput in MB/s of image data scanned
+ */
+static double bench_spread_extract(uint stride, unsigned char *data, const unsigned char *image, uint image_size)
+{
+  static unsigned char dense[STEGO_CHUNK_SIZE * 8];
+  double best = 0;
+  uint n_units = STEGO_SPREAD_WINDOW / stride / 8 * 8;
+  uint span = n_units * stride;
+
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    uint out = 0;
+    double start = bench_now();
+    for (uint pos = 0; pos + span <= image_size; pos += span, out += n_units / 8)
+    {
+      gather_strided(image + pos, n_units, 1, stride, dense);
+      extract_lsb(dense, n_units / 8, data + out);
+    }
+    double elapsed = bench_now() - start;
+    if (elapsed > 0 && (best == 0 || elapsed < best))
+      best = elapsed;
+  }
+  return best > 0 ? image_size / best / 1e6 : 0;
+}
+
+/*
+ * Function: bench_stego_header
+ * ----------------------------
+ * Embeds an LSB stego header (magic, format word with digest,
+ * extension, 4 byte size, digest) at the start of the pixel data
+ */
+static uint bench_stego_header(unsigned char *pixels, const char *magic, uint size, uint digest)
+{
+  unsigned char header[MAX_STEGO_HEADER_BYTES];
+  uint magic_len = strlen(magic);
+  uint word = STEGO_FORMAT_WORD(4, e_embed_lsb, 0) | STEGO_FLAG_DIGEST;
+  memcpy(header, magic, magic_len);
+  memcpy(header + magic_len, &word, 4);
+  memcpy(header + magic_len + 4, ".txt", 4);
+  memcpy(header + magic_len + 8, &size, 4);
+  memcpy(header + magic_len + 12, &digest, 4);
+  embed_lsb_replace(header, magic_len + 16, pixels);
+  return (magic_len + 16) * 8;
+}
+
+/*
+ * Function: bench_decode
+ * ----------------------
+ * Times decode_stego_buffer on an in-memory stego image that
+ * fills the whole image with an LSB secret, then on the same
+ * image with a size field larger than the image can carry.
+ * The damaged one must be rejected from the header alone, in
+ * time that does not grow with the claimed size.
+ */
+static void bench_decode(const unsigned char *data, const unsigned char *image, uint image_size)
+{
+  const char *magic = "bench";
+  DecodeInfo decInfo;
+  memset(&decInfo, 0, sizeof(decInfo));
+  unsigned char *stego = malloc(BMP_HEADER_SIZE + image_size);
+  if (stego == NULL || arena_init(&decInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+  {
+    log_error(e_err_memory, "Unable to allocate the decode benchmark image");
+    free(stego);
+    return;
+  }
+  memset(stego, 0, BMP_HEADER_SIZE);
+  memcpy(stego + BMP_HEADER_SIZE, image, image_size);
+  uint size = (image_size - MAX_STEGO_HEADER_BYTES * 8) / 8;
+  uint digest = crc32c_final(crc32c_update(CRC32C_INIT, data, size));
+  uint header_bytes = bench_stego_header(stego + BMP_HEADER_SIZE, magic, size, digest);
+  embed_lsb_replace(data, size, stego + BMP_HEADER_SIZE + header_bytes);
+
+  double best = 0;
+  Status status = e_failure;
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    decInfo.image_chunk = decInfo.secret_chunk = NULL;
+    arena_reset(&decInfo.arena);
+    decInfo.magic_string = magic;
+    double start = bench_now();
+    status = decode_stego_buffer(stego, BMP_HEADER_SIZE + image_size, &decInfo);
+    double elapsed = bench_now() - start;
+    if (elapsed > 0 && (best == 0 || elapsed < best))
+      best = elapsed;
+  }
+  printf("%-12s %10.1f MB/s  (%s, crc32c %08x)\n", "decode-mem", best > 0 ? image_size / best / 1e6 : 0,
+         status == e_success ? "PASS" : "FAIL", decInfo.digest_decoded);
+
+  // claim the largest 4 byte size, 8 times more image bytes than there are
+  bench_stego_header(stego + BMP_HEADER_SIZE, magic, (uint)STEGO_MAX_SIZE32, digest);
+  decInfo.image_chunk = decInfo.secret_chunk = NULL;
+  arena_reset(&decInfo.arena);
+  // the rejection is expected, keep its error line off the report
+  LogLevel level = log_level;
+  log_level = e_log_off;
+  double start = bench_now();
+  status = decode_stego_buffer(stego, BMP_HEADER_SIZE + image_size, &decInfo);
+  double elapsed = bench_now() - start;
+  log_level = level;
+  printf("%-12s %10.1f us    (size field past the image, %s)\n", "decode-bad", elapsed * 1e6,
+         status == e_success ? "ACCEPTED" : "rejected");
+
+  // an image file without a secret, turned away by the header probe
+  FILE *fptr = tmpfile();
+  uint file_bytes = image_size < BENCH_PROBE_BYTES ? image_size : BENCH_PROBE_BYTES;
+  if (fptr && fwrite(stego, 1, BMP_HEADER_SIZE, fptr) == BMP_HEADER_SIZE &&
+      fwrite(image, 1, file_bytes, fptr) == file_bytes && fflush(fptr) == 0)
+  {
+    uint misses = 0;
+    decInfo.fptr_stego_image = fptr;
+    start = bench_now();
+    for (int i = 0; i < BENCH_PROBE_RUNS; i++)
+    {
+      arena_reset(&decInfo.arena);
+      misses += decode_probe_header(&decInfo) != e_success;
+    }
+    elapsed = (bench_now() - start) / BENCH_PROBE_RUNS;
+    decInfo.fptr_stego_image = NULL;
+    printf("%-12s %10.2f us    (no magic string in the image, %u of %u rejected)\n", "probe-miss", elapsed * 1e6,
+           misses, BENCH_PROBE_RUNS);
+  }
+  if (fptr)
+    fclose(fptr);
+
+  arena_free(&decInfo.arena);
+  free(stego);
+}
+
+/*
+ * Function: do_benchmark
+ * ----------------------
+ * Fills a synthetic image and payload with random bytes and
+ * reports the throughput of every embedding kernel, relative
+ * to plain LSB replacement.
+ */
+Status do_benchmark(char *argv[])
+{
+  unsigned long mb = BENCH_DEFAULT_MB;
+  if (argv[2])
+    mb = strtoul(argv[2], NULL, 10);
+  if (mb == 0)
+    mb = BENCH_DEFAULT_MB;
+  // checked before multiplying, 4096 MB and up would wrap to a tiny image
+  if (mb > BENCH_MAX_MB)
+  {
+    log_error(e_err_args, "benchmark image size must be at most %u MB, got %lu", BENCH_MAX_MB, mb);
+    return e_failure;
+  }
+
+  uint image_size = (uint)((uint64)mb << 20);
+  uint size = image_size / 8;
+  unsigned char *image = malloc(image_size);
+  // pixel mode at 4 bits in 3 bytes per pixel carries half the image size
+  unsigned char *data = malloc(image_size / 2);
+  if (image == NULL || data == NULL)
+  {
+    log_error(e_err_memory, "Unable to allocate %lu MB for benchmark", mb);
+    free(image);
+    free(data);
+    return e_failure;
+  }
+
+  KeyStream fill;
+  keystream_init(&fill, "bench-fill");
+  for (uint i = 0; i < image_size; i += 8)
+  {
+    unsigned long long r = keystream_next(&fill);
+    memcpy(image + i, &r, 8);
+  }
+  for (uint i = 0; i + 8 <= image_size / 2; i += 8)
+    memcpy(data + i, image + image_size - 8 - i, 8);
+
+  printf("embed kernels, %lu MB image\n", mb);
+  double base = bench_embed(e_embed_lsb, 0, data, image, image_size);
+  printf("%-12s %10.1f MB/s\n", "lsb", base);
+  double match = bench_embed(e_embed_lsb_match, 0, data, image, image_size);
+  printf("%-12s %10.1f MB/s  (%.2fx slower than lsb)\n", "lsb-match", match, match > 0 ? base / match : 0);
+  for (uint rate = MATRIX_MIN_RATE; rate <= MATRIX_MAX_RATE; rate += 3)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), "matrix-k%u", rate);
+    double matrix = bench_embed(e_embed_matrix, rate, data, image, image_size);
+    printf("%-12s %10.1f MB/s  (%.2fx slower than lsb)\n", name, matrix, matrix > 0 ? base / matrix : 0);
+  }
+
+  // specialized pixel kernels against the same body with run time parameters
+  for (uint bytes_per_pixel = 3; bytes_per_pixel <= 4; bytes_per_pixel++)
+  {
+    for (uint bits = 1; bits <= 4; bits <<= 1)
+    {
+      char name[16];
+      uint param = PIXEL_PARAM(bits, bytes_per_pixel);
+      snprintf(name, sizeof(name), "pixel-k%u-%u", bits, bytes_per_pixel * 8);
+      double pixel = bench_embed(e_embed_pixel, param, data, image, image_size);
+      double runtime = bench_pixel_runtime(param, data, image, image_size);
+      printf("%-12s %10.1f MB/s  (%.2fx slower than lsb, run time parameters %.1f MB/s)\n", name, pixel, pixel > 0 ? base / pixel : 0, runtime);
+    }
+  }
+  // green and red only, bit 0 first: the channel mask and bit order are constants too
+  uint layout = PIXEL_PARAM(2, 4) | PIXEL_SKIP(1) | PIXEL_LSB_FIRST;
+  double pixel = bench_embed(e_embed_pixel, layout, data, image, image_size);
+  double runtime = bench_pixel_runtime(layout, data, image, image_size);
+  printf("%-12s %10.1f MB/s  (%.2fx slower than lsb, run time parameters %.1f MB/s)\n", "pixel-k2-gr", pixel, pixel > 0 ? base / pixel : 0, runtime);
+
+  // verify path: extract + crc32c over the whole image
+  double best = 0;
+  uint crc = CRC32C_INIT;
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    double start = bench_now();
+    extract_lsb(image, size, data);
+    crc = crc32c_update(CRC32C_INIT, data, size);
+    double elapsed = bench_now() - start;
+    if (elapsed > 0 && (best == 0 || elapsed < best))
+      best = elapsed;
+  }
+  printf("%-12s %10.1f MB/s  (crc32c %08x)\n", "extract+crc", best > 0 ? image_size / best / 1e6 : 0, crc32c_final(crc));
+
+  // strided gather in front of the same extract kernel, --spread
+  for (uint stride = 2; stride <= 8; stride *= 2)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), "spread-s%u", stride);
+    double spread = bench_spread_extract(stride, data, image, image_size);
+    printf("%-12s %10.1f MB/s  (image scanned, %u bytes per carrier)\n", name, spread, stride);
+  }
+
+  // in-memory decode, and how fast a damaged size field is turned away
+  bench_decode(data, image, image_size);
+
+  free(image);
+  free(data);
+  return e_success;
+}
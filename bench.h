@@ -0,0 +1,24 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * In-memory throughput benchmark of the embed/extract
+ * kernels and the verify digest. No files are touched, so the numbers show the
+ * kernel cost alone. The in-memory decode rows also show that
+ * a damaged size field is rejected before any data is read.
+ * The probe-miss row alone reads a temporary file: the time
+ * to turn away an image that carries no secret.
+ */
+
+#define BENCH_DEFAULT_MB 64
+#define BENCH_MAX_MB 2047 // the kernels take 32-bit buffer sizes
+#define BENCH_ROUNDS 5
+#define BENCH_PROBE_RUNS 10000
+#define BENCH_PROBE_BYTES (64 * 1024)
+
+/* Run the kernel benchmarks, "-b [image_megabytes]" */
+Status do_benchmark(char *argv[]);
+
+#endif
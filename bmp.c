@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <string.h>
+#include "bmp.h"
+#include "types.h"
+
+/*
+ * Function: bmp_read_u16 / bmp_read_u32
+ * -------------------------------------
+ * Reads a little endian field from a header buffer
+ */
+uint bmp_read_u16(const unsigned char *buf)
+{
+  return (uint)buf[0] | ((uint)buf[1] << 8);
+}
+
+uint bmp_read_u32(const unsigned char *buf)
+{
+  return (uint)buf[0] | ((uint)buf[1] << 8) | ((uint)buf[2] << 16) | ((uint)buf[3] << 24);
+}
+
+/*
+ * Function: parse_bmp_header
+ * --------------------------
+ * Validates the "BM" signature and fills BmpInfo from the
+ * 54 byte file + info header. Height is stored negative for
+ * top-down bitmaps, only its magnitude matters here.
+ *
+ * header: First BMP_HEADER_SIZE bytes of the file
+ * info: Pointer to BmpInfo struct
+ *
+ * Returns: e_success if the header looks like a BMP, otherwise e_failure
+ */
+Status parse_bmp_header(const unsigned char *header, BmpInfo *info)
+{
+  if (header[0] != 'B' || header[1] != 'M')
+    return e_failure;
+
+  memset(info, 0, sizeof(*info));
+  info->file_size = bmp_read_u32(header + BMP_OFFSET_FILE_SIZE);
+  info->data_offset = bmp_read_u32(header + BMP_OFFSET_DATA);
+  info->width = bmp_read_u32(header + BMP_OFFSET_WIDTH);
+  int height = (int)bmp_read_u32(header + BMP_OFFSET_HEIGHT);
+  // negated as unsigned, INT_MIN has no positive int
+  info->height = height < 0 ? 0u - (uint)height : (uint)height;
+  info->bits_per_pixel = bmp_read_u16(header + BMP_OFFSET_BPP);
+  info->compression = bmp_read_u32(header + BMP_OFFSET_COMPRESSION);
+
+  if (info->width == 0 || info->height == 0 || info->bits_per_pixel < 8)
+    return e_failure;
+
+  info->image_size = (uint64)info->width * info->height * (info->bits_per_pixel / 8);
+  return e_success;
+}
@@ -0,0 +1,44 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Fields of the BMP file header and BITMAPINFOHEADER
+ * that the encoder and the cover tools care about.
+ * All values are little endian in the file.
+ */
+
+#define BMP_HEADER_SIZE 54
+#define BMP_OFFSET_FILE_SIZE 2
+#define BMP_OFFSET_DATA 10
+#define BMP_OFFSET_WIDTH 18
+#define BMP_OFFSET_HEIGHT 22
+#define BMP_OFFSET_BPP 28
+#define BMP_OFFSET_COMPRESSION 30
+
+typedef struct _BmpInfo
+{
+    uint file_size;
+    uint data_offset;
+    uint width;
+    uint height;
+    uint bits_per_pixel;
+    uint compression;
+
+    /* width * height * bytes per pixel */
+    uint64 image_size;
+
+} BmpInfo;
+
+
+/* BMP function prototype */
+
+/* Parse the first BMP_HEADER_SIZE bytes of a BMP file */
+Status parse_bmp_header(const unsigned char *header, BmpInfo *info);
+
+/* Read a little endian 16/32 bit field out of a header buffer */
+uint bmp_read_u16(const unsigned char *buf);
+uint bmp_read_u32(const unsigned char *buf);
+
+#endif
@@ -1,2 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "common.h"
-char MAGIC_STRING[20];
\ No newline at end of file
+#include "kernel.h"
+char MAGIC_STRING[20];
+
+/*
+ * Function: strip_stego_options
+ * -----------------------------
+ * Pulls every "--name[=value]" argument out of argv and records
+ * it in opts, so the positional arguments keep their indexes.
+ *
+ * Returns: the remaining argc, or -1 on an unknown option
+ */
+int strip_stego_options(int argc, char *argv[], StegoOptions *opts)
+{
+  int kept = 0;
+  memset(opts, 0, sizeof(*opts));
+  opts->embed_mode = e_embed_lsb;
+  opts->matrix_rate = MATRIX_DEFAULT_RATE;
+  opts->pixel_bits = PIXEL_DEFAULT_BITS;
+  opts->log_level = e_log_error;
+
+  for (int i = 0; i < argc; i++)
+  {
+    if (i == 0 || strncmp(argv[i], "--", 2) != 0)
+    {
+      argv[kept++] = argv[i];
+      continue;
+    }
+    if (strcmp(argv[i], "--mode=lsb") == 0)
+      opts->embed_mode = e_embed_lsb;
+    else if (strcmp(argv[i], "--mode=match") == 0)
+      opts->embed_mode = e_embed_lsb_match;
+    else if (strcmp(argv[i], "--mode=matrix") == 0)
+      opts->embed_mode = e_embed_matrix;
+    else if (strcmp(argv[i], "--mode=pixel") == 0)
+      opts->embed_mode = e_embed_pixel;
+    else if (strncmp(argv[i], "--rate=", 7) == 0)
+    {
+      opts->matrix_rate = (uint)atoi(argv[i] + 7);
+      if (opts->matrix_rate < MATRIX_MIN_RATE || opts->matrix_rate > MATRIX_MAX_RATE)
+      {
+        log_error(e_err_args, "rate must be %d..%d", MATRIX_MIN_RATE, MATRIX_MAX_RATE);
+        return -1;
+      }
+    }
+    else if (strncmp(argv[i], "--bits=", 7) == 0)
+    {
+      opts->pixel_bits = (uint)atoi(argv[i] + 7);
+      if (embed_kernel_select(e_embed_pixel, PIXEL_PARAM(opts->pixel_bits, 3)) == NULL)
+      {
+        log_error(e_err_args, "bits must be 1, 2 or 4");
+        return -1;
+      }
+    }
+    else if (strncmp(argv[i], "--channels=", 11) == 0)
+    {
+      // b, g and r in any order; the parameter records the others
+      uint used = 0;
+      const char *c;
+      for (c = argv[i] + 11; *c && strchr("bgr", *c); c++)
+        used |= 1u << (strchr("bgr", *c) - "bgr");
+      if (used == 0 || *c)
+      {
+        log_error(e_err_args, "channels must be letters of bgr, got %s", argv[i] + 11);
+        return -1;
+      }
+      opts->pixel_layout = (opts->pixel_layout & PIXEL_LSB_FIRST) | PIXEL_SKIP(PIXEL_SKIP_ALL & ~used);
+    }
+    else if (strcmp(argv[i], "--bit-order=msb") == 0)
+      opts->pixel_layout &= ~PIXEL_LSB_FIRST;
+    else if (strcmp(argv[i], "--bit-order=lsb") == 0)
+      opts->pixel_layout |= PIXEL_LSB_FIRST;
+    else if (strcmp(argv[i], "--spread") == 0)
+      opts->spread = 1;
+    else if (strcmp(argv[i], "--verify") == 0)
+      opts->verify = 1;
+    else if (strncmp(argv[i], "--verify=", 9) == 0)
+    {
+      char *end;
+      opts->verify = 1;
+      opts->has_expected_digest = 1;
+      opts->expected_digest = (uint)strtoul(argv[i] + 9, &end, 16);
+      if (argv[i][9] == '\0' || *end != '\0')
+      {
+        log_error(e_err_args, "digest must be hex, got %s", argv[i] + 9);
+        return -1;
+      }
+    }
+    else if (strncmp(argv[i], "--repeat=", 9) == 0)
+    {
+      int repeat = atoi(argv[i] + 9);
+      if (repeat < 1)
+      {
+        log_error(e_err_args, "repeat must be at least 1");
+        return -1;
+      }
+      opts->repeat = (uint)repeat;
+    }
+    else if (strncmp(argv[i], "--cache-mb=", 11) == 0)
+    {
+      int megabytes = atoi(argv[i] + 11);
+      if (megabytes < 1)
+      {
+        log_error(e_err_args, "cache size must be at least 1 MB");
+        return -1;
+      }
+      opts->cache_budget = (unsigned long long)megabytes << 20;
+    }
+    else if (strcmp(argv[i], "--quiet") == 0)
+      opts->log_level = e_log_error;
+    else if (strcmp(argv[i], "--verbose") == 0)
+      opts->log_level = e_log_info;
+    else if (strncmp(argv[i], "--log=", 6) == 0)
+    {
+      int level;
+      for (level = e_log_off; level <= e_log_debug; level++)
+        if (strcmp(argv[i] + 6, log_level_name((LogLevel)level)) == 0)
+          break;
+      if (level > e_log_debug)
+      {
+        log_error(e_err_args, "log level must be off, error, warn, info or debug, got %s", argv[i] + 6);
+        return -1;
+      }
+      opts->log_level = (LogLevel)level;
+    }
+    else if (strcmp(argv[i], "--log-json") == 0)
+      opts->log_json = 1;
+    else
+    {
+      log_error(e_err_args, "Unknown option %s", argv[i]);
+      return -1;
+    }
+  }
+  if (opts->pixel_layout && opts->embed_mode != e_embed_pixel)
+  {
+    log_error(e_err_args, "--channels and --bit-order need --mode=pixel");
+    return -1;
+  }
+  // the parameter that goes with the mode; pixel mode adds the
+  // cover's bytes per pixel once the cover is open
+  opts->embed_param = opts->embed_mode == e_embed_pixel ? opts->pixel_bits | opts->pixel_layout : opts->matrix_rate;
+  argv[kept] = NULL;
+  return kept;
+}
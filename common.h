@@ -1,9 +1,94 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include "types.h" // Contains user defined types
+#include "log.h" // Log levels
+
 /* Magic string to identify whether stegged or not */
 //#define MAGIC_STRING "#*"
 extern char MAGIC_STRING[20];
-#endif
 
- 
\ No newline at end of file
+/* Longest magic string the 20 byte buffers can hold */
+#define MAX_MAGIC_STRING_LEN 19
+
+/* Worst case embedded header: magic, extn size, extn, 64-bit file size, digest */
+#define MAX_STEGO_HEADER_BYTES (MAX_MAGIC_STRING_LEN + 4 + 4 + 8 + 4)
+
+/* Secret bytes handed to the embed kernels per call */
+#define STEGO_CHUNK_SIZE 4096
+
+/*
+ * The 4 byte extension size field doubles as the format word:
+ * low byte is the extension length, the next byte the embedding
+ * mode of the secret data and the one after that its parameter.
+ * Parameter bits 8-11 (the pixel channel mask) ride in the top
+ * nibble of the mode byte. Images from before embedding modes
+ * carry 4 (plain LSB).
+ */
+#define STEGO_FORMAT_WORD(extn_len, mode, param) \
+  ((extn_len) | ((mode) << 8) | (((param) & 0xff) << 16) | (((param) >> 8 & 0xf) << 12))
+#define STEGO_FORMAT_EXTN_LEN(word) ((word) & 0xff)
+#define STEGO_FORMAT_MODE(word) (((word) >> 8) & 0xf)
+#define STEGO_FORMAT_PARAM(word) ((((word) >> 16) & 0xff) | (((word) >> 12 & 0xf) << 8))
+#define STEGO_FORMAT_FLAGS(word) (((word) >> 24) & 0xff)
+
+/* Format flags, top byte of the format word */
+#define STEGO_FLAG_DIGEST (1u << 24) // CRC-32C of the secret follows the file size
+#define STEGO_FLAG_CONTAINER (1u << 25) // secret data is a multi-file container
+#define STEGO_FLAG_SIZE64 (1u << 26) // file size field is 8 bytes instead of 4
+#define STEGO_FLAG_STRIDE (1u << 27) // a stride field follows the digest, secret data is spread
+#define STEGO_KNOWN_FLAGS (STEGO_FLAG_DIGEST | STEGO_FLAG_CONTAINER | STEGO_FLAG_SIZE64 | STEGO_FLAG_STRIDE)
+
+/*
+ * Largest secret the 4 byte file size field holds (decoders
+ * before STEGO_FLAG_SIZE64 read it as an int). Bigger secrets
+ * get the flag and an 8 byte field; smaller ones keep the old
+ * layout.
+ */
+#define STEGO_MAX_SIZE32 0x7fffffffULL
+#define STEGO_SIZE_FIELD_BYTES(flags) (((flags) & STEGO_FLAG_SIZE64) ? 8 : 4)
+
+/*
+ * Spread embedding (--spread): the image bytes that carry the
+ * secret data are placed every stride units instead of back to
+ * back, so the payload covers the whole pixel array. A unit is
+ * one byte, or one pixel in pixel mode. The stride is the 4 byte
+ * field after the digest. Chunks whose strided span fits
+ * STEGO_SPREAD_WINDOW are read and written in one piece.
+ */
+#define STEGO_STRIDE_FIELD_BYTES 4
+#define STEGO_SPREAD_WINDOW (STEGO_CHUNK_SIZE * 4)
+
+/* "--name[=value]" options accepted after the operation flag */
+typedef struct _StegoOptions
+{
+    /* --mode, and --rate (matrix) or --bits, --channels and --bit-order (pixel) as its parameter */
+    EmbedMode embed_mode;
+    uint embed_param;
+    uint matrix_rate;
+    uint pixel_bits;
+    uint pixel_layout;
+
+    /* --spread, secret data spread across the whole image */
+    int spread;
+
+    /* --verify[=crc32c] */
+    int verify;
+    int has_expected_digest;
+    uint expected_digest;
+
+    /* --repeat=N, daemon client requests to send */
+    uint repeat;
+
+    /* --cache-mb=N, daemon cover cache budget in bytes (0 = default) */
+    unsigned long long cache_budget;
+
+    /* --quiet, --verbose or --log=LEVEL, and --log-json */
+    LogLevel log_level;
+    int log_json;
+} StegoOptions;
+
+/* Remove the "--" options from argv, returns the new argc or -1 */
+int strip_stego_options(int argc, char *argv[], StegoOptions *opts);
+
+#endif
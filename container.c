@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "container.h"
+#include "log.h"
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "types.h"
+#include "bmp.h"
+#include "kernel.h"
+#include "crc32c.h"
+
+/*
+ * Function: container_put_u32
+ * ---------------------------
+ * Stores a little endian 32 bit field
+ */
+static void container_put_u32(unsigned char *buf, uint value)
+{
+  buf[0] = value & 0xff;
+  buf[1] = (value >> 8) & 0xff;
+  buf[2] = (value >> 16) & 0xff;
+  buf[3] = (value >> 24) & 0xff;
+}
+
+/*
+ * Function: container_build
+ * -------------------------
+ * Writes the container for files[] into fptr_out: the
+ * directory first, then every file back to back. The
+ * directory is written last, once the lengths and CRCs are
+ * known, into the space reserved for it. The entries, the
+ * directory and the copy buffer come from arena. Entry names
+ * are the base names of the files and must be unique.
+ *
+ * Returns: e_success, or e_failure on file errors, limits or
+ * duplicate names
+ */
+Status container_build(char *files[], uint n_files, FILE *fptr_out, Container *container, Arena *arena)
+{
+  memset(container, 0, sizeof(*container));
+  if (n_files == 0 || n_files > CONTAINER_MAX_ENTRIES)
+  {
+    log_error(e_err_args, "a container holds 1 to %d files", CONTAINER_MAX_ENTRIES);
+    return e_failure;
+  }
+  container->entries = arena_alloc(arena, n_files * sizeof(ContainerEntry));
+  unsigned char *buffer = arena_alloc(arena, STEGO_CHUNK_SIZE);
+  if (container->entries == NULL || buffer == NULL)
+  {
+    log_error(e_err_memory, "Memory alocation failed");
+    return e_failure;
+  }
+  container->n_entries = n_files;
+
+  // entries are named by the file's base name
+  unsigned long long dir_size = CONTAINER_DIR_HEADER_SIZE;
+  for (uint i = 0; i < n_files; i++)
+  {
+    const char *name = strrchr(files[i], '/');
+    name = name ? name + 1 : files[i];
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > CONTAINER_MAX_NAME)
+    {
+      log_error(e_err_args, "bad container entry name %s", files[i]);
+      return e_failure;
+    }
+    // extract finds an entry by name, a second one could never be reached
+    for (uint j = 0; j < i; j++)
+    {
+      if (strcmp(container->entries[j].name, name) == 0)
+      {
+        log_error(e_err_args, "%s and %s have the same container entry name %s", files[j], files[i], name);
+        return e_failure;
+      }
+    }
+    container->entries[i].name = name;
+    dir_size += CONTAINER_ENTRY_FIXED_SIZE + name_len;
+  }
+  container->dir_size = (uint)dir_size;
+
+  unsigned long long offset = dir_size;
+  fseek(fptr_out, dir_size, SEEK_SET);
+  for (uint i = 0; i < n_files; i++)
+  {
+    FILE *fptr = fopen(files[i], "rb");
+    if (fptr == NULL)
+    {
+      log_error(e_err_io, "Unable to open file %s: %s", files[i], strerror(errno));
+      return e_failure;
+    }
+    uint crc = CRC32C_INIT;
+    unsigned long long length = 0;
+    size_t count;
+    while ((count = fread(buffer, sizeof(char), STEGO_CHUNK_SIZE, fptr)) > 0)
+    {
+      crc = crc32c_update(crc, buffer, count);
+      if (fwrite(buffer, sizeof(char), count, fptr_out) != count)
+      {
+        fclose(fptr);
+        return e_failure;
+      }
+      length += count;
+    }
+    fclose(fptr);
+
+    container->entries[i].offset = (uint)offset;
+    container->entries[i].length = (uint)length;
+    container->entries[i].digest = crc32c_final(crc);
+    offset += length;
+    // directory offsets and lengths are 4 byte fields
+    if (offset > 0xffffffffULL)
+    {
+      log_error(e_err_capacity, "container is larger than %u bytes", 0xffffffffu);
+      return e_failure;
+    }
+  }
+
+  unsigned char *dir = arena_alloc(arena, dir_size);
+  if (dir == NULL)
+  {
+    log_error(e_err_memory, "Memory alocation failed");
+    return e_failure;
+  }
+  unsigned char *p = dir + CONTAINER_DIR_HEADER_SIZE;
+  for (uint i = 0; i < n_files; i++)
+  {
+    ContainerEntry *entry = &container->entries[i];
+    uint name_len = strlen(entry->name);
+    container_put_u32(p, entry->offset);
+    container_put_u32(p + 4, entry->length);
+    container_put_u32(p + 8, entry->digest);
+    p[12] = (unsigned char)name_len;
+    memcpy(p + CONTAINER_ENTRY_FIXED_SIZE, entry->name, name_len);
+    p += CONTAINER_ENTRY_FIXED_SIZE + name_len;
+  }
+  container_put_u32(dir, n_files);
+  container_put_u32(dir + 4, (uint)dir_size);
+  container_put_u32(dir + 8, crc32c_final(crc32c_update(CRC32C_INIT, dir + CONTAINER_DIR_HEADER_SIZE, dir_size - CONTAINER_DIR_HEADER_SIZE)));
+
+  fseek(fptr_out, 0, SEEK_SET);
+  return fwrite(dir, sizeof(char), dir_size, fptr_out) == dir_size ? e_success : e_failure;
+}
+
+/*
+ * Function: container_read_range
+ * ------------------------------
+ * Extracts secret bytes [offset, offset + size) without touching
+ * the image bytes before them. The secret was embedded in
+ * kernel chunks of embed_chunk_size bytes, each taking
+ * embed_image_bytes image bytes, so the read starts at the
+ * chunk holding offset and skips into it.
+ *
+ * buffer: Receives the bytes, if not NULL
+ * fptr_out: Receives the bytes, if not NULL
+ * digest: CRC-32C of the bytes, if not NULL
+ *
+ * Returns: e_success, or e_failure on a short image or bad range
+ */
+Status container_read_range(DecodeInfo *decInfo, off_t data_pos, uint offset, uint size, unsigned char *buffer, FILE *fptr_out, uint *digest)
+{
+  uint64 total = decInfo->size_secret_file;
+  if (offset > total || size > total - offset)
+  {
+    log_error(e_err_container, "Container range %u+%u is outside the secret data", offset, size);
+    return e_failure;
+  }
+  // chunk buffers come from the job arena
+  if (decInfo->image_chunk == NULL)
+  {
+    decInfo->image_chunk = arena_alloc(&decInfo->arena, STEGO_CHUNK_SIZE * 8);
+    decInfo->secret_chunk = arena_alloc(&decInfo->arena, STEGO_CHUNK_SIZE);
+    if (decInfo->image_chunk == NULL || decInfo->secret_chunk == NULL)
+    {
+      log_error(e_err_memory, "Memory alocation failed");
+      return e_failure;
+    }
+  }
+
+  EmbedMode mode = decInfo->embed_mode;
+  uint param = decInfo->embed_param;
+  uint chunk_size = embed_chunk_size(mode, param);
+  uint64 pos = offset / chunk_size * chunk_size;
+  off_t image_pos = data_pos + (off_t)(pos / chunk_size * embed_image_bytes(mode, param, chunk_size));
+  fseeko(decInfo->fptr_stego_image, image_pos, SEEK_SET);
+
+  uint crc = CRC32C_INIT;
+  uint done = 0;
+  while (done < size)
+  {
+    uint count = chunk_size;
+    if (total - pos < count)
+      count = (uint)(total - pos);
+    uint image_bytes = embed_image_bytes(mode, param, count);
+    if (fread(decInfo->image_chunk, sizeof(char), image_bytes, decInfo->fptr_stego_image) != image_bytes)
+    {
+      log_error(e_err_io, "Stego image ends before the secret data");
+      return e_failure;
+    }
+    decInfo->kernel->extract(decInfo->image_chunk, count, decInfo->secret_chunk);
+
+    // the part of this chunk inside the range
+    uint skip = (uint)(offset + done - pos);
+    uint take = count - skip;
+    if (take > size - done)
+      take = size - done;
+    if (buffer)
+      memcpy(buffer + done, decInfo->secret_chunk + skip, take);
+    if (fptr_out && fwrite(decInfo->secret_chunk + skip, sizeof(char), take, fptr_out) != take)
+    {
+      log_error(e_err_io, "unable to write %s: %s", decInfo->decode_fname, strerror(errno));
+      return e_failure;
+    }
+    crc = crc32c_update(crc, decInfo->secret_chunk + skip, take);
+    done += take;
+    pos += count;
+  }
+  if (digest)
+    *digest = crc32c_final(crc);
+  return e_success;
+}
+
+/*
+ * Function: container_read_directory
+ * ----------------------------------
+ * Reads and checks the directory at the front of the secret
+ * data into the job arena. Every entry must lie after the
+ * directory and inside the secret data. Entry names stay in
+ * the directory buffer and are terminated in place.
+ *
+ * Returns: e_success, or e_failure if the image holds no
+ * container or the directory is damaged
+ */
+Status container_read_directory(DecodeInfo *decInfo, off_t data_pos, Container *container)
+{
+  unsigned char header[CONTAINER_DIR_HEADER_SIZE];
+  memset(container, 0, sizeof(*container));
+  if (!(decInfo->format_flags & STEGO_FLAG_CONTAINER))
+  {
+    log_error(e_err_container, "%s does not hold a container", decInfo->stego_image_fname);
+    return e_failure;
+  }
+  // entries are found by chunk arithmetic on packed data
+  if (decInfo->format_flags & STEGO_FLAG_STRIDE)
+  {
+    log_error(e_err_container, "%s holds a spread container, which is not supported", decInfo->stego_image_fname);
+    return e_failure;
+  }
+  if (container_read_range(decInfo, data_pos, 0, CONTAINER_DIR_HEADER_SIZE, header, NULL, NULL) != e_success)
+    return e_failure;
+
+  uint n_entries = bmp_read_u32(header);
+  uint dir_size = bmp_read_u32(header + 4);
+  uint dir_digest = bmp_read_u32(header + 8);
+  if (n_entries == 0 || n_entries > CONTAINER_MAX_ENTRIES ||
+      dir_size < CONTAINER_DIR_HEADER_SIZE + n_entries * (CONTAINER_ENTRY_FIXED_SIZE + 1) ||
+      dir_size > decInfo->size_secret_file || dir_size > CONTAINER_MAX_DIR_SIZE)
+  {
+    log_error(e_err_container, "Invalide container directory : %u entries in %u bytes", n_entries, dir_size);
+    return e_failure;
+  }
+
+  // one spare byte terminates the last name
+  unsigned char *dir = arena_alloc(&decInfo->arena, dir_size + 1);
+  container->entries = arena_alloc(&decInfo->arena, n_entries * sizeof(ContainerEntry));
+  if (dir == NULL || container->entries == NULL)
+  {
+    log_error(e_err_memory, "Memory alocation failed");
+    return e_failure;
+  }
+  if (container_read_range(decInfo, data_pos, 0, dir_size, dir, NULL, NULL) != e_success)
+    return e_failure;
+  if (crc32c_final(crc32c_update(CRC32C_INIT, dir + CONTAINER_DIR_HEADER_SIZE, dir_size - CONTAINER_DIR_HEADER_SIZE)) != dir_digest)
+  {
+    log_error(e_err_digest, "Container directory digest mismatch");
+    return e_failure;
+  }
+
+  // a name is followed by the next entry's first field, so it is
+  // terminated only once that entry has been read
+  unsigned char *p = dir + CONTAINER_DIR_HEADER_SIZE;
+  unsigned char *end = dir + dir_size;
+  for (uint i = 0; i < n_entries; i++)
+  {
+    ContainerEntry *entry = &container->entries[i];
+    if (end - p < CONTAINER_ENTRY_FIXED_SIZE || p[12] == 0 || end - p - CONTAINER_ENTRY_FIXED_SIZE < p[12])
+    {
+      log_error(e_err_container, "Invalide container entry %u", i);
+      return e_failure;
+    }
+    entry->offset = bmp_read_u32(p);
+    entry->length = bmp_read_u32(p + 4);
+    entry->digest = bmp_read_u32(p + 8);
+    entry->name = (const char *)p + CONTAINER_ENTRY_FIXED_SIZE;
+    unsigned char name_len = p[12];
+    *p = '\0';
+    p += CONTAINER_ENTRY_FIXED_SIZE + name_len;
+  }
+  *end = '\0';
+
+  for (uint i = 0; i < n_entries; i++)
+  {
+    ContainerEntry *entry = &container->entries[i];
+    if (entry->offset < dir_size || entry->offset > decInfo->size_secret_file ||
+        entry->length > decInfo->size_secret_file - entry->offset)
+    {
+      log_error(e_err_container, "Invalide container entry %s : %u+%u", entry->name, entry->offset, entry->length);
+      return e_failure;
+    }
+  }
+  container->n_entries = n_entries;
+  container->dir_size = dir_size;
+  return e_success;
+}
+
+/*
+ * Function: do_container_encode
+ * -----------------------------
+ * Bundles the files after the two image names into a
+ * container and embeds it like a single secret.
+ */
+Status do_container_encode(char *argv[], EncodeInfo *encInfo)
+{
+  Container container;
+  char *dot;
+  memset(&container, 0, sizeof(container));
+  if ((dot = strstr(argv[2], ".")) == NULL || strcmp(dot, ".bmp") != 0 ||
+      (dot = strstr(argv[3], ".")) == NULL || strcmp(dot, ".bmp") != 0)
+  {
+    log_error(e_err_args, "source and stego image files should be .bmp");
+    return e_failure;
+  }
+  encInfo->src_image_fname = argv[2];
+  encInfo->stego_image_fname = argv[3];
+  encInfo->secret_fname = "container";
+  strcpy(encInfo->extn_secret_file, CONTAINER_EXTN);
+  encInfo->format_flags = STEGO_FLAG_CONTAINER;
+  // entries are read back by offset, which needs packed data
+  if (encInfo->spread)
+    log_warn(e_err_args, "--spread is ignored for containers");
+  encInfo->spread = 0;
+
+  uint n_files = 0;
+  while (argv[4 + n_files])
+    n_files++;
+
+  Status status = e_failure;
+  encInfo->fptr_secret = tmpfile();
+  if (encInfo->fptr_secret == NULL)
+  {
+    log_error(e_err_io, "Unable to create a temporary file: %s", strerror(errno));
+  }
+  else if (container_build(argv + 4, n_files, encInfo->fptr_secret, &container, &encInfo->arena) == e_success)
+  {
+    log_info("container of %u files built successfully", n_files);
+    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
+    if (encInfo->fptr_src_image == NULL)
+    {
+      log_error(e_err_io, "Unable to open file %s: %s", encInfo->src_image_fname, strerror(errno));
+    }
+    else if ((encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "wb")) == NULL)
+    {
+      log_error(e_err_io, "Unable to open file %s: %s", encInfo->stego_image_fname, strerror(errno));
+    }
+    else
+    {
+      status = do_encoding(encInfo);
+    }
+  }
+  if (status == e_success)
+  {
+    for (uint i = 0; i < container.n_entries; i++)
+      printf("added %s, %u bytes, crc32c %08x\n", container.entries[i].name, container.entries[i].length, container.entries[i].digest);
+  }
+
+  // do_encoding leaves the streams open when it fails
+  if (encInfo->fptr_src_image)
+    fclose(encInfo->fptr_src_image);
+  if (encInfo->fptr_secret)
+    fclose(encInfo->fptr_secret);
+  if (encInfo->fptr_stego_image)
+    fclose(encInfo->fptr_stego_image);
+  encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+  return status;
+}
+
+/*
+ * Function: container_open
+ * ------------------------
+ * Opens a stego image, decodes its header and directory
+ *
+ * data_pos: Set to the image offset of the secret data
+ */
+static Status container_open(char *argv[], DecodeInfo *decInfo, Container *container, off_t *data_pos)
+{
+  memset(container, 0, sizeof(*container));
+  decInfo->stego_image_fname = argv[2];
+  decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb");
+  if (decInfo->fptr_stego_image == NULL)
+  {
+    log_error(e_err_io, "unable to open file %s: %s", decInfo->stego_image_fname, strerror(errno));
+    return e_failure;
+  }
+  if (decode_stego_header(decInfo) != e_success)
+    return e_failure;
+  *data_pos = ftello(decInfo->fptr_stego_image);
+  return container_read_directory(decInfo, *data_pos, container);
+}
+
+/*
+ * Function: do_container_list
+ * ---------------------------
+ * Prints the directory of a container image
+ */
+Status do_container_list(char *argv[], DecodeInfo *decInfo)
+{
+  Container container;
+  off_t data_pos;
+  Status status = container_open(argv, decInfo, &container, &data_pos);
+  if (status == e_success)
+  {
+    for (uint i = 0; i < container.n_entries; i++)
+      printf("%-32s %10u bytes  crc32c %08x\n", container.entries[i].name, container.entries[i].length, container.entries[i].digest);
+    printf("%u files, %llu bytes\n", container.n_entries, decInfo->size_secret_file);
+  }
+  if (decInfo->fptr_stego_image)
+    fclose(decInfo->fptr_stego_image);
+  decInfo->fptr_stego_image = NULL;
+  return status;
+}
+
+/*
+ * Function: do_container_extract
+ * ------------------------------
+ * Writes one entry of a container image to argv[4], or to a
+ * file named after the entry, and checks its CRC-32C. The
+ * entry goes through decode_open_output like a decoded secret,
+ * so the file only appears, or replaces an existing one, once
+ * the CRC matched.
+ */
+Status do_container_extract(char *argv[], DecodeInfo *decInfo)
+{
+  Container container;
+  off_t data_pos;
+  Status status = container_open(argv, decInfo, &container, &data_pos);
+  if (status == e_success)
+  {
+    status = e_failure;
+    ContainerEntry *entry = NULL;
+    for (uint i = 0; i < container.n_entries && entry == NULL; i++)
+      if (strcmp(container.entries[i].name, argv[3]) == 0)
+        entry = &container.entries[i];
+
+    // an entry name never leaves the current directory
+    char *out_fname = argv[4] ? argv[4] : argv[3];
+    if (entry == NULL)
+    {
+      log_error(e_err_container, "%s is not in the container", argv[3]);
+    }
+    else if (argv[4] == NULL && (strchr(entry->name, '/') || strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0))
+    {
+      log_error(e_err_args, "entry name %s is not a plain file name, give an output file", entry->name);
+    }
+    else
+    {
+      decInfo->decode_fname = out_fname;
+      decInfo->fptr_decode = NULL;
+      if (decode_open_output(decInfo) == e_success)
+      {
+        uint digest = 0;
+        if (container_read_range(decInfo, data_pos, entry->offset, entry->length, NULL, decInfo->fptr_decode, &digest) == e_success)
+        {
+          if (digest == entry->digest)
+            status = decode_commit_output(decInfo);
+          else
+            log_error(e_err_digest, "Container entry digest mismatch:expected %08x got %08x", entry->digest, digest);
+        }
+        if (status == e_success)
+          printf("extracted %s to %s, %u bytes, crc32c %08x\n", entry->name, out_fname, entry->length, digest);
+        else
+          decode_discard_output(decInfo);
+      }
+    }
+  }
+  if (decInfo->fptr_stego_image)
+    fclose(decInfo->fptr_stego_image);
+  decInfo->fptr_stego_image = NULL;
+  return status;
+}
@@ -0,0 +1,77 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+#include "encode.h"
+#include "decode.h"
+#include "arena.h"
+#include "common.h"
+
+/*
+ * Multi-file container.
+ * Several named files embedded as one secret, flagged with
+ * STEGO_FLAG_CONTAINER in the format word. The secret data
+ * starts with a directory, followed by the files back to back:
+ *
+ *   entry count, directory size, CRC-32C of the entries (4 bytes each)
+ *   per entry: offset, length, CRC-32C (4 bytes each), name length (1), name
+ *
+ * Offsets count from the start of the secret data. All fields
+ * are little endian. Listing reads only the directory and
+ * extracting reads only the image bytes of one entry.
+ */
+
+#define CONTAINER_EXTN ".ctr"
+#define CONTAINER_MAX_ENTRIES 4096
+#define CONTAINER_MAX_NAME 255
+#define CONTAINER_DIR_HEADER_SIZE 12
+#define CONTAINER_ENTRY_FIXED_SIZE 13
+#define CONTAINER_MAX_DIR_SIZE (CONTAINER_DIR_HEADER_SIZE + CONTAINER_MAX_ENTRIES * (CONTAINER_ENTRY_FIXED_SIZE + CONTAINER_MAX_NAME))
+
+/*
+ * The directory, its entries and the copy buffer come from the
+ * job arena; a container job needs room for the largest
+ * directory on top of the usual chunk buffers.
+ */
+#define CONTAINER_ARENA_SIZE (ARENA_DEFAULT_SIZE + STEGO_CHUNK_SIZE + CONTAINER_MAX_DIR_SIZE + 1 + \
+                              CONTAINER_MAX_ENTRIES * sizeof(ContainerEntry) + 4 * ARENA_ALIGN)
+
+typedef struct _ContainerEntry
+{
+    /* Base name of the file when building, inside the directory when reading */
+    const char *name;
+    uint offset;
+    uint length;
+    uint digest;
+} ContainerEntry;
+
+typedef struct _Container
+{
+    ContainerEntry *entries;
+    uint n_entries;
+    uint dir_size;
+} Container;
+
+
+/* Container function prototype */
+
+/* Write the directory and files[] into fptr_out, scratch from arena */
+Status container_build(char *files[], uint n_files, FILE *fptr_out, Container *container, Arena *arena);
+
+/* Read the directory of a decoded header; data_pos is the image offset of the secret data */
+Status container_read_directory(DecodeInfo *decInfo, off_t data_pos, Container *container);
+
+/* Extract secret bytes [offset, offset + size) to buffer and/or fptr_out, with their CRC-32C */
+Status container_read_range(DecodeInfo *decInfo, off_t data_pos, uint offset, uint size, unsigned char *buffer, FILE *fptr_out, uint *digest);
+
+/* Bundle "-m cover.bmp stego.bmp file..." */
+Status do_container_encode(char *argv[], EncodeInfo *encInfo);
+
+/* List "-l stego.bmp" */
+Status do_container_list(char *argv[], DecodeInfo *decInfo);
+
+/* Extract "-x stego.bmp name [output]" */
+Status do_container_extract(char *argv[], DecodeInfo *decInfo);
+
+#endif
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cover_cache.h"
+#include "log.h"
+#include "bmp.h"
+#include "types.h"
+
+/*
+ * Function: cover_cache_hash
+ * --------------------------
+ * FNV-1a of the path, reduced to a bucket index
+ */
+static uint cover_cache_hash(const char *path)
+{
+  uint hash = 2166136261u;
+  for (; *path; path++)
+  {
+    hash ^= (unsigned char)*path;
+    hash *= 16777619u;
+  }
+  return hash % COVER_CACHE_BUCKETS;
+}
+
+/*
+ * Function: cover_cache_release
+ * -----------------------------
+ * Drops one reference, the last one frees the cover.
+ * Caller holds the cache lock.
+ */
+static void cover_cache_release(CachedCover *cover)
+{
+  if (--cover->refs == 0)
+    free(cover);
+}
+
+static CachedCover *cover_cache_lookup(CoverCache *cache, const char *path)
+{
+  CachedCover *cover = cache->buckets[cover_cache_hash(path)];
+  while (cover && strcmp(cover->path, path) != 0)
+    cover = cover->hash_next;
+  return cover;
+}
+
+/*
+ * Function: cover_cache_unlist
+ * ----------------------------
+ * Takes a cover off the hash chain and the LRU list and drops
+ * the cache's reference to it
+ */
+static void cover_cache_unlist(CoverCache *cache, CachedCover *cover)
+{
+  CachedCover **link = &cache->buckets[cover_cache_hash(cover->path)];
+  while (*link != cover)
+    link = &(*link)->hash_next;
+  *link = cover->hash_next;
+
+  if (cover->prev)
+    cover->prev->next = cover->next;
+  else
+    cache->head = cover->next;
+  if (cover->next)
+    cover->next->prev = cover->prev;
+  else
+    cache->tail = cover->prev;
+
+  cache->stats.bytes -= cover->size;
+  cache->stats.entries--;
+  cover_cache_release(cover);
+}
+
+/*
+ * Function: cover_cache_touch
+ * ---------------------------
+ * Moves a cover to the front of the LRU list
+ */
+static void cover_cache_touch(CoverCache *cache, CachedCover *cover)
+{
+  if (cache->head == cover)
+    return;
+  cover->prev->next = cover->next;
+  if (cover->next)
+    cover->next->prev = cover->prev;
+  else
+    cache->tail = cover->prev;
+  cover->prev = NULL;
+  cover->next = cache->head;
+  cache->head->prev = cover;
+  cache->head = cover;
+}
+
+/*
+ * Function: cover_cache_insert
+ * ----------------------------
+ * Lists a cover as most recently used, evicting from the tail
+ * until it fits the budget. Covers larger than the whole
+ * budget are not listed.
+ */
+static void cover_cache_insert(CoverCache *cache, CachedCover *cover)
+{
+  if ((unsigned long long)cover->size > cache->stats.budget)
+    return;
+  while (cache->stats.bytes + cover->size > cache->stats.budget)
+  {
+    cover_cache_unlist(cache, cache->tail);
+    cache->stats.evictions++;
+  }
+
+  uint bucket = cover_cache_hash(cover->path);
+  cover->hash_next = cache->buckets[bucket];
+  cache->buckets[bucket] = cover;
+  cover->prev = NULL;
+  cover->next = cache->head;
+  if (cache->head)
+    cache->head->prev = cover;
+  else
+    cache->tail = cover;
+  cache->head = cover;
+
+  cover->refs++;
+  cache->stats.bytes += cover->size;
+  cache->stats.entries++;
+}
+
+/*
+ * Function: cover_cache_load
+ * --------------------------
+ * Reads a whole cover and validates its BMP header. The entry,
+ * its path and the file data share one allocation, so a miss
+ * costs a single malloc and a hit none.
+ */
+static CachedCover *cover_cache_load(const char *path, long long mtime, long long size)
+{
+  if (size < BMP_HEADER_SIZE)
+    return NULL;
+
+  // path after the struct, data 16 byte aligned after the path
+  size_t path_size = (strlen(path) + 1 + 15) & ~(size_t)15;
+  size_t head_size = (sizeof(CachedCover) + 15) & ~(size_t)15;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  CachedCover *cover = malloc(head_size + path_size + size);
+  if (cover == NULL)
+  {
+    close(fd);
+    return NULL;
+  }
+  memset(cover, 0, sizeof(*cover));
+  cover->path = (char *)cover + head_size;
+  strcpy(cover->path, path);
+  cover->data = (unsigned char *)cover + head_size + path_size;
+
+  long long done = 0;
+  while (done < size)
+  {
+    ssize_t n = pread(fd, cover->data + done, size - done, done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  close(fd);
+
+  cover->mtime = mtime;
+  cover->size = done;
+  cover->refs = 1;
+  if (done < BMP_HEADER_SIZE || parse_bmp_header(cover->data, &cover->bmp) != e_success)
+  {
+    log_error(e_err_format, "%s is not a BMP image", path);
+    cover_cache_release(cover);
+    return NULL;
+  }
+  return cover;
+}
+
+/*
+ * Function: cover_cache_init
+ * --------------------------
+ * Sets up an empty cache
+ *
+ * Returns: e_success, or e_failure if the lock cannot be created
+ */
+Status cover_cache_init(CoverCache *cache, unsigned long long budget)
+{
+  memset(cache, 0, sizeof(*cache));
+  cache->stats.budget = budget;
+  if (pthread_mutex_init(&cache->lock, NULL) != 0)
+    return e_failure;
+  return e_success;
+}
+
+/*
+ * Function: cover_cache_get
+ * -------------------------
+ * Looks the cover up by path and checks it against the file's
+ * current mtime and size. A stale or missing cover is read
+ * outside the lock and then listed, replacing any copy another
+ * job listed meanwhile unless that one is already current.
+ *
+ * hit: Set to 1 when the cover came from the cache
+ *
+ * Returns: cover with one reference owned by the caller, or NULL
+ */
+CachedCover *cover_cache_get(CoverCache *cache, const char *path, uint *hit)
+{
+  struct stat st;
+  *hit = 0;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    return NULL;
+  long long mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+  pthread_mutex_lock(&cache->lock);
+  CachedCover *cover = cover_cache_lookup(cache, path);
+  if (cover && cover->mtime == mtime && cover->size == (long long)st.st_size)
+  {
+    cover_cache_touch(cache, cover);
+    cover->refs++;
+    cache->stats.hits++;
+    pthread_mutex_unlock(&cache->lock);
+    *hit = 1;
+    return cover;
+  }
+  cache->stats.misses++;
+  pthread_mutex_unlock(&cache->lock);
+
+  CachedCover *loaded = cover_cache_load(path, mtime, st.st_size);
+  if (loaded == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&cache->lock);
+  cover = cover_cache_lookup(cache, path);
+  if (cover && cover->mtime == loaded->mtime && cover->size == loaded->size)
+  {
+    cover->refs++;
+    cover_cache_release(loaded);
+    loaded = cover;
+  }
+  else
+  {
+    if (cover)
+      cover_cache_unlist(cache, cover);
+    cover_cache_insert(cache, loaded);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return loaded;
+}
+
+/*
+ * Function: cover_cache_put
+ * -------------------------
+ * Returns the caller's reference
+ */
+void cover_cache_put(CoverCache *cache, CachedCover *cover)
+{
+  pthread_mutex_lock(&cache->lock);
+  cover_cache_release(cover);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void cover_cache_stats(CoverCache *cache, CoverCacheStats *stats)
+{
+  pthread_mutex_lock(&cache->lock);
+  *stats = cache->stats;
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void cover_cache_free(CoverCache *cache)
+{
+  pthread_mutex_lock(&cache->lock);
+  while (cache->head)
+    cover_cache_unlist(cache, cache->head);
+  pthread_mutex_unlock(&cache->lock);
+  pthread_mutex_destroy(&cache->lock);
+}
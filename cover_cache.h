@@ -0,0 +1,77 @@
+#ifndef COVER_CACHE_H
+#define COVER_CACHE_H
+
+#include <pthread.h>
+#include "types.h" // Contains user defined types
+#include "bmp.h" // Parsed BMP header
+
+/*
+ * In-memory cache of cover images, keyed by path, mtime and
+ * size. Each entry holds the whole file (header and pixels)
+ * and its parsed header, so repeat encodes into the same
+ * cover neither read nor re-validate it. The total size is
+ * kept under a byte budget by evicting the least recently
+ * used entry. Entries are refcounted: an evicted cover stays
+ * valid until the last job using it puts it back.
+ */
+
+#define COVER_CACHE_BUCKETS 256
+#define COVER_CACHE_DEFAULT_BUDGET (256u << 20)
+
+typedef struct _CachedCover
+{
+    char *path;
+    long long mtime;
+    long long size;
+
+    /* Whole file and its parsed header */
+    unsigned char *data;
+    BmpInfo bmp;
+
+    /* Users plus one for the cache itself while it is listed */
+    uint refs;
+
+    /* LRU list, most recent first, and hash chain */
+    struct _CachedCover *prev;
+    struct _CachedCover *next;
+    struct _CachedCover *hash_next;
+} CachedCover;
+
+typedef struct _CoverCacheStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long bytes;
+    unsigned long long budget;
+    uint entries;
+} CoverCacheStats;
+
+typedef struct _CoverCache
+{
+    pthread_mutex_t lock;
+    CachedCover *buckets[COVER_CACHE_BUCKETS];
+    CachedCover *head;
+    CachedCover *tail;
+    CoverCacheStats stats;
+} CoverCache;
+
+
+/* Cover cache function prototype */
+
+/* Empty cache holding at most budget bytes */
+Status cover_cache_init(CoverCache *cache, unsigned long long budget);
+
+/* Cover for path, loaded on a miss; *hit tells which. NULL if unreadable or not a BMP */
+CachedCover *cover_cache_get(CoverCache *cache, const char *path, uint *hit);
+
+/* Give back a cover returned by cover_cache_get */
+void cover_cache_put(CoverCache *cache, CachedCover *cover);
+
+/* Snapshot of the counters */
+void cover_cache_stats(CoverCache *cache, CoverCacheStats *stats);
+
+/* Drop every entry; covers still in use are freed by their last put */
+void cover_cache_free(CoverCache *cache);
+
+#endif
@@ -0,0 +1,705 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "cover_index.h"
+#include "log.h"
+#include "encode.h"
+#include "bmp.h"
+#include "kernel.h"
+#include "common.h"
+#include "types.h"
+
+/* Bytes of one saved entry before its name */
+#define COVER_RECORD_SIZE (sizeof(long long) + 2 * sizeof(uint64) + 3 * sizeof(uint) + \
+                           e_embed_mode_count * sizeof(uint64) + sizeof(unsigned short))
+
+/* Shared state of the scan worker threads */
+typedef struct _CoverScan
+{
+    const char *dir_name;
+    char **names;
+    char *name_pool;
+    uint n_names;
+    CoverEntry *entries;
+    char *valid;
+
+    /* Previous index entries sorted by name, for reuse */
+    CoverEntry **old_by_name;
+    uint n_old;
+
+    /* Next name to claim, and result counters */
+    uint next;
+    uint n_scanned;
+    uint n_reused;
+    uint n_rejected;
+
+} CoverScan;
+
+/*
+ * Function: compare_by_name / compare_by_capacity
+ * -----------------------------------------------
+ * qsort/bsearch helpers. The index is ordered by the LSB
+ * capacity; the byte oriented modes' capacity grows with the
+ * pixel data size so the same order serves them all.
+ */
+static int compare_by_name(const void *a, const void *b)
+{
+  const CoverEntry *ea = *(CoverEntry *const *)a;
+  const CoverEntry *eb = *(CoverEntry *const *)b;
+  return strcmp(ea->name, eb->name);
+}
+
+static int compare_name_key(const void *key, const void *elem)
+{
+  const CoverEntry *e = *(CoverEntry *const *)elem;
+  return strcmp((const char *)key, e->name);
+}
+
+static int compare_by_capacity(const void *a, const void *b)
+{
+  const CoverEntry *ea = a;
+  const CoverEntry *eb = b;
+  if (ea->capacity[e_embed_lsb] != eb->capacity[e_embed_lsb])
+    return ea->capacity[e_embed_lsb] < eb->capacity[e_embed_lsb] ? -1 : 1;
+  return strcmp(ea->name, eb->name);
+}
+
+/*
+ * Function: pixel_slots / compare_by_pixels
+ * -----------------------------------------
+ * Pixel mode capacity is floor(P / g) * 3 payload bytes, where
+ * P = (pixel data size - header bits) / bytes per pixel and g
+ * is the pixels per 3 byte group of the depth and channel
+ * mask. Ordering covers by P, with the ones that carry nothing
+ * first, orders them by pixel capacity for every parameter.
+ */
+static uint64 pixel_slots(const CoverEntry *entry)
+{
+  if (entry->capacity[e_embed_pixel] == 0)
+    return 0;
+  return (entry->image_size - MAX_STEGO_HEADER_BYTES * 8) / (entry->bits_per_pixel / 8);
+}
+
+static int compare_by_pixels(const void *a, const void *b)
+{
+  const CoverEntry *ea = *(const CoverEntry *const *)a;
+  const CoverEntry *eb = *(const CoverEntry *const *)b;
+  uint64 pa = pixel_slots(ea), pb = pixel_slots(eb);
+  if (pa != pb)
+    return pa < pb ? -1 : 1;
+  return ea < eb ? -1 : ea > eb;
+}
+
+/*
+ * Function: order_by_pixels
+ * -------------------------
+ * Builds index->by_pixel once the entries are final
+ */
+static Status order_by_pixels(CoverIndex *index)
+{
+  index->by_pixel = malloc((index->n_entries ? index->n_entries : 1) * sizeof(CoverEntry *));
+  if (index->by_pixel == NULL)
+  {
+    log_error(e_err_memory, "Unable to allocate cover index");
+    return e_failure;
+  }
+  for (uint i = 0; i < index->n_entries; i++)
+    index->by_pixel[i] = &index->entries[i];
+  qsort(index->by_pixel, index->n_entries, sizeof(CoverEntry *), compare_by_pixels);
+  return e_success;
+}
+
+/*
+ * Function: is_bmp_name
+ * ---------------------
+ * True for names ending in ".bmp"
+ */
+static int is_bmp_name(const char *name)
+{
+  size_t len = strlen(name);
+  return len > 4 && strcmp(name + len - 4, ".bmp") == 0;
+}
+
+/*
+ * Function: cover_default_param
+ * -----------------------------
+ * Parameter the stored capacities are computed with: the
+ * default matrix rate, or the default pixel depth with the
+ * cover's own pixel size
+ */
+static uint cover_default_param(EmbedMode mode, const CoverEntry *entry)
+{
+  if (mode == e_embed_pixel)
+    return PIXEL_PARAM(PIXEL_DEFAULT_BITS, entry->bits_per_pixel / 8);
+  return MATRIX_DEFAULT_RATE;
+}
+
+/*
+ * Function: read_cover_entry
+ * --------------------------
+ * Reads only the BMP header of one cover and fills its entry.
+ * Covers that are not uncompressed 24 or 32-bit BMPs, or whose
+ * pixels do not start right after the 54 byte header (the
+ * encoder embeds from there), are kept in the index with their
+ * format but zero capacity.
+ */
+static Status read_cover_entry(const char *path, CoverEntry *entry)
+{
+  unsigned char header[BMP_HEADER_SIZE];
+  BmpInfo info;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return e_failure;
+  ssize_t n = pread(fd, header, sizeof(header), 0);
+  close(fd);
+  if (n != (ssize_t)sizeof(header) || parse_bmp_header(header, &info) != e_success)
+    return e_failure;
+
+  entry->width = info.width;
+  entry->height = info.height;
+  entry->bits_per_pixel = info.bits_per_pixel;
+  entry->image_size = info.image_size;
+  for (int mode = 0; mode < e_embed_mode_count; mode++)
+  {
+    if ((info.bits_per_pixel == 24 || info.bits_per_pixel == 32) && info.compression == 0 &&
+        info.data_offset == BMP_HEADER_SIZE)
+      entry->capacity[mode] = get_payload_capacity(info.image_size, (EmbedMode)mode, cover_default_param((EmbedMode)mode, entry));
+    else
+      entry->capacity[mode] = 0;
+  }
+  return e_success;
+}
+
+/*
+ * Function: cover_scan_worker
+ * ---------------------------
+ * Claims names one at a time and either reuses the previous
+ * entry (same mtime and size) or reads the cover's header.
+ */
+static void *cover_scan_worker(void *arg)
+{
+  CoverScan *scan = arg;
+  char path[4096];
+  struct stat st;
+
+  for (;;)
+  {
+    uint i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED);
+    if (i >= scan->n_names)
+      break;
+
+    CoverEntry *entry = &scan->entries[i];
+    snprintf(path, sizeof(path), "%s/%s", scan->dir_name, scan->names[i]);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      __atomic_fetch_add(&scan->n_rejected, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    CoverEntry **old = NULL;
+    if (scan->n_old)
+      old = bsearch(scan->names[i], scan->old_by_name, scan->n_old, sizeof(CoverEntry *), compare_name_key);
+    long long mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (old && (*old)->mtime == mtime && (*old)->file_size == (uint64)st.st_size)
+    {
+      *entry = **old;
+      entry->name = scan->names[i];
+      scan->valid[i] = 1;
+      __atomic_fetch_add(&scan->n_reused, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    entry->name = scan->names[i];
+    entry->mtime = mtime;
+    entry->file_size = (uint64)st.st_size;
+    if (read_cover_entry(path, entry) == e_success)
+    {
+      scan->valid[i] = 1;
+      __atomic_fetch_add(&scan->n_scanned, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+      __atomic_fetch_add(&scan->n_rejected, 1, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Function: list_bmp_names
+ * ------------------------
+ * Collects the names of all .bmp files in a directory. The
+ * names are packed into one pool that grows by doubling; the
+ * pointers into it are set once the listing is complete.
+ */
+static Status list_bmp_names(const char *dir_name, char ***names_out, char **pool_out, uint *count_out)
+{
+  DIR *dir = opendir(dir_name);
+  if (dir == NULL)
+  {
+    log_error(e_err_io, "Unable to open directory %s: %s", dir_name, strerror(errno));
+    return e_failure;
+  }
+
+  // offsets while the pool can still move
+  size_t *offsets = NULL;
+  char *pool = NULL;
+  size_t pool_used = 0, pool_alloc = 0;
+  uint count = 0, alloc = 0;
+  Status status = e_success;
+  struct dirent *de;
+  while (status == e_success && (de = readdir(dir)) != NULL)
+  {
+    if (!is_bmp_name(de->d_name))
+      continue;
+    size_t name_size = strlen(de->d_name) + 1;
+    if (count == alloc)
+    {
+      alloc = alloc ? alloc * 2 : 256;
+      size_t *grown = realloc(offsets, alloc * sizeof(size_t));
+      if (grown == NULL)
+      {
+        status = e_failure;
+        break;
+      }
+      offsets = grown;
+    }
+    if (pool_used + name_size > pool_alloc)
+    {
+      pool_alloc = pool_alloc ? pool_alloc * 2 : 256 * 16;
+      if (pool_alloc < pool_used + name_size)
+        pool_alloc = pool_used + name_size;
+      char *grown = realloc(pool, pool_alloc);
+      if (grown == NULL)
+      {
+        status = e_failure;
+        break;
+      }
+      pool = grown;
+    }
+    memcpy(pool + pool_used, de->d_name, name_size);
+    offsets[count++] = pool_used;
+    pool_used += name_size;
+  }
+  closedir(dir);
+  // a partial listing would be saved as the whole directory
+  if (status != e_success)
+  {
+    log_error(e_err_memory, "Unable to list %s: out of memory after %u covers", dir_name, count);
+    free(offsets);
+    free(pool);
+    return e_failure;
+  }
+
+  // the offsets array becomes the pointer array, same size
+  char **names = (char **)offsets;
+  for (uint i = 0; i < count; i++)
+    names[i] = pool + offsets[i];
+
+  *names_out = names;
+  *pool_out = pool;
+  *count_out = count;
+  return e_success;
+}
+
+/*
+ * Function: cover_index_scan
+ * --------------------------
+ * Scans every .bmp in dir_name with a pool of threads. If
+ * index_fname already holds an index, covers whose mtime and
+ * size are unchanged are taken from it instead of re-read.
+ *
+ * Returns: e_success, or e_failure if the directory can't be read
+ */
+Status cover_index_scan(const char *dir_name, const char *index_fname, CoverIndex *index)
+{
+  CoverIndex old;
+  CoverScan scan;
+  memset(&old, 0, sizeof(old));
+  memset(&scan, 0, sizeof(scan));
+  memset(index, 0, sizeof(*index));
+
+  // previous index is optional, a missing one means a full scan
+  FILE *fptr_old = fopen(index_fname, "rb");
+  if (fptr_old)
+  {
+    fclose(fptr_old);
+    if (cover_index_load(index_fname, &old) == e_success && old.dir_name && strcmp(old.dir_name, dir_name) != 0)
+    {
+      cover_index_free(&old);
+      memset(&old, 0, sizeof(old));
+    }
+  }
+
+  if (list_bmp_names(dir_name, &scan.names, &scan.name_pool, &scan.n_names) != e_success)
+  {
+    cover_index_free(&old);
+    return e_failure;
+  }
+
+  // the old entry lookup table and valid flags ride behind the entries
+  scan.dir_name = dir_name;
+  size_t entries_size = (scan.n_names ? scan.n_names : 1) * sizeof(CoverEntry);
+  size_t old_size = old.n_entries * sizeof(CoverEntry *);
+  scan.entries = calloc(1, entries_size + old_size + scan.n_names + 1);
+  if (scan.entries == NULL)
+  {
+    log_error(e_err_memory, "Unable to allocate cover index");
+    free(scan.names);
+    free(scan.name_pool);
+    cover_index_free(&old);
+    return e_failure;
+  }
+  scan.old_by_name = (CoverEntry **)((char *)scan.entries + entries_size);
+  scan.valid = (char *)scan.old_by_name + old_size;
+  for (uint i = 0; i < old.n_entries; i++)
+    scan.old_by_name[i] = &old.entries[i];
+  qsort(scan.old_by_name, old.n_entries, sizeof(CoverEntry *), compare_by_name);
+  scan.n_old = old.n_entries;
+
+  // one worker per online cpu, the header reads are tiny and latency bound
+  long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+  uint n_threads = n_cpu > 0 ? (uint)n_cpu : 1;
+  if (n_threads > MAX_COVER_SCAN_THREADS)
+    n_threads = MAX_COVER_SCAN_THREADS;
+  if (n_threads > scan.n_names)
+    n_threads = scan.n_names ? scan.n_names : 1;
+
+  pthread_t threads[MAX_COVER_SCAN_THREADS];
+  uint n_started = 0;
+  for (uint t = 0; t < n_threads; t++)
+  {
+    if (pthread_create(&threads[t], NULL, cover_scan_worker, &scan) != 0)
+      break;
+    n_started++;
+  }
+  // no thread could be started, scan on the calling thread
+  if (n_started == 0)
+    cover_scan_worker(&scan);
+  for (uint t = 0; t < n_started; t++)
+    pthread_join(threads[t], NULL);
+
+  // compact the valid entries, the name pool moves into the index
+  uint count = 0;
+  for (uint i = 0; i < scan.n_names; i++)
+    if (scan.valid[i])
+      scan.entries[count++] = scan.entries[i];
+  qsort(scan.entries, count, sizeof(CoverEntry), compare_by_capacity);
+
+  index->dir_name = strdup(dir_name);
+  index->index_fname = strdup(index_fname);
+  index->entries = scan.entries;
+  index->n_entries = count;
+  index->name_pool = scan.name_pool;
+  index->n_scanned = scan.n_scanned;
+  index->n_reused = scan.n_reused;
+  index->n_rejected = scan.n_rejected;
+
+  free(scan.names);
+  cover_index_free(&old);
+  if (index->dir_name == NULL || index->index_fname == NULL)
+  {
+    log_error(e_err_memory, "Unable to allocate cover index");
+    cover_index_free(index);
+    return e_failure;
+  }
+  if (order_by_pixels(index) != e_success)
+  {
+    cover_index_free(index);
+    return e_failure;
+  }
+  return e_success;
+}
+
+/*
+ * Function: cover_index_save
+ * --------------------------
+ * Writes the index as
+ *   "SCIX", version, entry count, mode count, dir length, dir
+ * followed by one fixed record plus name per entry. The file
+ * is written under a temporary name and renamed into place so
+ * readers never see a partial index.
+ */
+Status cover_index_save(CoverIndex *index)
+{
+  char tmp_fname[4096];
+  snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", index->index_fname);
+  FILE *fptr = fopen(tmp_fname, "wb");
+  if (fptr == NULL)
+  {
+    log_error(e_err_io, "Unable to open file %s: %s", tmp_fname, strerror(errno));
+    return e_failure;
+  }
+
+  uint version = COVER_INDEX_VERSION;
+  uint n_modes = e_embed_mode_count;
+  uint dir_len = strlen(index->dir_name);
+  fwrite(COVER_INDEX_MAGIC, 1, 4, fptr);
+  fwrite(&version, sizeof(uint), 1, fptr);
+  fwrite(&index->n_entries, sizeof(uint), 1, fptr);
+  fwrite(&n_modes, sizeof(uint), 1, fptr);
+  fwrite(&dir_len, sizeof(uint), 1, fptr);
+  fwrite(index->dir_name, 1, dir_len, fptr);
+
+  for (uint i = 0; i < index->n_entries; i++)
+  {
+    CoverEntry *entry = &index->entries[i];
+    unsigned short name_len = strlen(entry->name);
+    fwrite(&entry->mtime, sizeof(long long), 1, fptr);
+    fwrite(&entry->file_size, sizeof(uint64), 1, fptr);
+    fwrite(&entry->width, sizeof(uint), 1, fptr);
+    fwrite(&entry->height, sizeof(uint), 1, fptr);
+    fwrite(&entry->bits_per_pixel, sizeof(uint), 1, fptr);
+    fwrite(&entry->image_size, sizeof(uint64), 1, fptr);
+    fwrite(entry->capacity, sizeof(uint64), e_embed_mode_count, fptr);
+    fwrite(&name_len, sizeof(name_len), 1, fptr);
+    fwrite(entry->name, 1, name_len, fptr);
+  }
+
+  if (ferror(fptr) | fclose(fptr))
+  {
+    log_error(e_err_io, "Unable to write file %s", tmp_fname);
+    remove(tmp_fname);
+    return e_failure;
+  }
+  if (rename(tmp_fname, index->index_fname) != 0)
+  {
+    log_error(e_err_io, "Unable to rename %s to %s: %s", tmp_fname, index->index_fname, strerror(errno));
+    remove(tmp_fname);
+    return e_failure;
+  }
+  return e_success;
+}
+
+/*
+ * Function: cover_index_load
+ * --------------------------
+ * Reads an index written by cover_index_save. An index from
+ * a build with a different mode count is rejected, a rescan
+ * rebuilds it.
+ */
+Status cover_index_load(const char *index_fname, CoverIndex *index)
+{
+  memset(index, 0, sizeof(*index));
+  FILE *fptr = fopen(index_fname, "rb");
+  if (fptr == NULL)
+  {
+    log_error(e_err_io, "Unable to open file %s: %s", index_fname, strerror(errno));
+    return e_failure;
+  }
+
+  char magic[4];
+  uint version, n_entries, n_modes, dir_len;
+  if (fread(magic, 1, 4, fptr) != 4 || memcmp(magic, COVER_INDEX_MAGIC, 4) != 0 ||
+      fread(&version, sizeof(uint), 1, fptr) != 1 || version != COVER_INDEX_VERSION ||
+      fread(&n_entries, sizeof(uint), 1, fptr) != 1 ||
+      fread(&n_modes, sizeof(uint), 1, fptr) != 1 || n_modes != e_embed_mode_count ||
+      fread(&dir_len, sizeof(uint), 1, fptr) != 1 || dir_len > 4095)
+  {
+    log_error(e_err_format, "%s is not a cover index", index_fname);
+    fclose(fptr);
+    return e_failure;
+  }
+
+  // every record is longer than a name's terminator, so the rest
+  // of the file bounds the name pool
+  struct stat st;
+  long rest = ftell(fptr) + dir_len;
+  size_t pool_size = fstat(fileno(fptr), &st) == 0 && st.st_size > rest ? (size_t)(st.st_size - rest) : 0;
+  if (n_entries > pool_size / COVER_RECORD_SIZE)
+  {
+    log_error(e_err_format, "%s is truncated", index_fname);
+    fclose(fptr);
+    return e_failure;
+  }
+  index->dir_name = calloc(dir_len + 1, 1);
+  index->index_fname = strdup(index_fname);
+  index->entries = calloc(n_entries ? n_entries : 1, sizeof(CoverEntry));
+  index->name_pool = malloc(pool_size ? pool_size : 1);
+  if (index->dir_name == NULL || index->index_fname == NULL || index->entries == NULL ||
+      index->name_pool == NULL || fread(index->dir_name, 1, dir_len, fptr) != dir_len)
+  {
+    if (index->dir_name == NULL || index->index_fname == NULL || index->entries == NULL || index->name_pool == NULL)
+      log_error(e_err_memory, "Unable to allocate cover index");
+    else
+      log_error(e_err_format, "%s is truncated", index_fname);
+    fclose(fptr);
+    cover_index_free(index);
+    return e_failure;
+  }
+
+  index->n_entries = n_entries;
+  char *name = index->name_pool;
+  for (uint i = 0; i < n_entries; i++)
+  {
+    CoverEntry *entry = &index->entries[i];
+    unsigned short name_len;
+    if (fread(&entry->mtime, sizeof(long long), 1, fptr) != 1 ||
+        fread(&entry->file_size, sizeof(uint64), 1, fptr) != 1 ||
+        fread(&entry->width, sizeof(uint), 1, fptr) != 1 ||
+        fread(&entry->height, sizeof(uint), 1, fptr) != 1 ||
+        fread(&entry->bits_per_pixel, sizeof(uint), 1, fptr) != 1 ||
+        fread(&entry->image_size, sizeof(uint64), 1, fptr) != 1 ||
+        fread(entry->capacity, sizeof(uint64), e_embed_mode_count, fptr) != e_embed_mode_count ||
+        fread(&name_len, sizeof(name_len), 1, fptr) != 1 ||
+        name_len >= index->name_pool + pool_size - name ||
+        fread(name, 1, name_len, fptr) != name_len)
+    {
+      log_error(e_err_format, "%s is truncated", index_fname);
+      fclose(fptr);
+      cover_index_free(index);
+      return e_failure;
+    }
+    name[name_len] = '\0';
+    entry->name = name;
+    name += name_len + 1;
+  }
+  fclose(fptr);
+  if (order_by_pixels(index) != e_success)
+  {
+    cover_index_free(index);
+    return e_failure;
+  }
+  return e_success;
+}
+
+/*
+ * Function: cover_index_best_fit
+ * ------------------------------
+ * Binary search for the first entry whose capacity for mode
+ * (and its parameter) is at least payload_size. O(log n) in
+ * the number of covers.
+ * Pixel capacity follows the pixel count rather than the pixel
+ * data size, so with 24 and 32-bit covers mixed it is not in
+ * index order; that mode searches the by_pixel order instead.
+ */
+const CoverEntry *cover_index_best_fit(const CoverIndex *index, uint64 payload_size, EmbedMode mode, uint param)
+{
+  uint lo = 0, hi = index->n_entries;
+  while (lo < hi)
+  {
+    uint mid = lo + (hi - lo) / 2;
+    const CoverEntry *entry = mode == e_embed_pixel ? index->by_pixel[mid] : &index->entries[mid];
+    if (cover_capacity(entry, mode, param) < payload_size)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == index->n_entries)
+    return NULL;
+  return mode == e_embed_pixel ? index->by_pixel[lo] : &index->entries[lo];
+}
+
+/*
+ * Function: cover_capacity
+ * ------------------------
+ * Capacity of an indexed cover. The stored value covers the
+ * default matrix rate and pixel depth, others are derived from
+ * the pixel data size; unsupported formats stay at 0.
+ */
+uint64 cover_capacity(const CoverEntry *entry, EmbedMode mode, uint param)
+{
+  // pixel mode callers pass the depth and layout only, the cover adds its pixel size
+  if (mode == e_embed_pixel)
+    param = PIXEL_PARAM_SET_BPP(param, entry->bits_per_pixel / 8);
+  if ((mode != e_embed_matrix && mode != e_embed_pixel) || param == cover_default_param(mode, entry) || entry->capacity[mode] == 0)
+    return entry->capacity[mode];
+  return get_payload_capacity(entry->image_size, mode, param);
+}
+
+/*
+ * Function: cover_index_free
+ * --------------------------
+ * Releases the name pool, entries and paths of an index.
+ */
+void cover_index_free(CoverIndex *index)
+{
+  free(index->by_pixel);
+  free(index->name_pool);
+  free(index->entries);
+  free(index->dir_name);
+  free(index->index_fname);
+  index->entries = NULL;
+  index->by_pixel = NULL;
+  index->name_pool = NULL;
+  index->dir_name = NULL;
+  index->index_fname = NULL;
+  index->n_entries = 0;
+}
+
+/*
+ * Function: do_cover_index
+ * ------------------------
+ * Handles "-i covers_dir [index_file]": scans the directory,
+ * updates the index and reports what was (re)read.
+ */
+Status do_cover_index(char *argv[])
+{
+  CoverIndex index;
+  const char *index_fname = argv[3] ? argv[3] : COVER_INDEX_DEFAULT_FNAME;
+
+  if (cover_index_scan(argv[2], index_fname, &index) != e_success)
+    return e_failure;
+
+  printf("indexed %u covers (%u scanned, %u unchanged, %u rejected)\n",
+         index.n_entries, index.n_scanned, index.n_reused, index.n_rejected);
+  Status status = cover_index_save(&index);
+  if (status == e_success)
+    log_info("cover index written to %s", index_fname);
+  cover_index_free(&index);
+  return status;
+}
+
+/*
+ * Function: do_cover_query
+ * ------------------------
+ * Handles "-q index_file payload": payload is either a byte
+ * count or a file whose size is used. Prints the path of the
+ * smallest cover that can carry it with the given mode.
+ */
+Status do_cover_query(char *argv[], EmbedMode mode, uint param)
+{
+  CoverIndex index;
+  struct stat st;
+  uint64 payload_size;
+  char *end;
+
+  if (stat(argv[3], &st) == 0)
+  {
+    payload_size = (uint64)st.st_size;
+  }
+  else
+  {
+    payload_size = strtoull(argv[3], &end, 10);
+    if (*argv[3] == '\0' || *end != '\0')
+    {
+      log_error(e_err_args, "%s is neither a file nor a size", argv[3]);
+      return e_failure;
+    }
+  }
+
+  if (cover_index_load(argv[2], &index) != e_success)
+    return e_failure;
+
+  const CoverEntry *entry = cover_index_best_fit(&index, payload_size, mode, param);
+  Status status = e_failure;
+  if (entry)
+  {
+    printf("%s/%s %ux%u capacity = %llu\n", index.dir_name, entry->name,
+           entry->width, entry->height, cover_capacity(entry, mode, param));
+    status = e_success;
+  }
+  else
+  {
+    log_error(e_err_capacity, "no cover can hold %llu bytes", payload_size);
+  }
+  cover_index_free(&index);
+  return status;
+}
@@ -0,0 +1,89 @@
+#ifndef COVER_INDEX_H
+#define COVER_INDEX_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Index of a directory of cover images.
+ * Only the 54 byte BMP header of each cover is read. The
+ * index is kept sorted by capacity so the smallest cover
+ * that fits a payload is found with a binary search, and it
+ * is persisted so a rescan only re-reads covers whose mtime
+ * or size changed.
+ */
+
+#define COVER_INDEX_MAGIC "SCIX"
+#define COVER_INDEX_VERSION 4
+#define COVER_INDEX_DEFAULT_FNAME "covers.idx"
+#define MAX_COVER_SCAN_THREADS 16
+
+typedef struct _CoverEntry
+{
+    /* File name, relative to the indexed directory */
+    char *name;
+
+    /* Cover file info, used to detect changes on rescan (mtime in ns) */
+    long long mtime;
+    uint64 file_size;
+
+    /* Pixel format */
+    uint width;
+    uint height;
+    uint bits_per_pixel;
+    uint64 image_size;
+
+    /* Secret bytes that fit, per embedding mode at the default
+       matrix rate and pixel depth (0 if unsupported) */
+    uint64 capacity[e_embed_mode_count];
+
+} CoverEntry;
+
+typedef struct _CoverIndex
+{
+    char *dir_name;
+    char *index_fname;
+
+    /* Entries sorted by capacity; their names live back to back
+       in one block instead of one allocation per cover */
+    CoverEntry *entries;
+    uint n_entries;
+    char *name_pool;
+
+    /* Entries in pixel mode capacity order, see cover_index_best_fit */
+    const CoverEntry **by_pixel;
+
+    /* Rescan statistics */
+    uint n_scanned;
+    uint n_reused;
+    uint n_rejected;
+
+} CoverIndex;
+
+
+/* Cover index function prototype */
+
+/* Scan dir_name in parallel, reusing unchanged entries of index_fname */
+Status cover_index_scan(const char *dir_name, const char *index_fname, CoverIndex *index);
+
+/* Load a persisted index */
+Status cover_index_load(const char *index_fname, CoverIndex *index);
+
+/* Persist the index to index->index_fname */
+Status cover_index_save(CoverIndex *index);
+
+/* Smallest cover that can carry payload_size bytes, NULL if none */
+const CoverEntry *cover_index_best_fit(const CoverIndex *index, uint64 payload_size, EmbedMode mode, uint param);
+
+/* Capacity of one entry for a mode and its parameter */
+uint64 cover_capacity(const CoverEntry *entry, EmbedMode mode, uint param);
+
+/* Release the entries */
+void cover_index_free(CoverIndex *index);
+
+/* Build index from "-i dir [index]" */
+Status do_cover_index(char *argv[]);
+
+/* Answer "-q index size|file" */
+Status do_cover_query(char *argv[], EmbedMode mode, uint param);
+
+#endif
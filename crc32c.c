@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "crc32c.h"
+#include "types.h"
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#ifndef __SSE4_2__
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+static uint crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Function: crc32c_init_tables
+ * ----------------------------
+ * Builds the slice-by-8 tables, once per process
+ */
+static void crc32c_init_tables(void)
+{
+  for (uint i = 0; i < 256; i++)
+  {
+    uint crc = i;
+    for (int j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+    crc32c_table[0][i] = crc;
+  }
+  for (uint i = 0; i < 256; i++)
+    for (int t = 1; t < 8; t++)
+      crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+}
+#endif
+
+/*
+ * Function: crc32c_update
+ * -----------------------
+ * Feeds size bytes into a running crc, 8 bytes per step
+ */
+uint crc32c_update(uint crc, const void *data, size_t size)
+{
+  const unsigned char *p = data;
+#ifdef __SSE4_2__
+  unsigned long long crc64 = crc;
+  for (; size >= 8; size -= 8, p += 8)
+  {
+    unsigned long long word;
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint)crc64;
+  for (; size; size--, p++)
+    crc = _mm_crc32_u8(crc, *p);
+#else
+  pthread_once(&crc32c_once, crc32c_init_tables);
+  for (; size >= 8; size -= 8, p += 8)
+  {
+    uint lo = crc ^ ((uint)p[0] | ((uint)p[1] << 8) | ((uint)p[2] << 16) | ((uint)p[3] << 24));
+    uint hi = (uint)p[4] | ((uint)p[5] << 8) | ((uint)p[6] << 16) | ((uint)p[7] << 24);
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+          crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+          crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+          crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+  }
+  for (; size; size--, p++)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p) & 0xff];
+#endif
+  return crc;
+}
+
+/*
+ * Function: crc32c_final
+ * ----------------------
+ * Final xor of the running crc
+ */
+uint crc32c_final(uint crc)
+{
+  return crc ^ 0xFFFFFFFFu;
+}
+
+/*
+ * Function: crc32c_resume
+ * -----------------------
+ * Undoes the final xor, so appended data can be fed in
+ */
+uint crc32c_resume(uint digest)
+{
+  return digest ^ 0xFFFFFFFFu;
+}
@@ -0,0 +1,27 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * CRC-32C (Castagnoli) digest of the secret data.
+ * Uses the SSE4.2 crc32 instruction when the compiler targets
+ * it and slice-by-8 tables otherwise; both give the same value.
+ * Streaming: start with CRC32C_INIT, feed every chunk through
+ * crc32c_update and finish with crc32c_final. A finished
+ * digest can be extended with more data through crc32c_resume.
+ */
+
+#define CRC32C_INIT 0xFFFFFFFFu
+
+/* Feed size bytes into a running crc */
+uint crc32c_update(uint crc, const void *data, size_t size);
+
+/* Final value of a running crc */
+uint crc32c_final(uint crc);
+
+/* Running crc that continues after a final value */
+uint crc32c_resume(uint digest);
+
+#endif
@@ -0,0 +1,801 @@
+#define _GNU_SOURCE // accept4, MSG_CMSG_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "kernel.h"
+#include "cover_cache.h"
+#include "log.h"
+#include "types.h"
+
+struct _Daemon;
+
+/* One worker thread and the job contexts it reuses */
+typedef struct _DaemonWorker
+{
+    pthread_t thread;
+    struct _Daemon *daemon;
+    EncodeInfo encInfo;
+    DecodeInfo decInfo;
+    int conn_fd;
+} DaemonWorker;
+
+typedef struct _Daemon
+{
+    int listen_fd;
+    int stop;
+
+    /* Connections with a request waiting for a worker */
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int queue[DAEMON_MAX_CONNECTIONS];
+    uint head;
+    uint count;
+
+    /* Connections workers handed back after a request, and the
+       pipe that wakes the accept loop to poll them again */
+    int returned[DAEMON_MAX_CONNECTIONS];
+    uint n_returned;
+    int wake_pipe[2];
+
+    /* Open connections, idle, queued or being served */
+    uint n_open;
+
+    DaemonWorker workers[DAEMON_MAX_WORKERS];
+    uint n_workers;
+
+    /* Covers by path, shared by all workers */
+    CoverCache covers;
+} Daemon;
+
+static Daemon stego_daemon;
+static volatile sig_atomic_t stego_daemon_stop;
+
+/*
+ * Function: daemon_wake
+ * ---------------------
+ * Makes the accept loop's poll return; safe in a signal handler
+ */
+static void daemon_wake(Daemon *daemon)
+{
+  char byte = 0;
+  ssize_t n = write(daemon->wake_pipe[1], &byte, 1);
+  (void)n; // a full pipe already wakes the loop
+}
+
+/*
+ * Function: daemon_on_signal
+ * --------------------------
+ * SIGINT/SIGTERM: ask the accept loop to finish
+ */
+static void daemon_on_signal(int sig)
+{
+  (void)sig;
+  stego_daemon_stop = 1;
+  daemon_wake(&stego_daemon);
+}
+
+/*
+ * Function: daemon_send / daemon_recv
+ * -----------------------------------
+ * One message per call, with up to 2 file descriptors
+ * attached as SCM_RIGHTS.
+ */
+static ssize_t daemon_send(int sock, const void *buf, size_t size, const int *fds, int n_fds)
+{
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  struct iovec iov = { (void *)buf, size };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (n_fds > 0)
+  {
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+  }
+  return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+static ssize_t daemon_recv(int sock, void *buf, size_t size, int *fds, int *n_fds)
+{
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  struct iovec iov = { buf, size };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  *n_fds = 0;
+  ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  if (n < 0)
+    return n;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *received = (int *)CMSG_DATA(cmsg);
+    for (int i = 0; i < count; i++)
+    {
+      if (*n_fds < 2)
+        fds[(*n_fds)++] = received[i];
+      else
+        close(received[i]);
+    }
+  }
+  return n;
+}
+
+/*
+ * Function: daemon_fdopen
+ * -----------------------
+ * fdopen that closes the descriptor if no stream can be made
+ */
+static FILE *daemon_fdopen(int fd, const char *mode)
+{
+  FILE *fptr = fdopen(fd, mode);
+  if (fptr == NULL)
+    close(fd);
+  return fptr;
+}
+
+static void daemon_fclose(FILE **fptr)
+{
+  if (*fptr)
+    fclose(*fptr);
+  *fptr = NULL;
+}
+
+/*
+ * Function: daemon_reset_encode / daemon_reset_decode
+ * ---------------------------------------------------
+ * Clears a worker's job context for the next request. The
+ * arena block is kept and only reset, so steady state jobs
+ * do not call malloc.
+ */
+static void daemon_reset_encode(EncodeInfo *encInfo)
+{
+  Arena arena = encInfo->arena;
+  memset(encInfo, 0, sizeof(*encInfo));
+  encInfo->arena = arena;
+  arena_reset(&encInfo->arena);
+}
+
+static void daemon_reset_decode(DecodeInfo *decInfo)
+{
+  Arena arena = decInfo->arena;
+  memset(decInfo, 0, sizeof(*decInfo));
+  decInfo->arena = arena;
+  arena_reset(&decInfo->arena);
+}
+
+/*
+ * Function: daemon_encode
+ * -----------------------
+ * Encodes the secret fd into the output fd, reading the cover
+ * from the in-memory cache through fmemopen.
+ */
+static void daemon_encode(DaemonWorker *worker, DaemonRequest *req, int *fds, DaemonResponse *resp)
+{
+  EncodeInfo *encInfo = &worker->encInfo;
+  uint cached = 0;
+  CachedCover *cover = cover_cache_get(&worker->daemon->covers, req->cover_path, &cached);
+  if (cover == NULL)
+  {
+    close(fds[0]);
+    close(fds[1]);
+    snprintf(resp->message, sizeof(resp->message), "unable to read cover %.100s", req->cover_path);
+    return;
+  }
+
+  daemon_reset_encode(encInfo);
+  encInfo->magic_string = req->magic_string;
+  encInfo->embed_mode = (EmbedMode)req->embed_mode;
+  encInfo->embed_param = req->embed_param;
+  encInfo->spread = req->spread != 0;
+  encInfo->src_image_fname = req->cover_path;
+  if (cover->bmp.bits_per_pixel == 24 || cover->bmp.bits_per_pixel == 32)
+    encInfo->image_capacity = cover->bmp.image_size;
+  encInfo->secret_fname = "<fd>";
+  encInfo->stego_image_fname = "<fd>";
+  strcpy(encInfo->extn_secret_file, ".txt");
+  encInfo->fptr_src_image = fmemopen(cover->data, cover->size, "rb");
+  encInfo->fptr_secret = daemon_fdopen(fds[0], "rb");
+  encInfo->fptr_stego_image = daemon_fdopen(fds[1], "wb");
+
+  if (encInfo->fptr_src_image && encInfo->fptr_secret && encInfo->fptr_stego_image &&
+      do_encoding(encInfo) == e_success)
+  {
+    resp->status = e_success;
+    resp->size_secret_file = encInfo->size_secret_file;
+    resp->digest = encInfo->digest_secret_file;
+    snprintf(resp->message, sizeof(resp->message), "encoded");
+  }
+  else
+  {
+    snprintf(resp->message, sizeof(resp->message), "failed to encode");
+  }
+  resp->cover_cached = cached;
+
+  // streams do_encoding did not get to close
+  daemon_fclose(&encInfo->fptr_src_image);
+  daemon_fclose(&encInfo->fptr_secret);
+  daemon_fclose(&encInfo->fptr_stego_image);
+  cover_cache_put(&worker->daemon->covers, cover);
+}
+
+/*
+ * Function: daemon_decode
+ * -----------------------
+ * Decodes (fds[1] valid) or probes (header only) a stego image fd
+ */
+static void daemon_decode(DaemonWorker *worker, DaemonRequest *req, int *fds, DaemonResponse *resp, int probe)
+{
+  DecodeInfo *decInfo = &worker->decInfo;
+  daemon_reset_decode(decInfo);
+  decInfo->magic_string = req->magic_string;
+  decInfo->stego_image_fname = "<fd>";
+  decInfo->decode_fname = "<fd>";
+  decInfo->fptr_stego_image = daemon_fdopen(fds[0], "rb");
+
+  Status status = e_failure;
+  if (probe)
+  {
+    if (decInfo->fptr_stego_image)
+      status = decode_stego_header(decInfo);
+  }
+  else
+  {
+    decInfo->fptr_decode = daemon_fdopen(fds[1], "wb");
+    if (decInfo->fptr_stego_image && decInfo->fptr_decode)
+      status = do_decoding(decInfo);
+  }
+
+  resp->status = status;
+  if (status == e_success)
+  {
+    resp->size_secret_file = decInfo->size_secret_file;
+    resp->digest = probe ? decInfo->digest_secret_file : decInfo->digest_decoded;
+    resp->embed_mode = decInfo->embed_mode;
+    resp->embed_param = decInfo->embed_param;
+  }
+  snprintf(resp->message, sizeof(resp->message), "%s %s", probe ? "probe" : "decode",
+           status == e_success ? "matched" : "failed");
+
+  daemon_fclose(&decInfo->fptr_stego_image);
+  daemon_fclose(&decInfo->fptr_decode);
+}
+
+/*
+ * Function: daemon_format_stats
+ * -----------------------------
+ * One line summary of the cover cache counters, without the
+ * newline, for the client's output and the daemon's log
+ */
+static void daemon_format_stats(char *line, size_t size, const CoverCacheStats *stats)
+{
+  snprintf(line, size, "cover cache: %u covers, %.1f of %.1f MB, %llu hits, %llu misses, %llu evictions",
+           stats->entries, stats->bytes / 1048576.0, stats->budget / 1048576.0,
+           stats->hits, stats->misses, stats->evictions);
+}
+
+/*
+ * Function: daemon_serve
+ * ----------------------
+ * Answers one request on a connection the accept loop found
+ * readable.
+ *
+ * Returns: 1 to keep the connection, 0 once the client hung up
+ * or the response could not be sent
+ */
+static int daemon_serve(DaemonWorker *worker, int conn)
+{
+  DaemonRequest req;
+  DaemonResponse resp;
+  int fds[2];
+  int n_fds;
+
+  ssize_t n = daemon_recv(conn, &req, sizeof(req), fds, &n_fds);
+  if (n <= 0)
+  {
+    for (int i = 0; i < n_fds; i++)
+      close(fds[i]);
+    return 0;
+  }
+
+  memset(&resp, 0, sizeof(resp));
+  resp.status = e_failure;
+  // each request is its own job for log_failure
+  log_last_code = e_err_none;
+  // nothing in req is looked at before its size is known
+  if (n != sizeof(req) || req.proto_magic != DAEMON_PROTO_MAGIC || req.op > e_daemon_stats)
+  {
+    for (int i = 0; i < n_fds; i++)
+      close(fds[i]);
+    snprintf(resp.message, sizeof(resp.message), "bad request");
+    return send(conn, &resp, sizeof(resp), MSG_NOSIGNAL) == sizeof(resp);
+  }
+
+  int wanted = req.op == e_daemon_stats ? 0 : req.op == e_daemon_probe ? 1 : 2;
+  req.magic_string[MAX_MAGIC_STRING_LEN] = '\0';
+  req.cover_path[DAEMON_MAX_PATH - 1] = '\0';
+
+  if (n_fds != wanted || req.embed_mode >= e_embed_mode_count ||
+      (req.embed_mode == e_embed_matrix && (req.embed_param < MATRIX_MIN_RATE || req.embed_param > MATRIX_MAX_RATE)) ||
+      (req.embed_mode == e_embed_pixel && embed_kernel_select(e_embed_pixel, PIXEL_PARAM_SET_BPP(req.embed_param, 3)) == NULL))
+  {
+    for (int i = 0; i < n_fds; i++)
+      close(fds[i]);
+    snprintf(resp.message, sizeof(resp.message), "bad request");
+  }
+  else if (req.op == e_daemon_stats)
+  {
+    cover_cache_stats(&worker->daemon->covers, &resp.cache);
+    resp.status = e_success;
+    snprintf(resp.message, sizeof(resp.message), "stats");
+  }
+  else if (req.op == e_daemon_encode)
+  {
+    daemon_encode(worker, &req, fds, &resp);
+  }
+  else
+  {
+    daemon_decode(worker, &req, fds, &resp, req.op == e_daemon_probe);
+  }
+
+  return send(conn, &resp, sizeof(resp), MSG_NOSIGNAL) == sizeof(resp);
+}
+
+/*
+ * Function: daemon_worker
+ * -----------------------
+ * Worker thread: takes connections with a pending request off
+ * the queue, serves that one request and hands the connection
+ * back to the accept loop, or closes it if the client is gone
+ */
+static void *daemon_worker(void *arg)
+{
+  DaemonWorker *worker = arg;
+  Daemon *daemon = worker->daemon;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&daemon->lock);
+    while (daemon->count == 0 && !daemon->stop)
+      pthread_cond_wait(&daemon->ready, &daemon->lock);
+    if (daemon->stop)
+    {
+      pthread_mutex_unlock(&daemon->lock);
+      break;
+    }
+    int conn = daemon->queue[daemon->head];
+    daemon->head = (daemon->head + 1) % DAEMON_MAX_CONNECTIONS;
+    daemon->count--;
+    worker->conn_fd = conn;
+    pthread_mutex_unlock(&daemon->lock);
+
+    int keep = daemon_serve(worker, conn);
+    log_flush();
+
+    pthread_mutex_lock(&daemon->lock);
+    worker->conn_fd = -1;
+    if (keep && !daemon->stop)
+    {
+      daemon->returned[daemon->n_returned++] = conn;
+    }
+    else
+    {
+      close(conn);
+      daemon->n_open--;
+    }
+    pthread_mutex_unlock(&daemon->lock);
+    daemon_wake(daemon);
+  }
+  return NULL;
+}
+
+/*
+ * Function: daemon_dispatch
+ * -------------------------
+ * Queues a connection with a pending request for the workers
+ */
+static void daemon_dispatch(Daemon *daemon, int conn)
+{
+  pthread_mutex_lock(&daemon->lock);
+  daemon->queue[(daemon->head + daemon->count) % DAEMON_MAX_CONNECTIONS] = conn;
+  daemon->count++;
+  pthread_cond_signal(&daemon->ready);
+  pthread_mutex_unlock(&daemon->lock);
+}
+
+/*
+ * Function: do_daemon
+ * -------------------
+ * Handles "-D socket_path [workers] [--cache-mb=N]": binds the
+ * socket, starts the worker pool and accepts connections until
+ * SIGINT or SIGTERM. Per-job progress lines follow the log
+ * level, each worker flushes its lines after every job.
+ */
+Status do_daemon(char *argv[], const StegoOptions *opts)
+{
+  Daemon *daemon = &stego_daemon;
+  struct sockaddr_un addr;
+  const char *path = argv[2];
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    log_error(e_err_args, "socket path %s is too long", path);
+    return e_failure;
+  }
+
+  long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+  uint n_workers = argv[3] ? (uint)atoi(argv[3]) : (n_cpu > 0 ? (uint)n_cpu : 1);
+  if (n_workers == 0)
+    n_workers = 1;
+  if (n_workers > DAEMON_MAX_WORKERS)
+    n_workers = DAEMON_MAX_WORKERS;
+
+  memset(daemon, 0, sizeof(*daemon));
+  pthread_mutex_init(&daemon->lock, NULL);
+  pthread_cond_init(&daemon->ready, NULL);
+  if (pipe2(daemon->wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+  {
+    log_error(e_err_daemon, "Unable to create pipe: %s", strerror(errno));
+    return e_failure;
+  }
+  if (cover_cache_init(&daemon->covers, opts->cache_budget ? opts->cache_budget : COVER_CACHE_DEFAULT_BUDGET) != e_success)
+    return e_failure;
+
+  daemon->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (daemon->listen_fd < 0)
+  {
+    log_error(e_err_daemon, "Unable to create socket: %s", strerror(errno));
+    return e_failure;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  // only a stale socket is replaced, never a file that happens to have the name
+  struct stat st;
+  if (lstat(path, &st) == 0)
+  {
+    if (!S_ISSOCK(st.st_mode))
+    {
+      log_error(e_err_daemon, "%s exists and is not a socket", path);
+      close(daemon->listen_fd);
+      return e_failure;
+    }
+    unlink(path);
+  }
+  // the socket is created 0600: any user who can connect can make
+  // the daemon read and write through its descriptors. No thread
+  // is running yet, so the process-wide umask change is safe.
+  mode_t old_umask = umask(0177);
+  int bound = bind(daemon->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_umask);
+  if (bound != 0 || listen(daemon->listen_fd, 128) != 0)
+  {
+    log_error(e_err_daemon, "unable to listen on %s: %s", path, strerror(errno));
+    close(daemon->listen_fd);
+    return e_failure;
+  }
+
+  // workers must not take the stop signals, the accept loop does
+  sigset_t stop_signals, old_mask;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+  for (uint i = 0; i < n_workers; i++)
+  {
+    DaemonWorker *worker = &daemon->workers[i];
+    worker->daemon = daemon;
+    worker->conn_fd = -1;
+    if (arena_init(&worker->encInfo.arena, ARENA_DEFAULT_SIZE) != e_success ||
+        arena_init(&worker->decInfo.arena, ARENA_DEFAULT_SIZE) != e_success ||
+        pthread_create(&worker->thread, NULL, daemon_worker, worker) != 0)
+    {
+      arena_free(&worker->encInfo.arena);
+      arena_free(&worker->decInfo.arena);
+      break;
+    }
+    daemon->n_workers++;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = daemon_on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  stego_daemon_stop = 0;
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+  log_info("daemon listening on %s with %u workers", path, daemon->n_workers);
+  log_flush();
+
+  // idle connections wait here until their next request arrives;
+  // slots 0 and 1 of the poll set are the socket and the wake pipe
+  static struct pollfd pfds[2 + DAEMON_MAX_CONNECTIONS];
+  int idle[DAEMON_MAX_CONNECTIONS];
+  uint n_idle = 0;
+  while (!stego_daemon_stop && daemon->n_workers)
+  {
+    pthread_mutex_lock(&daemon->lock);
+    int full = daemon->n_open == DAEMON_MAX_CONNECTIONS;
+    pthread_mutex_unlock(&daemon->lock);
+    pfds[0].fd = full ? -1 : daemon->listen_fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = daemon->wake_pipe[0];
+    pfds[1].events = POLLIN;
+    for (uint i = 0; i < n_idle; i++)
+    {
+      pfds[2 + i].fd = idle[i];
+      pfds[2 + i].events = POLLIN;
+    }
+    if (poll(pfds, 2 + n_idle, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      log_error(e_err_daemon, "poll failed: %s", strerror(errno));
+      break;
+    }
+
+    // readable (or hung up) idle connections go to the workers;
+    // walking backwards lets the last one fill a removed slot
+    for (uint i = n_idle; i-- > 0;)
+    {
+      if (pfds[2 + i].revents == 0)
+        continue;
+      daemon_dispatch(daemon, idle[i]);
+      idle[i] = idle[--n_idle];
+    }
+
+    if (pfds[1].revents)
+    {
+      char drain[64];
+      while (read(daemon->wake_pipe[0], drain, sizeof(drain)) > 0)
+        ;
+      pthread_mutex_lock(&daemon->lock);
+      for (uint i = 0; i < daemon->n_returned; i++)
+        idle[n_idle++] = daemon->returned[i];
+      daemon->n_returned = 0;
+      pthread_mutex_unlock(&daemon->lock);
+    }
+
+    if (pfds[0].revents)
+    {
+      int conn = accept4(daemon->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (conn < 0)
+      {
+        if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+          continue;
+        log_error(e_err_daemon, "accept failed: %s", strerror(errno));
+        break;
+      }
+      pthread_mutex_lock(&daemon->lock);
+      daemon->n_open++;
+      pthread_mutex_unlock(&daemon->lock);
+      idle[n_idle++] = conn;
+    }
+  }
+
+  // wake idle workers and cut busy ones off their clients
+  pthread_mutex_lock(&daemon->lock);
+  daemon->stop = 1;
+  for (uint i = 0; i < daemon->n_workers; i++)
+    if (daemon->workers[i].conn_fd >= 0)
+      shutdown(daemon->workers[i].conn_fd, SHUT_RDWR);
+  pthread_cond_broadcast(&daemon->ready);
+  pthread_mutex_unlock(&daemon->lock);
+  for (uint i = 0; i < daemon->n_workers; i++)
+  {
+    pthread_join(daemon->workers[i].thread, NULL);
+    arena_free(&daemon->workers[i].encInfo.arena);
+    arena_free(&daemon->workers[i].decInfo.arena);
+  }
+  for (; daemon->count; daemon->count--, daemon->head = (daemon->head + 1) % DAEMON_MAX_CONNECTIONS)
+    close(daemon->queue[daemon->head]);
+  for (uint i = 0; i < daemon->n_returned; i++)
+    close(daemon->returned[i]);
+  for (uint i = 0; i < n_idle; i++)
+    close(idle[i]);
+  CoverCacheStats stats;
+  char line[256];
+  cover_cache_stats(&daemon->covers, &stats);
+  daemon_format_stats(line, sizeof(line), &stats);
+  log_info("%s", line);
+  cover_cache_free(&daemon->covers);
+
+  close(daemon->listen_fd);
+  close(daemon->wake_pipe[0]);
+  close(daemon->wake_pipe[1]);
+  unlink(path);
+  log_info("daemon stopped");
+  return e_success;
+}
+
+/*
+ * Function: daemon_client_open
+ * ----------------------------
+ * Opens the fds a request carries, returns how many
+ */
+static int daemon_client_open(DaemonOp op, char *argv[], int *fds)
+{
+  if (op == e_daemon_encode)
+  {
+    fds[0] = open(argv[5], O_RDONLY | O_CLOEXEC);
+    fds[1] = open(argv[6] ? argv[6] : "stego.bmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  else if (op == e_daemon_decode)
+  {
+    fds[0] = open(argv[4], O_RDONLY | O_CLOEXEC);
+    fds[1] = open(argv[5] ? argv[5] : "decodedfile.txt", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  else if (op == e_daemon_probe)
+  {
+    fds[0] = open(argv[4], O_RDONLY | O_CLOEXEC);
+    fds[1] = -1;
+    if (fds[0] < 0)
+      log_error(e_err_io, "Unable to open file %s: %s", argv[4], strerror(errno));
+    return fds[0] < 0 ? -1 : 1;
+  }
+  else
+  {
+    return 0;
+  }
+  if (fds[0] < 0 || fds[1] < 0)
+  {
+    log_error(e_err_io, "Unable to open file %s: %s", fds[0] < 0 ? argv[4] : argv[5] ? argv[5] : "decodedfile.txt", strerror(errno));
+    if (fds[0] >= 0)
+      close(fds[0]);
+    if (fds[1] >= 0)
+      close(fds[1]);
+    return -1;
+  }
+  return 2;
+}
+
+/*
+ * Function: do_daemon_client
+ * --------------------------
+ * Handles "-c socket_path e cover.bmp secret.txt [out.bmp]",
+ * "-c socket_path d stego.bmp [out.txt]",
+ * "-c socket_path p stego.bmp" and "-c socket_path s" for the
+ * cover cache counters. With --repeat=N the request is
+ * sent N times and the round trip latency is reported.
+ */
+Status do_daemon_client(char *argv[], const StegoOptions *opts)
+{
+  DaemonRequest req;
+  DaemonResponse resp;
+  struct sockaddr_un addr;
+  DaemonOp op;
+
+  if (strcmp(argv[3], "e") == 0 && argv[4] && argv[5])
+    op = e_daemon_encode;
+  else if (strcmp(argv[3], "d") == 0 && argv[4])
+    op = e_daemon_decode;
+  else if (strcmp(argv[3], "p") == 0 && argv[4])
+    op = e_daemon_probe;
+  else if (strcmp(argv[3], "s") == 0)
+    op = e_daemon_stats;
+  else
+  {
+    log_error(e_err_args, "client operation must be e, d, p or s with its files");
+    return e_failure;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.proto_magic = DAEMON_PROTO_MAGIC;
+  req.op = op;
+  req.embed_mode = opts->embed_mode;
+  req.embed_param = opts->embed_param;
+  req.spread = (uint)opts->spread;
+  if (op == e_daemon_encode)
+  {
+    // the daemon caches covers by path, so send the absolute one
+    char cover_path[PATH_MAX];
+    if (realpath(argv[4], cover_path) == NULL || strlen(cover_path) >= DAEMON_MAX_PATH)
+    {
+      log_error(e_err_io, "Unable to resolve cover %s", argv[4]);
+      return e_failure;
+    }
+    strcpy(req.cover_path, cover_path);
+  }
+  if (op != e_daemon_stats)
+  {
+    log_flush();
+    printf("Enter magic string:");
+    scanf("%19s", req.magic_string);
+  }
+
+  int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[2]);
+  if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    log_error(e_err_daemon, "no daemon on %s: %s", argv[2], strerror(errno));
+    if (sock >= 0)
+      close(sock);
+    return e_failure;
+  }
+
+  uint repeat = opts->repeat ? opts->repeat : 1;
+  double total = 0, best = 0;
+  Status status = e_success;
+  for (uint i = 0; i < repeat && status == e_success; i++)
+  {
+    int fds[2];
+    int n_fds = daemon_client_open(op, argv, fds);
+    if (n_fds < 0)
+    {
+      status = e_failure;
+      break;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ssize_t sent = daemon_send(sock, &req, sizeof(req), fds, n_fds);
+    ssize_t got = sent == sizeof(req) ? recv(sock, &resp, sizeof(resp), 0) : -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int f = 0; f < n_fds; f++)
+      close(fds[f]);
+
+    if (got != sizeof(resp))
+    {
+      log_error(e_err_daemon, "daemon closed the connection");
+      status = e_failure;
+      break;
+    }
+    double elapsed = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    total += elapsed;
+    if (best == 0 || elapsed < best)
+      best = elapsed;
+    if (resp.status != e_success)
+      status = e_failure;
+  }
+  close(sock);
+
+  if (status == e_success && op == e_daemon_stats)
+  {
+    char line[256];
+    daemon_format_stats(line, sizeof(line), &resp.cache);
+    printf("%s\n", line);
+  }
+  else if (status == e_success)
+  {
+    printf("%s: %llu bytes, crc32c %08x%s\n", resp.message, resp.size_secret_file, resp.digest,
+           op == e_daemon_encode ? (resp.cover_cached ? ", cover cached" : ", cover loaded") : "");
+    printf("%u requests, avg %.1f us, min %.1f us\n", repeat, total / repeat, best);
+  }
+  else if (total > 0)
+  {
+    log_error(e_err_daemon, "%s", resp.message);
+  }
+  return status;
+}
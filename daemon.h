@@ -0,0 +1,75 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "types.h" // Contains user defined types
+#include "common.h" // Options, magic string length
+#include "cover_cache.h" // Cache statistics
+
+/*
+ * Long running stego daemon.
+ * Listens on a Unix domain (SOCK_SEQPACKET) socket and serves
+ * encode, decode and probe requests from a pool of worker
+ * threads. Image, secret and output files are passed as file
+ * descriptors (SCM_RIGHTS), so a memfd works as a shared
+ * memory buffer. Cover images named by path are served from a
+ * cover cache shared by the workers. Idle connections wait in
+ * the accept loop's poll set; a worker serves one request and
+ * hands the connection back, so idle clients never hold a
+ * worker.
+ */
+
+#define DAEMON_PROTO_MAGIC 0x44475453u // "STGD"
+#define DAEMON_MAX_PATH 256
+#define DAEMON_MAX_WORKERS 64
+#define DAEMON_MAX_CONNECTIONS 1024
+
+typedef enum
+{
+    e_daemon_encode,
+    e_daemon_decode,
+    e_daemon_probe,
+    e_daemon_stats
+} DaemonOp;
+
+/*
+ * Request, followed by the fds:
+ *   encode: secret file, output image (cover is cover_path)
+ *   decode: stego image, output file
+ *   probe:  stego image
+ *   stats:  none
+ */
+typedef struct _DaemonRequest
+{
+    uint proto_magic;
+    uint op;
+    uint embed_mode;
+    uint embed_param;
+    uint spread;
+    char magic_string[MAX_MAGIC_STRING_LEN + 1];
+    char cover_path[DAEMON_MAX_PATH];
+} DaemonRequest;
+
+typedef struct _DaemonResponse
+{
+    uint status;
+    uint64 size_secret_file;
+    uint digest;
+    uint embed_mode;
+    uint embed_param;
+    uint cover_cached;
+    char message[128];
+
+    /* Cover cache counters, filled for stats requests */
+    CoverCacheStats cache;
+} DaemonResponse;
+
+
+/* Daemon function prototype */
+
+/* Serve requests on "-D socket_path [workers]" until SIGINT/SIGTERM */
+Status do_daemon(char *argv[], const StegoOptions *opts);
+
+/* Client "-c socket_path e|d|p|s [image] [file] [output]" */
+Status do_daemon_client(char *argv[], const StegoOptions *opts);
+
+#endif
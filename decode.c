@@ -1,9 +1,20 @@
+#define _GNU_SOURCE // O_TMPFILE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "decode.h"
 #include "types.h"
 #include "common.h"
-#include <stdlib.h>
+#include "arena.h"
+#include "bmp.h"
+#include "crc32c.h"
+#include "log.h"
+#include <time.h>
 /* 
  * Function: read_and_validate_decode_args
  * ---------------------------------------
@@ -51,11 +62,11 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
      }
      else
      {
-       //allocate dynamic memory for .txt + '\0'
-       char *file_extn=malloc(strlen(argv[3])+5);
+       //allocate name + .txt + '\0' from the job arena
+       char *file_extn=arena_alloc(&decInfo->arena, strlen(argv[3])+5);
        if(!file_extn)
        {
-         fprintf(stderr,"Memory alocation failed\n");
+         log_error(e_err_memory,"Memory alocation failed");
          return e_failure;
        }
        sprintf(file_extn,"%s.txt",argv[3]);
@@ -72,29 +83,225 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 /* 
  * Function: open_decode_files
  * ---------------------------
- * Opens the stego image and the file to write the decoded output.
- * Performs error checks on each file.
+ * Opens the stego image. The output file is only created by
+ * decode_open_output, once the header has been validated, so
+ * an image without a secret leaves nothing behind.
  */
 Status open_decode_files(DecodeInfo *decInfo)
 {
+  // streams the caller already opened (daemon jobs) are used as is
+  if (decInfo->fptr_stego_image)
+    return e_success;
+
   // Src Image file
   decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb");
    // Do Error handling
   if (decInfo->fptr_stego_image == NULL)
   {
-    perror("fopen");
-    fprintf(stderr, "ERROR: unable to open file %s\n", decInfo->stego_image_fname);
+    log_error(e_err_io, "unable to open file %s: %s", decInfo->stego_image_fname, strerror(errno));
     return e_failure;
   }
-  // decoded file
-  decInfo->fptr_decode = fopen(decInfo->decode_fname, "wb");
-   // Do Error handling
-  if (decInfo->fptr_decode == NULL)
+  return e_success;
+}
+
+/* 
+ * Function: decode_open_output
+ * ----------------------------
+ * Creates the decoded output after the header checked out. It
+ * is an unnamed O_TMPFILE in the output's directory, so a
+ * failed decode never leaves a partial file; filesystems
+ * without O_TMPFILE get a new file named after decode_fname,
+ * created with O_EXCL so no existing file is touched before
+ * decode_commit_output renames it.
+ */
+Status decode_open_output(DecodeInfo *decInfo)
+{
+  // the daemon passes an open output in
+  if (decInfo->fptr_decode)
+  {
+    decInfo->decode_output = e_output_caller;
+    return e_success;
+  }
+
+  const char *slash = strrchr(decInfo->decode_fname, '/');
+  char *dir = arena_strdup(&decInfo->arena, slash ? decInfo->decode_fname : ".");
+  if (dir == NULL)
   {
-    perror("fopen");
-    fprintf(stderr, "ERROR: unable to open file %s\n", decInfo->decode_fname);
+    log_error(e_err_memory, "Memory alocation failed");
     return e_failure;
   }
+  if (slash)
+    dir[slash - decInfo->decode_fname + (slash == decInfo->decode_fname)] = '\0';
+
+  int fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+  decInfo->decode_output = e_output_tmpfile;
+  if (fd < 0)
+  {
+    decInfo->decode_output = e_output_named;
+    decInfo->decode_tmp_fname = arena_alloc(&decInfo->arena, strlen(decInfo->decode_fname) + 32);
+    if (decInfo->decode_tmp_fname == NULL)
+    {
+      log_error(e_err_memory, "Memory alocation failed");
+      return e_failure;
+    }
+    for (uint attempt = 0; fd < 0 && attempt < DECODE_TMP_ATTEMPTS; attempt++)
+    {
+      sprintf(decInfo->decode_tmp_fname, "%s.%ld.%u.tmp", decInfo->decode_fname, (long)getpid(), attempt);
+      fd = open(decInfo->decode_tmp_fname, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+      if (fd < 0 && errno != EEXIST)
+        break;
+    }
+  }
+  if (fd < 0 || (decInfo->fptr_decode = fdopen(fd, "wb")) == NULL)
+  {
+    const char *fname = decInfo->decode_output == e_output_named ? decInfo->decode_tmp_fname : decInfo->decode_fname;
+    log_error(e_err_io, "unable to open file %s: %s", fname, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    if (fd >= 0 && decInfo->decode_output == e_output_named)
+      unlink(decInfo->decode_tmp_fname);
+    decInfo->decode_output = e_output_caller;
+    return e_failure;
+  }
+  return e_success;
+}
+
+/* 
+ * Function: decode_commit_output
+ * ------------------------------
+ * Flushes and closes the output. An O_TMPFILE output gets its
+ * name here with linkat, through a temporary name and rename
+ * when decode_fname already exists; a named temporary file is
+ * renamed over decode_fname. Either way the file appears whole.
+ */
+Status decode_commit_output(DecodeInfo *decInfo)
+{
+  Status status = fflush(decInfo->fptr_decode) == 0 ? e_success : e_failure;
+  if (status != e_success)
+    log_error(e_err_io, "unable to write %s: %s", decInfo->decode_fname, strerror(errno));
+  if (status == e_success && decInfo->decode_output == e_output_tmpfile)
+  {
+    char fd_path[32], *tmp_fname;
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fileno(decInfo->fptr_decode));
+    if (linkat(AT_FDCWD, fd_path, AT_FDCWD, decInfo->decode_fname, AT_SYMLINK_FOLLOW) != 0)
+    {
+      status = e_failure;
+      if (errno == EEXIST && (tmp_fname = arena_alloc(&decInfo->arena, strlen(decInfo->decode_fname) + 24)) != NULL)
+      {
+        sprintf(tmp_fname, "%s.%ld.tmp", decInfo->decode_fname, (long)getpid());
+        if (linkat(AT_FDCWD, fd_path, AT_FDCWD, tmp_fname, AT_SYMLINK_FOLLOW) == 0)
+        {
+          if (rename(tmp_fname, decInfo->decode_fname) == 0)
+            status = e_success;
+          else
+            unlink(tmp_fname);
+        }
+      }
+    }
+    if (status != e_success)
+      log_error(e_err_io, "unable to create %s: %s", decInfo->decode_fname, strerror(errno));
+  }
+  if (fclose(decInfo->fptr_decode) != 0)
+    status = e_failure;
+  decInfo->fptr_decode = NULL;
+  // the named temporary file replaces decode_fname only once it is whole
+  if (decInfo->decode_output == e_output_named)
+  {
+    if (status == e_success && rename(decInfo->decode_tmp_fname, decInfo->decode_fname) != 0)
+    {
+      log_error(e_err_io, "unable to create %s: %s", decInfo->decode_fname, strerror(errno));
+      status = e_failure;
+    }
+    if (status != e_success)
+      unlink(decInfo->decode_tmp_fname);
+  }
+  decInfo->decode_output = e_output_caller;
+  return status;
+}
+
+/* 
+ * Function: decode_discard_output
+ * -------------------------------
+ * Closes the output after a failed decode. An O_TMPFILE output
+ * goes away on close; a named temporary file is removed, and
+ * decode_fname is left as it was.
+ */
+void decode_discard_output(DecodeInfo *decInfo)
+{
+  if (decInfo->fptr_decode == NULL)
+    return;
+  fclose(decInfo->fptr_decode);
+  if (decInfo->decode_output == e_output_named)
+    unlink(decInfo->decode_tmp_fname);
+  decInfo->fptr_decode = NULL;
+  decInfo->decode_output = e_output_caller;
+}
+
+/* 
+ * Function: decode_probe_header
+ * -----------------------------
+ * Reads the BMP header and the longest stego header with one
+ * pread and compares the magic string straight from it, so an
+ * image without a secret costs one system call and nothing is
+ * logged. On a match the header fields that follow are decoded
+ * from the same buffer. Streams without a descriptor (fmemopen)
+ * skip the probe and are read as before.
+ *
+ * Returns: e_failure if the image does not start with the magic string
+ */
+Status decode_probe_header(DecodeInfo *decInfo)
+{
+  char magic_buffer[20];
+  struct stat st;
+  decInfo->probe = NULL;
+  if (decInfo->magic_string == NULL)
+  {
+    log_flush();
+    printf("Enter magic string:");
+    scanf("%19s", magic_buffer);
+    decInfo->magic_string = arena_strdup(&decInfo->arena, magic_buffer);
+    if (decInfo->magic_string == NULL)
+      return e_failure;
+  }
+
+  int fd = fileno(decInfo->fptr_stego_image);
+  if (fd < 0 || fstat(fd, &st) != 0)
+    return e_success;
+  unsigned char *probe = arena_alloc(&decInfo->arena, DECODE_PROBE_SIZE);
+  if (probe == NULL)
+    return e_success;
+  ssize_t n = pread(fd, probe, DECODE_PROBE_SIZE, 0);
+  if (n < 0)
+    return e_success;
+
+  uint magic_len = strlen(decInfo->magic_string);
+  if ((size_t)n < 54 + magic_len * 8)
+    return e_failure;
+  for (uint i = 0; i < magic_len; i++)
+    if (decode_byte_from_lsb((char *)probe + 54 + i * 8) != decInfo->magic_string[i])
+      return e_failure;
+
+  decInfo->probe = probe;
+  decInfo->probe_len = (uint)n;
+  decInfo->probe_pos = 54;
+  decInfo->image_file_size = (uint64)st.st_size;
+  return e_success;
+}
+
+/* 
+ * Function: decode_header_bits
+ * ----------------------------
+ * Fills Image_data with the 8 image bytes of the next header
+ * byte, from the probe buffer or else from the stream.
+ */
+static Status decode_header_bits(DecodeInfo *decInfo)
+{
+  if (decInfo->probe == NULL)
+    return fread(decInfo->Image_data, sizeof(char), 8, decInfo->fptr_stego_image) == 8 ? e_success : e_failure;
+  if (decInfo->probe_pos + 8 > decInfo->probe_len)
+    return e_failure;
+  memcpy(decInfo->Image_data, decInfo->probe + decInfo->probe_pos, 8);
+  decInfo->probe_pos += 8;
   return e_success;
 }
 
@@ -105,28 +312,46 @@ Status open_decode_files(DecodeInfo *decInfo)
  */
 Status decode_magic_string(DecodeInfo *DecInfo)
 {
-  //Ask user magic string
-  char magic_string[20];
-  printf("Enter magic string:");
-  scanf("%s",magic_string);
+  //Ask user magic string, unless the caller (daemon) or the probe supplied it
+  char magic_buffer[20];
+  const char *magic_string = DecInfo->magic_string;
+  if (magic_string == NULL)
+  {
+    log_flush();
+    printf("Enter magic string:");
+    scanf("%19s",magic_buffer);
+    magic_string = magic_buffer;
+  }
 
   //skip 54 bytes of header from starting
-  fseek(DecInfo->fptr_stego_image, 54, SEEK_SET);
+  if (DecInfo->probe)
+    DecInfo->probe_pos = 54;
+  else
+    fseek(DecInfo->fptr_stego_image, 54, SEEK_SET);
   //calculate length of magic string
   int magic_len = strlen(magic_string);
-  //length + '\0' store in decoded magic variable
-  char decoded_magic[magic_len + 1];
+  //length + '\0' store in decoded magic buffer from the job arena
+  char *decoded_magic = arena_alloc(&DecInfo->arena, magic_len + 1);
+  if (decoded_magic == NULL)
+  {
+    log_error(e_err_memory, "Memory alocation failed");
+    return e_failure;
+  }
   int i;
   for (i = 0; i < magic_len; i++)
   {
-    fread(DecInfo->Image_data, sizeof(char), 8, DecInfo->fptr_stego_image);
+    if (decode_header_bits(DecInfo) != e_success)
+    {
+      log_error(e_err_header, "Stego image ends before the magic string");
+      return e_failure;
+    }
     decoded_magic[i] = decode_byte_from_lsb(DecInfo->Image_data);
   }
   decoded_magic[magic_len] = '\0';
 
   if (strcmp(decoded_magic,magic_string) != 0)
   {
-    fprintf(stderr, "Magic string mismatch:expected %s got %s\n", magic_string, decoded_magic);
+    log_error(e_err_magic, "Magic string mismatch:expected %s got %s", magic_string, decoded_magic);
     return e_failure;
   }
   else
@@ -141,19 +366,39 @@ Status decode_magic_string(DecodeInfo *DecInfo)
 Status decode_secret_file_extn_size(DecodeInfo *DecInfo)
 {
   char decoded_size[4];
-  int data = 0;
+  uint data = 0;
   for (int i = 0; i < 4; i++)
   {
-    fread(DecInfo->Image_data, sizeof(char), 8, DecInfo->fptr_stego_image);
+    if (decode_header_bits(DecInfo) != e_success)
+      return e_failure;
     decoded_size[i] = decode_byte_from_lsb(DecInfo->Image_data);
-    data = data | ((unsigned char)decoded_size[i]<<(i*8));
+    data = data | ((uint)(unsigned char)decoded_size[i]<<(i*8));
   }
 
-  if (data <= 0 || data != 4)
+  // low byte is the extension length, the rest says how the data was embedded
+  uint mode = STEGO_FORMAT_MODE(data);
+  uint param = STEGO_FORMAT_PARAM(data);
+  if (STEGO_FORMAT_EXTN_LEN(data) != 4 || (data & ~(STEGO_KNOWN_FLAGS | 0xffffff)) != 0 || mode >= e_embed_mode_count)
   {
-    fprintf(stderr, "Invalide extension size : %d\n", data);
+    log_error(e_err_header, "Invalide extension size : %u", data);
     return e_failure;
   }
+  if (mode == e_embed_matrix && (param < MATRIX_MIN_RATE || param > MATRIX_MAX_RATE))
+  {
+    log_error(e_err_header, "Invalide matrix rate : %u", param);
+    return e_failure;
+  }
+  // the kernel is looked up once here and used for every chunk
+  DecInfo->kernel = embed_kernel_select((EmbedMode)mode, param);
+  if (DecInfo->kernel == NULL)
+  {
+    log_error(e_err_header, "Invalide pixel format : %u bits per channel, %u bytes per pixel, channel mask %u", PIXEL_PARAM_BITS(param),
+              PIXEL_PARAM_BPP(param), PIXEL_PARAM_SKIP(param));
+    return e_failure;
+  }
+  DecInfo->embed_mode = (EmbedMode)mode;
+  DecInfo->embed_param = param;
+  DecInfo->format_flags = data & STEGO_KNOWN_FLAGS;
   return e_success;
 }
 
@@ -167,49 +412,250 @@ Status decode_secret_file_extn(DecodeInfo *DecInfo)
   int extn_size = strlen(".txt");
   for (int i = 0; i < extn_size; i++)
   {
-    fread(DecInfo->Image_data, sizeof(char), 8, DecInfo->fptr_stego_image);
+    if (decode_header_bits(DecInfo) != e_success)
+      return e_failure;
     DecInfo->extn_secret_file[i] = decode_byte_from_lsb(DecInfo->Image_data);
   }
   DecInfo->extn_secret_file[extn_size] = '\0';
   return e_success;
 }
 
+/* 
+ * Function: decode_image_bytes_left
+ * ---------------------------------
+ * Image bytes between the read position (in the probe buffer
+ * or the stream) and the end of the stego image, 0 if the
+ * stream cannot seek.
+ */
+static uint64 decode_image_bytes_left(DecodeInfo *DecInfo)
+{
+  if (DecInfo->probe)
+    return DecInfo->image_file_size > DecInfo->probe_pos ? DecInfo->image_file_size - DecInfo->probe_pos : 0;
+  FILE *fptr = DecInfo->fptr_stego_image;
+  off_t pos = ftello(fptr);
+  if (pos < 0 || fseeko(fptr, 0, SEEK_END) != 0)
+    return 0;
+  off_t end = ftello(fptr);
+  fseeko(fptr, pos, SEEK_SET);
+  return end > pos ? (uint64)(end - pos) : 0;
+}
+
 /* 
  * Function: decode_secret_file_size
  * ---------------------------------
- * Retrieves the size of the hidden secret file.
+ * Retrieves the size of the hidden secret file: 4 bytes, or
+ * 8 when the format word carries STEGO_FLAG_SIZE64.
  */
 Status decode_secret_file_size(DecodeInfo *DecInfo)
 {
-  char decoded_size[4];
-  int data=0;
-  for (int i = 0; i < 4; i++)
+  int field_size = STEGO_SIZE_FIELD_BYTES(DecInfo->format_flags);
+  uint64 data = 0;
+  for (int i = 0; i < field_size; i++)
   {
-    fread(DecInfo->Image_data, sizeof(char), 8, DecInfo->fptr_stego_image);
-    decoded_size[i] = decode_byte_from_lsb(DecInfo->Image_data);
-    data = data | ((unsigned char)decoded_size[i]<<(i*8));
+    if (decode_header_bits(DecInfo) != e_success)
+      return e_failure;
+    data = data | ((uint64)(unsigned char)decode_byte_from_lsb(DecInfo->Image_data) << (i * 8));
   }
-  if (data <= 0)
+  // the 4 byte field was written as an int
+  if (data == 0 || (field_size == 4 && data > STEGO_MAX_SIZE32))
   {
-    fprintf(stderr, "Invalide secret file size : %d\n", data);
+    log_error(e_err_header, "Invalide secret file size : %llu", data);
+    return e_failure;
+  }
+  // the digest and the secret must fit in the rest of the image, so a
+  // damaged size field costs no more work than reading the file.
+  // Every mode takes at least 1 image byte per secret byte.
+  uint64 left = decode_image_bytes_left(DecInfo);
+  uint64 digest_bytes = (DecInfo->format_flags & STEGO_FLAG_DIGEST) ? 32 : 0;
+  if (data > left || digest_bytes + embed_image_bytes(DecInfo->embed_mode, DecInfo->embed_param, data) > left)
+  {
+    log_error(e_err_header, "Invalide secret file size : %llu bytes do not fit the %llu image bytes left", data, left);
     return e_failure;
   }
   DecInfo->size_secret_file = data;
   return e_success;
 }
 
+/* 
+ * Function: decode_secret_file_digest
+ * -----------------------------------
+ * Retrieves the CRC-32C stored after the file size. Images
+ * encoded without one skip this step.
+ */
+Status decode_secret_file_digest(DecodeInfo *DecInfo)
+{
+  if (!(DecInfo->format_flags & STEGO_FLAG_DIGEST))
+    return e_success;
+  uint data = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    if (decode_header_bits(DecInfo) != e_success)
+      return e_failure;
+    data = data | ((uint)(unsigned char)decode_byte_from_lsb(DecInfo->Image_data) << (i * 8));
+  }
+  DecInfo->digest_secret_file = data;
+  return e_success;
+}
+
+/* 
+ * Function: decode_end_probe
+ * --------------------------
+ * Moves the stream to the first byte after the header decoded
+ * from the probe buffer, where the secret data starts.
+ */
+static Status decode_end_probe(DecodeInfo *DecInfo)
+{
+  if (DecInfo->probe == NULL)
+    return e_success;
+  off_t pos = DecInfo->probe_pos;
+  DecInfo->probe = NULL;
+  return fseeko(DecInfo->fptr_stego_image, pos, SEEK_SET) == 0 ? e_success : e_failure;
+}
+
+/* 
+ * Function: decode_skip_data_pad
+ * ------------------------------
+ * Moves the read position over the image bytes the encoder left
+ * between the end of the header and the next whole pixel
+ */
+static Status decode_skip_data_pad(DecodeInfo *DecInfo)
+{
+  off_t pos = DecInfo->probe ? (off_t)DecInfo->probe_pos : ftello(DecInfo->fptr_stego_image);
+  if (pos < BMP_HEADER_SIZE)
+    return e_failure;
+  DecInfo->data_pad = embed_data_pad(DecInfo->embed_mode, DecInfo->embed_param, (uint64)(pos - BMP_HEADER_SIZE));
+  if (DecInfo->probe)
+  {
+    DecInfo->probe_pos += DecInfo->data_pad;
+    return e_success;
+  }
+  return fseeko(DecInfo->fptr_stego_image, DecInfo->data_pad, SEEK_CUR) == 0 ? e_success : e_failure;
+}
+
+/* 
+ * Function: decode_secret_file_stride
+ * -----------------------------------
+ * Retrieves the stride stored after the digest by --spread.
+ * The strided secret data must still end inside the image.
+ * This is the last header field, so the stream takes over from
+ * the probe buffer here, past the pad before the secret data.
+ */
+Status decode_secret_file_stride(DecodeInfo *DecInfo)
+{
+  DecInfo->spread_stride = 0;
+  if (!(DecInfo->format_flags & STEGO_FLAG_STRIDE))
+    return decode_skip_data_pad(DecInfo) == e_success ? decode_end_probe(DecInfo) : e_failure;
+  uint data = 0;
+  for (int i = 0; i < STEGO_STRIDE_FIELD_BYTES; i++)
+  {
+    if (decode_header_bits(DecInfo) != e_success)
+      return e_failure;
+    data = data | ((uint)(unsigned char)decode_byte_from_lsb(DecInfo->Image_data) << (i * 8));
+  }
+  if (decode_skip_data_pad(DecInfo) != e_success)
+    return e_failure;
+  uint unit = embed_unit_size(DecInfo->embed_mode, DecInfo->embed_param);
+  uint64 units = (embed_image_bytes(DecInfo->embed_mode, DecInfo->embed_param, DecInfo->size_secret_file) + unit - 1) / unit;
+  uint64 left = decode_image_bytes_left(DecInfo) / unit;
+  if (data == 0 || units > left / data)
+  {
+    log_error(e_err_header, "Invalide stride : %u units for %llu units of secret data", data, units);
+    return e_failure;
+  }
+  DecInfo->spread_stride = data;
+  return decode_end_probe(DecInfo);
+}
+
+/* 
+ * Function: decode_read_image_chunk
+ * ---------------------------------
+ * Reads the image bytes that carry the next chunk into
+ * image_chunk: back to back, or gathered from every
+ * spread_stride units. A strided span that fits
+ * STEGO_SPREAD_WINDOW is read at once, a wider one unit by
+ * unit, leaving the stream after the span either way.
+ */
+static Status decode_read_image_chunk(DecodeInfo *DecInfo, uint image_bytes)
+{
+  if (DecInfo->spread_stride == 0)
+    return fread(DecInfo->image_chunk, sizeof(char), image_bytes, DecInfo->fptr_stego_image) == image_bytes ? e_success : e_failure;
+
+  uint stride = DecInfo->spread_stride;
+  uint unit = embed_unit_size(DecInfo->embed_mode, DecInfo->embed_param);
+  uint n_units = (image_bytes + unit - 1) / unit;
+  uint64 step = (uint64)stride * unit;
+  uint64 span = n_units * step;
+  if (span <= STEGO_SPREAD_WINDOW)
+  {
+    if (fread(DecInfo->spread_window, sizeof(char), span, DecInfo->fptr_stego_image) != span)
+      return e_failure;
+    gather_strided(DecInfo->spread_window, n_units, unit, stride, DecInfo->image_chunk);
+    return e_success;
+  }
+  off_t base = ftello(DecInfo->fptr_stego_image);
+  for (uint i = 0; i < n_units; i++)
+  {
+    if (fseeko(DecInfo->fptr_stego_image, base + (off_t)(i * step), SEEK_SET) != 0 ||
+        fread(DecInfo->image_chunk + i * unit, sizeof(char), unit, DecInfo->fptr_stego_image) != unit)
+      return e_failure;
+  }
+  return fseeko(DecInfo->fptr_stego_image, base + (off_t)span, SEEK_SET) == 0 ? e_success : e_failure;
+}
+
 /* 
  * Function: decode_secret_file_data
  * ---------------------------------
- * Extracts the hidden content of the secret file and writes it to the output file.
+ * Extracts the hidden content of the secret file and writes it to the output file,
+ * computing its CRC-32C on the way.
  */
 Status decode_secret_file_data(DecodeInfo *DecInfo)
 {
-  for (int i = 0; i < DecInfo->size_secret_file; i++)
+  // chunk buffers come from the job arena
+  if (DecInfo->image_chunk == NULL)
+  {
+    DecInfo->image_chunk = arena_alloc(&DecInfo->arena, STEGO_CHUNK_SIZE * 8);
+    DecInfo->secret_chunk = arena_alloc(&DecInfo->arena, STEGO_CHUNK_SIZE);
+    if (DecInfo->image_chunk == NULL || DecInfo->secret_chunk == NULL)
+    {
+      log_error(e_err_memory, "Memory alocation failed");
+      return e_failure;
+    }
+  }
+  if (DecInfo->spread_stride && DecInfo->spread_window == NULL &&
+      (DecInfo->spread_window = arena_alloc(&DecInfo->arena, STEGO_SPREAD_WINDOW)) == NULL)
+  {
+    log_error(e_err_memory, "Memory alocation failed");
+    return e_failure;
+  }
+  uint chunk_size = DecInfo->spread_stride ? embed_spread_chunk_size(DecInfo->embed_mode, DecInfo->embed_param, DecInfo->spread_stride)
+                                           : embed_chunk_size(DecInfo->embed_mode, DecInfo->embed_param);
+  uint crc = CRC32C_INIT;
+  for (uint64 done = 0; done < DecInfo->size_secret_file; )
+  {
+    uint count = chunk_size;
+    if (DecInfo->size_secret_file - done < count)
+      count = (uint)(DecInfo->size_secret_file - done);
+    uint image_bytes = embed_image_bytes(DecInfo->embed_mode, DecInfo->embed_param, count);
+    if (decode_read_image_chunk(DecInfo, image_bytes) != e_success)
+    {
+      log_error(e_err_header, "Stego image ends before the secret data");
+      return e_failure;
+    }
+    DecInfo->kernel->extract(DecInfo->image_chunk, count, DecInfo->secret_chunk);
+    crc = crc32c_update(crc, DecInfo->secret_chunk, count);
+    // verify mode has no output file
+    if (DecInfo->fptr_decode && fwrite(DecInfo->secret_chunk, sizeof(char), count, DecInfo->fptr_decode) != count)
+    {
+      log_error(e_err_io, "unable to write the decoded secret: %s", strerror(errno));
+      return e_failure;
+    }
+    done += count;
+  }
+  DecInfo->digest_decoded = crc32c_final(crc);
+  if ((DecInfo->format_flags & STEGO_FLAG_DIGEST) && !DecInfo->verify && DecInfo->digest_decoded != DecInfo->digest_secret_file)
   {
-    fread(DecInfo->Image_data, sizeof(char), 8, DecInfo->fptr_stego_image);
-    char ch = decode_byte_from_lsb(DecInfo->Image_data);
-    fwrite(&ch, sizeof(char), 1, DecInfo->fptr_decode);
+    log_error(e_err_digest, "Secret file digest mismatch:expected %08x got %08x", DecInfo->digest_secret_file, DecInfo->digest_decoded);
+    return e_failure;
   }
   return e_success;
 }
@@ -239,61 +685,194 @@ Status do_decoding(DecodeInfo *decInfo)
 {
   if (open_decode_files(decInfo) == e_success)
   {
-    printf("opened file successfully\n");
-    printf("Decoding started\n");
-    if (decode_magic_string(decInfo) == e_success)
+    log_info("opened file successfully");
+    log_info("Decoding started");
+    if (decode_probe_header(decInfo) == e_success && decode_magic_string(decInfo) == e_success)
     {
-      printf("Decoded magic string successfully\n");
+      log_info("Decoded magic string successfully");
       if (decode_secret_file_extn_size(decInfo) == e_success)
       {
-        printf("Decoded secret file extn size successfully\n");
+        log_info("Decoded secret file extn size successfully");
         if (decode_secret_file_extn(decInfo) == e_success)
         {
-          printf("Decoded secret file extn successfully\n");
+          log_info("Decoded secret file extn successfully");
           if (decode_secret_file_size(decInfo) == e_success)
           {
-            printf("Decoded secret file size successfully\n");
-            if (decode_secret_file_data(decInfo) == e_success)
+            log_info("Decoded secret file size successfully");
+            if (decode_secret_file_digest(decInfo) == e_success)
             {
-              printf("Decoded secret file data successfully\n");
-              //freeing the file poiters
-              fclose(decInfo->fptr_stego_image);
-              fclose(decInfo->fptr_decode);
+              log_info("Decoded secret file digest successfully");
+              if (decode_secret_file_stride(decInfo) == e_success)
+              {
+                // the output is only created once the header checked out
+                if (decode_open_output(decInfo) == e_success)
+                {
+                  if (decode_secret_file_data(decInfo) == e_success)
+                  {
+                    log_info("Decoded secret file data successfully");
+                    //freeing the file poiters
+                    fclose(decInfo->fptr_stego_image);
+                    decInfo->fptr_stego_image = NULL;
+                    if (decode_commit_output(decInfo) != e_success)
+                      return e_failure;
+                  }
+                  else
+                  {
+                    log_failure(e_err_io, "failed to decode secret file data");
+                    decode_discard_output(decInfo);
+                    return e_failure;
+                  }
+                }
+                else
+                {
+                  return e_failure;
+                }
+              }
+              else
+              {
+                log_failure(e_err_header, "failed to decode secret file stride");
+                return e_failure;
+              }
             }
             else
             {
-              fprintf(stderr, "failed to decode secret file data\n");
+              log_failure(e_err_io, "failed to decode secret file digest");
               return e_failure;
             }
           }
           else
           {
-            fprintf(stderr, "failed to Decode secret file size\n");
+            log_failure(e_err_header, "failed to decode secret file size");
             return e_failure;
           }
         }
         else
         {
-          fprintf(stderr, "failed to decode secret file extn\n");
+          log_failure(e_err_io, "failed to decode secret file extn");
           return e_failure;
         }
       }
       else
       {
-        fprintf(stderr, "failed to decoded secret file extn size\n");
+        log_failure(e_err_header, "failed to decode secret file extn size");
         return e_failure;
       }
     }
     else
     {
-      fprintf(stderr, "failed to decode magic string\n");
+      log_failure(e_err_magic, "failed to decode magic string");
       return e_failure;
     }
   }
   else
   {
-    fprintf(stderr, "failed to open file\n");
+    log_failure(e_err_io, "failed to open file");
     return e_failure;
   }
   return e_success;
-}
\ No newline at end of file
+}
+
+/* 
+ * Function: decode_stego_header
+ * -----------------------------
+ * Runs every decode step before the secret data: magic string,
+ * format word, extension, size and digest. Used on its own to
+ * probe whether an image carries a secret; an image without the
+ * magic string is turned away after a single pread.
+ */
+Status decode_stego_header(DecodeInfo *decInfo)
+{
+  if (decode_probe_header(decInfo) != e_success)
+  {
+    log_error(e_err_magic, "%s does not carry a secret for this magic string", decInfo->stego_image_fname);
+    return e_failure;
+  }
+  if (decode_magic_string(decInfo) == e_success &&
+      decode_secret_file_extn_size(decInfo) == e_success &&
+      decode_secret_file_extn(decInfo) == e_success &&
+      decode_secret_file_size(decInfo) == e_success &&
+      decode_secret_file_digest(decInfo) == e_success &&
+      decode_secret_file_stride(decInfo) == e_success)
+    return e_success;
+  return e_failure;
+}
+
+/* 
+ * Function: do_verify
+ * -------------------
+ * Checks a stego image without writing the secret out. The
+ * secret data is extracted chunk by chunk into the job arena
+ * and streamed through CRC-32C, then compared to the digest
+ * given on the command line or, failing that, the embedded one.
+ */
+Status do_verify(DecodeInfo *decInfo)
+{
+  struct timespec start, end;
+
+  decInfo->fptr_decode = NULL;
+  decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb");
+  if (decInfo->fptr_stego_image == NULL)
+  {
+    log_error(e_err_io, "unable to open file %s: %s", decInfo->stego_image_fname, strerror(errno));
+    return e_failure;
+  }
+
+  Status status = e_failure;
+  if (decode_stego_header(decInfo) == e_success)
+  {
+    uint expected = decInfo->has_expected_digest ? decInfo->expected_digest : decInfo->digest_secret_file;
+    if (!decInfo->has_expected_digest && !(decInfo->format_flags & STEGO_FLAG_DIGEST))
+    {
+      log_error(e_err_digest, "image carries no digest, pass one with --verify=<crc32c>");
+    }
+    else
+    {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      if (decode_secret_file_data(decInfo) == e_success)
+      {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        uint64 image_bytes = embed_image_bytes(decInfo->embed_mode, decInfo->embed_param, decInfo->size_secret_file);
+        printf("verify %s: crc32c %08x, expected %08x, %llu bytes in %.3f ms (%.1f MB/s)\n",
+               decInfo->digest_decoded == expected ? "PASS" : "FAIL",
+               decInfo->digest_decoded, expected, decInfo->size_secret_file,
+               elapsed * 1e3, elapsed > 0 ? image_bytes / elapsed / 1e6 : 0);
+        if (decInfo->digest_decoded == expected)
+          status = e_success;
+      }
+    }
+  }
+  fclose(decInfo->fptr_stego_image);
+  decInfo->fptr_stego_image = NULL;
+  return status;
+}
+
+/* 
+ * Function: decode_stego_buffer
+ * -----------------------------
+ * Decodes a stego image that is already in memory, for callers
+ * that receive images as buffers and for fuzzing. decInfo
+ * supplies the magic string (required, nothing is prompted),
+ * the job arena and an optional fptr_decode for the secret;
+ * without one only the digest is checked. Every field is
+ * checked against image_size, so a damaged image is rejected
+ * after at most image_size bytes of work.
+ */
+Status decode_stego_buffer(const unsigned char *image, size_t image_size, DecodeInfo *decInfo)
+{
+  if (image_size == 0 || decInfo->magic_string == NULL)
+    return e_failure;
+  decInfo->fptr_stego_image = fmemopen((void *)image, image_size, "rb");
+  if (decInfo->fptr_stego_image == NULL)
+  {
+    log_error(e_err_io, "fmemopen: %s", strerror(errno));
+    return e_failure;
+  }
+
+  Status status = e_failure;
+  if (decode_stego_header(decInfo) == e_success && decode_secret_file_data(decInfo) == e_success)
+    status = e_success;
+  fclose(decInfo->fptr_stego_image);
+  decInfo->fptr_stego_image = NULL;
+  return status;
+}
@@ -2,6 +2,9 @@
 #define DECODE_H
 
 #include "types.h" // Contains user defined types
+#include "arena.h" // Per-job allocator
+#include "kernel.h" // Embed kernels
+#include "common.h" // Stego header layout
 
 /* 
  * Structure to store information required for
@@ -14,12 +17,50 @@
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
 #define MAX_FILE_SUFFIX 4
 
+/* BMP header plus the longest stego header, 1 bit per byte: one pread */
+#define DECODE_PROBE_SIZE (54 + (MAX_STEGO_HEADER_BYTES + STEGO_STRIDE_FIELD_BYTES) * 8)
+
+/* Names tried for the output's temporary file without O_TMPFILE */
+#define DECODE_TMP_ATTEMPTS 100
+
+/* Who made fptr_decode, and so how it is published or discarded */
+typedef enum
+{
+    e_output_caller,   // opened by the caller (daemon), closed as is
+    e_output_tmpfile,  // unnamed O_TMPFILE, linked as decode_fname on success
+    e_output_named     // decode_tmp_fname next to decode_fname, renamed over it on success
+} DecodeOutput;
+
 typedef struct _DecodeInfo
 {
 
     /* Secret File Info */
-    char extn_secret_file[MAX_FILE_SUFFIX];
-    int size_secret_file;
+    char extn_secret_file[MAX_FILE_SUFFIX + 1];
+    uint64 size_secret_file;
+
+    /* Magic string, NULL to prompt for it */
+    const char *magic_string;
+
+    /* Embedding mode of the secret data and its kernel, from the format word */
+    EmbedMode embed_mode;
+    uint embed_param;
+    const EmbedKernel *kernel;
+    uint format_flags;
+
+    /* Stride of spread secret data, 0 when it is packed */
+    uint spread_stride;
+
+    /* Image bytes between the header and the secret data, see embed_data_pad */
+    uint data_pad;
+
+    /* CRC-32C embedded with the secret and the one computed while decoding */
+    uint digest_secret_file;
+    uint digest_decoded;
+
+    /* --verify: check the digest without writing an output file */
+    int verify;
+    int has_expected_digest;
+    uint expected_digest;
 
     /* Stego Image Info */
     char *stego_image_fname;
@@ -28,10 +69,24 @@ typedef struct _DecodeInfo
     /*Image Data Buffer*/
     char Image_data[MAX_IMAGE_BUF_SIZE];
 
+    /* Start of the image read with one pread; header fields come from
+       here until the secret data, NULL when they are read from the stream */
+    unsigned char *probe;
+    uint probe_len;
+    uint probe_pos;
+    uint64 image_file_size;
+
     /* decoded file Info */
     char *decode_fname;
+    char *decode_tmp_fname;
     FILE *fptr_decode;
-     
+    DecodeOutput decode_output;
+
+    /* Job scratch memory, reset between jobs */
+    Arena arena;
+    unsigned char *image_chunk;
+    unsigned char *secret_chunk;
+    unsigned char *spread_window;
 
 } DecodeInfo;
 
@@ -62,9 +117,36 @@ Status decode_secret_file_extn(DecodeInfo *DecInfo);
 /* Decode secret file size */
 Status decode_secret_file_size(DecodeInfo *DecInfo);
 
+/* Decode CRC-32C of the secret file, if the image carries one */
+Status decode_secret_file_digest(DecodeInfo *DecInfo);
+
+/* Decode the stride of spread secret data, if the image carries one */
+Status decode_secret_file_stride(DecodeInfo *DecInfo);
+
 /* Decode secret file data*/
 Status decode_secret_file_data(DecodeInfo *DecInfo);
 
+/* Read the header with one pread and check the magic string, no logging */
+Status decode_probe_header(DecodeInfo *decInfo);
+
+/* Create the output file once the header is valid */
+Status decode_open_output(DecodeInfo *decInfo);
+
+/* Publish the output file under decode_fname and close it */
+Status decode_commit_output(DecodeInfo *decInfo);
+
+/* Close the output file without publishing it */
+void decode_discard_output(DecodeInfo *decInfo);
+
+/* Decode everything up to the secret data */
+Status decode_stego_header(DecodeInfo *decInfo);
+
+/* Stream the secret through CRC-32C and compare, no output file */
+Status do_verify(DecodeInfo *decInfo);
+
+/* Decode a stego image held in memory, the secret goes to fptr_decode if set */
+Status decode_stego_buffer(const unsigned char *image, size_t image_size, DecodeInfo *decInfo);
+
 /* Decode a byte into LSB of image data array */
 char decode_byte_from_lsb(char *image_buffer);
 
@@ -1,32 +1,40 @@
+#define _GNU_SOURCE // SEEK_DATA, SEEK_HOLE
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "encode.h"
 #include "types.h"
 #include "common.h"
+#include "kernel.h"
+#include "crc32c.h"
+#include "bmp.h"
+#include "log.h"
 /* Function Definitions */
 
+// file offsets go through fseeko/ftello, build with -D_FILE_OFFSET_BITS=64 on 32-bit hosts
+_Static_assert(sizeof(off_t) == 8, "off_t must be 64-bit for covers and secrets over 2 GB");
+
 /* Get image size
  * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * Output: width * height * bytes per pixel, 0 if the file does
+ * not start with a BMP header
+ * Description: Reads the 54 byte header and parses it with
+ * parse_bmp_header, which takes the magnitude of the signed
+ * height of top-down bitmaps
  */
-uint get_image_size_for_bmp(FILE *fptr_image)
+uint64 get_image_size_for_bmp(FILE *fptr_image)
 {
-  uint width, height;
-  // Seek to 18th byte
-  fseek(fptr_image, 18, SEEK_SET);
-
-  // Read the width (an int)
-  fread(&width, sizeof(int), 1, fptr_image);
-  printf("width = %u\n", width);
-
-  // Read the height (an int)
-  fread(&height, sizeof(int), 1, fptr_image);
-  printf("height = %u\n", height);
-
-  // Return image capacity
-  return width * height * 3;
+  unsigned char header[BMP_HEADER_SIZE];
+  BmpInfo info;
+  if (fseeko(fptr_image, 0, SEEK_SET) != 0 || fread(header, sizeof(char), sizeof(header), fptr_image) != sizeof(header) ||
+      parse_bmp_header(header, &info) != e_success)
+    return 0;
+  log_debug("width = %u", info.width);
+  log_debug("height = %u", info.height);
+  return info.image_size;
 }
 
 /*
@@ -38,13 +46,16 @@ uint get_image_size_for_bmp(FILE *fptr_image)
  */
 Status open_files(EncodeInfo *encInfo)
 {
+  // streams the caller already opened (daemon jobs) are used as is
+  if (encInfo->fptr_src_image && encInfo->fptr_secret && encInfo->fptr_stego_image)
+    return e_success;
+
   // Src Image file
   encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
   // Do Error handling
   if (encInfo->fptr_src_image == NULL)
   {
-    perror("fopen");
-    fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->src_image_fname);
+    log_error(e_err_io, "Unable to open file %s: %s", encInfo->src_image_fname, strerror(errno));
 
     return e_failure;
   }
@@ -54,8 +65,7 @@ Status open_files(EncodeInfo *encInfo)
   // Do Error handling
   if (encInfo->fptr_secret == NULL)
   {
-    perror("fopen");
-    fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+    log_error(e_err_io, "Unable to open file %s: %s", encInfo->secret_fname, strerror(errno));
 
     return e_failure;
   }
@@ -65,8 +75,7 @@ Status open_files(EncodeInfo *encInfo)
   // Do Error handling
   if (encInfo->fptr_stego_image == NULL)
   {
-    perror("fopen");
-    fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
+    log_error(e_err_io, "Unable to open file %s: %s", encInfo->stego_image_fname, strerror(errno));
 
     return e_failure;
   }
@@ -90,6 +99,24 @@ OperationType check_operation_type(char *argv[])
     return e_encode;
   else if (strcmp(argv[1], "-d") == 0)
     return e_decode;
+  else if (strcmp(argv[1], "-i") == 0)
+    return e_index;
+  else if (strcmp(argv[1], "-q") == 0)
+    return e_query;
+  else if (strcmp(argv[1], "-b") == 0)
+    return e_bench;
+  else if (strcmp(argv[1], "-m") == 0)
+    return e_bundle;
+  else if (strcmp(argv[1], "-l") == 0)
+    return e_list;
+  else if (strcmp(argv[1], "-x") == 0)
+    return e_extract;
+  else if (strcmp(argv[1], "-a") == 0)
+    return e_append;
+  else if (strcmp(argv[1], "-D") == 0)
+    return e_daemon;
+  else if (strcmp(argv[1], "-c") == 0)
+    return e_client;
   else
     return e_unsupported;
 }
@@ -143,7 +170,8 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 
   if (argv[4])
   {
-    if (strcmp(strstr(argv[4], "."), ".bmp") == 0)
+    char *dot4 = strstr(argv[4], ".");
+    if (dot4 != NULL && strcmp(dot4, ".bmp") == 0)
       encInfo->stego_image_fname = argv[4];
     else
       encInfo->stego_image_fname = "stego.bmp";
@@ -166,30 +194,123 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
  */
 Status check_capacity(EncodeInfo *encInfo)
 {
-  // get_image_size_for_bmp
-  encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-  printf("beautiful.bmp Image file size = %u\n", encInfo->image_capacity);
+  // pixel embedding picks its kernel from the cover's pixel format
+  if (encInfo->embed_mode == e_embed_pixel && check_pixel_format(encInfo) != e_success)
+    return e_failure;
+  // the job's kernels, looked up once for every chunk
+  encInfo->kernel = embed_kernel_select(encInfo->embed_mode, encInfo->embed_param);
+  encInfo->header_kernel = embed_kernel_select(embed_header_mode(encInfo->embed_mode), 0);
+  if (encInfo->kernel == NULL)
+  {
+    log_error(e_err_args, "no kernel for embedding mode %u with parameter %u", encInfo->embed_mode, encInfo->embed_param);
+    return e_failure;
+  }
+  // get_image_size_for_bmp, unless the cover cache already parsed the header
+  if (encInfo->image_capacity == 0)
+    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
+  if (encInfo->image_capacity == 0)
+  {
+    log_error(e_err_format, "%s is not a BMP image", encInfo->src_image_fname);
+    return e_failure;
+  }
+  log_info("%s image data size = %llu", encInfo->src_image_fname, encInfo->image_capacity);
   // get_image_size_for_.txt
   encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
-  printf("secret.txt Image file size = %u\n", encInfo->size_secret_file);
-  // header,magic_string_len,file_extension,file_extension_size,
-  // size_of_file,actual_secret_file_size,multiple of 8(1byte of secret data needed 8bytes of image data)
-  int total_bytes_encode = (54 + (strlen(MAGIC_STRING) + MAX_FILE_SUFFIX + sizeof(int) + sizeof(int) + encInfo->size_secret_file) * 8);
-  if (encInfo->image_capacity > total_bytes_encode)
+  log_info("%s file size = %llu", encInfo->secret_fname, encInfo->size_secret_file);
+  // header (longest magic string, extn size, extn, file size) plus secret data
+  // in the chosen embedding mode must fit the image data; spreading adds the stride field
+  uint64 image_size = encInfo->image_capacity;
+  if (encInfo->spread)
+    image_size = image_size > STEGO_STRIDE_FIELD_BYTES * 8 ? image_size - STEGO_STRIDE_FIELD_BYTES * 8 : 0;
+  if (encInfo->size_secret_file <= get_payload_capacity(image_size, encInfo->embed_mode, encInfo->embed_param))
     return e_success;
   else
     return e_failure;
 }
 
+/*
+ * Function: check_pixel_format
+ * ----------------------------
+ * Pixel embedding needs an uncompressed 24 or 32-bit cover
+ * whose pixels start right after the 54 byte header, so that
+ * embed_data_pad can put the secret data on a pixel boundary.
+ * Completes embed_param with the cover's bytes per pixel.
+ *
+ * Returns: e_success if a specialized kernel exists for the cover
+ */
+Status check_pixel_format(EncodeInfo *encInfo)
+{
+  unsigned char header[BMP_HEADER_SIZE];
+  BmpInfo info;
+  rewind(encInfo->fptr_src_image);
+  if (fread(header, sizeof(char), sizeof(header), encInfo->fptr_src_image) != sizeof(header) ||
+      parse_bmp_header(header, &info) != e_success)
+  {
+    log_error(e_err_format, "%s is not a BMP image", encInfo->src_image_fname);
+    return e_failure;
+  }
+  if ((info.bits_per_pixel != 24 && info.bits_per_pixel != 32) || info.compression != 0 || info.data_offset != BMP_HEADER_SIZE)
+  {
+    log_error(e_err_format, "pixel mode needs an uncompressed 24 or 32-bit BMP, %s is %u-bit", encInfo->src_image_fname, info.bits_per_pixel);
+    return e_failure;
+  }
+  encInfo->bits_per_pixel = info.bits_per_pixel;
+  encInfo->embed_param = PIXEL_PARAM_SET_BPP(encInfo->embed_param, info.bits_per_pixel / 8);
+  if (embed_kernel_select(e_embed_pixel, encInfo->embed_param) == NULL)
+  {
+    log_error(e_err_format, "no pixel kernel for %u bits per channel, channel mask %u", PIXEL_PARAM_BITS(encInfo->embed_param),
+              PIXEL_PARAM_SKIP(encInfo->embed_param));
+    return e_failure;
+  }
+  encInfo->image_capacity = info.image_size;
+  return e_success;
+}
+
+/*
+ * Function: get_payload_capacity
+ * ------------------------------
+ * Largest secret file, in bytes, that fits into image_size bytes
+ * of pixel data with the given embedding mode (param is the
+ * matrix code rate), assuming the longest magic string.
+ *
+ * Returns: capacity in bytes, 0 if even the header does not fit
+ */
+uint64 get_payload_capacity(uint64 image_size, EmbedMode mode, uint param)
+{
+  uint header_bits = MAX_STEGO_HEADER_BYTES * 8;
+  if (image_size <= header_bits)
+    return 0;
+  switch (mode)
+  {
+    case e_embed_lsb:
+    case e_embed_lsb_match:
+      // 1 bit per image byte
+      return (image_size - header_bits) / 8;
+    case e_embed_matrix:
+      // param bits per block of 2^param - 1 image bytes
+      return (image_size - header_bits) / ((1u << param) - 1) * param / 8;
+    case e_embed_pixel:
+      // 3 payload bytes per 24 / (k * channels) pixels, unknown pixel formats carry nothing;
+      // the data starts on the pixel after the header, up to bytes per pixel - 1 later
+      if (embed_kernel_select(mode, param) == NULL || image_size - header_bits < PIXEL_PARAM_BPP(param))
+        return 0;
+      return (image_size - header_bits - (PIXEL_PARAM_BPP(param) - 1)) / pixel_group_bytes(param) * 3;
+    default:
+      return 0;
+  }
+}
+
 /*
  * Function: get_file_size
  * ------------------------
- * Returns size of the given file
+ * Returns size of the given file, 64-bit so secrets over
+ * 4 GB are not truncated
  */
-uint get_file_size(FILE *fptr)
+uint64 get_file_size(FILE *fptr)
 {
-  fseek(fptr, 0, SEEK_END);
-  return ftell(fptr);
+  fseeko(fptr, 0, SEEK_END);
+  off_t size = ftello(fptr);
+  return size < 0 ? 0 : (uint64)size;
 }
 
 /*
@@ -201,8 +322,8 @@ Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
 {
   rewind(fptr_src_image);
   char header[54];
-  fread(header, sizeof(char), 54, fptr_src_image);
-  fwrite(header, sizeof(char), 54, fptr_dest_image);
+  if (fread(header, sizeof(char), 54, fptr_src_image) != 54 || fwrite(header, sizeof(char), 54, fptr_dest_image) != 54)
+    return e_failure;
   return e_success;
 }
 
@@ -214,26 +335,209 @@ Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
   // string data is converted to image
-  encode_data_to_image((char *)magic_string, strlen(magic_string), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
-  return e_success;
+  return encode_data_to_image((char *)magic_string, strlen(magic_string), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
 }
 
 /*
  * Function: encode_data_to_image
  * ------------------------------
- * Encodes a data buffer into the image using LSB steganography.
+ * Encodes a data buffer into the image using the job's
+ * embedding mode. Works through the data in chunks of
+ * STEGO_CHUNK_SIZE bytes so the kernel sees whole buffers.
+ */
+Status encode_data_to_image(char *data, size_t size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo)
+{
+  // header fields stay 1 bit per byte so the decoder can read the format word
+  return encode_mode_data_to_image(data, size, embed_header_mode(encInfo->embed_mode), encInfo->header_kernel, fptr_src_image,
+                                   fptr_stego_image, encInfo);
+}
+
+/*
+ * Function: encode_mode_data_to_image
+ * -----------------------------------
+ * Encodes a data buffer with the given embedding mode and its
+ * kernel, in chunks of embed_chunk_size bytes so the kernel
+ * sees whole buffers and matrix blocks never straddle two
+ * chunks.
+ */
+Status encode_mode_data_to_image(char *data, size_t size, EmbedMode mode, const EmbedKernel *kernel, FILE *fptr_src_image,
+                                 FILE *fptr_stego_image, EncodeInfo *encInfo)
+{
+  // chunk buffer comes from the job arena on first use
+  if (encInfo->image_chunk == NULL)
+  {
+    encInfo->image_chunk = arena_alloc(&encInfo->arena, STEGO_CHUNK_SIZE * 8);
+    if (encInfo->image_chunk == NULL)
+    {
+      log_error(e_err_memory, "Memory alocation failed");
+      return e_failure;
+    }
+  }
+  uint chunk_size = embed_chunk_size(mode, encInfo->embed_param);
+  for (size_t done = 0; done < size; )
+  {
+    uint count = size - done < chunk_size ? (uint)(size - done) : chunk_size;
+    uint image_bytes = embed_image_bytes(mode, encInfo->embed_param, count);
+    // read the image bytes that will carry this chunk
+    if (fread(encInfo->image_chunk, sizeof(char), image_bytes, fptr_src_image) != image_bytes)
+      return e_failure;
+    // change lsb bits of the chunk
+    kernel->embed((unsigned char *)data + done, count, encInfo->image_chunk, &encInfo->keystream);
+    // write the chunk to stego.bmp
+    if (fwrite(encInfo->image_chunk, sizeof(char), image_bytes, fptr_stego_image) != image_bytes)
+    {
+      log_error(e_err_io, "Unable to write %s: %s", encInfo->stego_image_fname, strerror(errno));
+      return e_failure;
+    }
+    done += count;
+  }
+  return e_success;
+}
+
+/*
+ * Function: copy_image_bytes
+ * --------------------------
+ * Copies size bytes from the source to the stego image through
+ * buffer, for the gaps between widely spread carrier units and
+ * the pixel data after the secret. Long copies from a regular
+ * file skip its holes (SEEK_DATA / SEEK_HOLE): the stego image
+ * seeks over them too, so a sparse multi-GB cover gives a
+ * sparse stego image and only its data is read. A stego stream
+ * that cannot seek gets the zeros written out.
+ */
+static Status copy_image_bytes(FILE *fptr_src, FILE *fptr_dest, uint64 size, unsigned char *buffer, size_t buffer_size)
+{
+  struct stat st;
+  int fd = fileno(fptr_src);
+  int sparse = size >= STEGO_SPREAD_WINDOW && fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  int ends_in_hole = 0;
+  while (size > 0)
+  {
+    uint64 run = size;
+    off_t pos = ftello(fptr_src);
+    if (sparse && pos >= 0 && pos < st.st_size)
+    {
+      // a hole runs to the next data, or to the end of the file
+      off_t data = lseek(fd, pos, SEEK_DATA);
+      if (data < 0 && errno == ENXIO)
+        data = st.st_size;
+      if (data > pos)
+      {
+        uint64 hole = (uint64)(data - pos) < size ? (uint64)(data - pos) : size;
+        if (fseeko(fptr_src, pos + (off_t)hole, SEEK_SET) != 0)
+          return e_failure;
+        if (fseeko(fptr_dest, (off_t)hole, SEEK_CUR) != 0)
+        {
+          // not seekable: write the hole out
+          memset(buffer, 0, buffer_size);
+          for (uint64 left = hole; left > 0; )
+          {
+            size_t count = left < buffer_size ? (size_t)left : buffer_size;
+            if (fwrite(buffer, sizeof(char), count, fptr_dest) != count)
+              return e_failure;
+            left -= count;
+          }
+        }
+        else
+        {
+          ends_in_hole = 1;
+        }
+        size -= hole;
+        continue;
+      }
+      off_t hole = data == pos ? lseek(fd, pos, SEEK_HOLE) : -1;
+      if (hole > pos && (uint64)(hole - pos) < size)
+        run = hole - pos;
+      // the lseeks moved the descriptor under the stream
+      if (fseeko(fptr_src, pos, SEEK_SET) != 0)
+        return e_failure;
+    }
+    size -= run;
+    ends_in_hole = 0;
+    while (run > 0)
+    {
+      size_t count = run < buffer_size ? (size_t)run : buffer_size;
+      if (fread(buffer, sizeof(char), count, fptr_src) != count || fwrite(buffer, sizeof(char), count, fptr_dest) != count)
+        return e_failure;
+      run -= count;
+    }
+  }
+  // a hole at the end only exists once the file is that long
+  if (ends_in_hole)
+  {
+    off_t end = ftello(fptr_dest);
+    if (fflush(fptr_dest) != 0 || fstat(fileno(fptr_dest), &st) != 0 ||
+        (st.st_size < end && ftruncate(fileno(fptr_dest), end) != 0))
+      return e_failure;
+  }
+  return e_success;
+}
+
+/*
+ * Function: encode_spread_data_to_image
+ * -------------------------------------
+ * Encodes a data buffer with the job's embedding mode, its
+ * carrier units spread_stride units apart. A chunk whose span
+ * fits STEGO_SPREAD_WINDOW is read in one piece, gathered,
+ * embedded, scattered back and written. Wider spans (tiny
+ * secrets in big covers) are gathered unit by unit with
+ * fseeko and the gaps copied through.
  */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo)
+Status encode_spread_data_to_image(char *data, size_t size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo)
 {
-  // fetch 8 bytes of beautiful.bmp untill the size
-  for (int i = 0; i < size; i++)
+  EmbedMode mode = encInfo->embed_mode;
+  uint param = encInfo->embed_param;
+  uint stride = encInfo->spread_stride;
+  uint unit = embed_unit_size(mode, param);
+  if (encInfo->image_chunk == NULL)
+    encInfo->image_chunk = arena_alloc(&encInfo->arena, STEGO_CHUNK_SIZE * 8);
+  if (encInfo->spread_window == NULL)
+    encInfo->spread_window = arena_alloc(&encInfo->arena, STEGO_SPREAD_WINDOW);
+  if (encInfo->image_chunk == NULL || encInfo->spread_window == NULL)
   {
-    // read 8byte data from beautiful.bmp
-    fread(encInfo->image_data, sizeof(char), 8, fptr_src_image);
-    // encode lsb bytes(change lsb bits in bytes)
-    encode_byte_to_lsb(data[i], encInfo->image_data);
-    // write 8byte data to stego.bmp
-    fwrite(encInfo->image_data, sizeof(char), 8, fptr_stego_image);
+    log_error(e_err_memory, "Memory alocation failed");
+    return e_failure;
+  }
+  uint chunk_size = embed_spread_chunk_size(mode, param, stride);
+  uint64 step = (uint64)stride * unit;
+  for (size_t done = 0; done < size; )
+  {
+    uint count = size - done < chunk_size ? (uint)(size - done) : chunk_size;
+    uint n_units = (embed_image_bytes(mode, param, count) + unit - 1) / unit;
+    uint64 span = n_units * step;
+    if (span <= STEGO_SPREAD_WINDOW)
+    {
+      if (fread(encInfo->spread_window, sizeof(char), span, fptr_src_image) != span)
+        return e_failure;
+      gather_strided(encInfo->spread_window, n_units, unit, stride, encInfo->image_chunk);
+      encInfo->kernel->embed((unsigned char *)data + done, count, encInfo->image_chunk, &encInfo->keystream);
+      scatter_strided(encInfo->image_chunk, n_units, unit, stride, encInfo->spread_window);
+      if (fwrite(encInfo->spread_window, sizeof(char), span, fptr_stego_image) != span)
+      {
+        log_error(e_err_io, "Unable to write %s: %s", encInfo->stego_image_fname, strerror(errno));
+        return e_failure;
+      }
+    }
+    else
+    {
+      off_t base = ftello(fptr_src_image);
+      for (uint i = 0; i < n_units; i++)
+      {
+        if (fseeko(fptr_src_image, base + (off_t)(i * step), SEEK_SET) != 0 ||
+            fread(encInfo->image_chunk + i * unit, sizeof(char), unit, fptr_src_image) != unit)
+          return e_failure;
+      }
+      encInfo->kernel->embed((unsigned char *)data + done, count, encInfo->image_chunk, &encInfo->keystream);
+      // the stego image is written in order: a unit, then the gap after it
+      for (uint i = 0; i < n_units; i++)
+      {
+        if (fwrite(encInfo->image_chunk + i * unit, sizeof(char), unit, fptr_stego_image) != unit ||
+            fseeko(fptr_src_image, base + (off_t)(i * step + unit), SEEK_SET) != 0 ||
+            copy_image_bytes(fptr_src_image, fptr_stego_image, step - unit, encInfo->spread_window, STEGO_SPREAD_WINDOW) != e_success)
+          return e_failure;
+      }
+    }
+    done += count;
   }
   return e_success;
 }
@@ -268,18 +572,8 @@ Status encode_byte_to_lsb(char data, char *image_buffer)
  */
 Status encode_secret_file_extn_size(int file_size1, EncodeInfo *encInfo)
 {
-  char *data = (char *)&file_size1;
-  // file_size 4byte,read 32 bytes from beautiful.bmp
-  for (int i = 0; i < 4; i++)
-  {
-    // read 8byte data from beautiful.bmp
-    fread(encInfo->image_data, sizeof(char), 8, encInfo->fptr_src_image);
-    // encode lsb bytes
-    encode_byte_to_lsb(data[i], encInfo->image_data);
-    // write 8byte data to stego.bmp
-    fwrite(encInfo->image_data, sizeof(char), 8, encInfo->fptr_stego_image);
-  }
-  return e_success;
+  // int is 4 bytes, stored little endian
+  return encode_data_to_image((char *)&file_size1, sizeof(int), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
 }
 
 /*
@@ -290,29 +584,83 @@ Status encode_secret_file_extn_size(int file_size1, EncodeInfo *encInfo)
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
   // string data is converted to image
-  encode_data_to_image((char *)file_extn, strlen(file_extn), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
-  return e_success;
+  return encode_data_to_image((char *)file_extn, strlen(file_extn), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
 }
 
 /*
  * Function: encode_secret_file_size
  * ---------------------------------
- * Encodes the size of the secret file into the image.
+ * Encodes the size of the secret file into the image, little
+ * endian: 4 bytes, or 8 for secrets over STEGO_MAX_SIZE32
+ * (the format word then carries STEGO_FLAG_SIZE64).
+ */
+Status encode_secret_file_size(uint64 file_size, EncodeInfo *encInfo)
+{
+  char field[8];
+  int field_size = file_size > STEGO_MAX_SIZE32 ? 8 : 4;
+  for (int i = 0; i < field_size; i++)
+    field[i] = (char)(file_size >> (i * 8));
+  return encode_data_to_image(field, field_size, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+}
+
+/*
+ * Function: encode_secret_file_digest
+ * -----------------------------------
+ * Computes the CRC-32C of the secret file and encodes it
+ * after the file size, so the image can be verified without
+ * writing the secret out.
  */
-Status encode_secret_file_size(int file_size, EncodeInfo *encInfo)
+Status encode_secret_file_digest(EncodeInfo *encInfo)
 {
-  char *data = (char *)&file_size;
-  // file_size 4byte,read 32 bytes from beautiful.bmp
-  for (int i = 0; i < 4; i++)
+  if (encInfo->secret_chunk == NULL)
   {
-    // read 8byte data from beautiful.bmp
-    fread(encInfo->image_data, sizeof(char), 8, encInfo->fptr_src_image);
-    // encode lsb bytes
-    encode_byte_to_lsb(data[i], encInfo->image_data);
-    // write 8byte data to stego.bmp
-    fwrite(encInfo->image_data, sizeof(char), 8, encInfo->fptr_stego_image);
+    encInfo->secret_chunk = arena_alloc(&encInfo->arena, STEGO_CHUNK_SIZE);
+    if (encInfo->secret_chunk == NULL)
+    {
+      log_error(e_err_memory, "Memory alocation failed");
+      return e_failure;
+    }
   }
-  return e_success;
+  uint crc = CRC32C_INIT;
+  fseeko(encInfo->fptr_secret, 0, SEEK_SET);
+  for (uint64 done = 0; done < encInfo->size_secret_file; )
+  {
+    uint count = STEGO_CHUNK_SIZE;
+    if (encInfo->size_secret_file - done < count)
+      count = (uint)(encInfo->size_secret_file - done);
+    if (fread(encInfo->secret_chunk, sizeof(char), count, encInfo->fptr_secret) != count)
+      return e_failure;
+    crc = crc32c_update(crc, encInfo->secret_chunk, count);
+    done += count;
+  }
+  encInfo->digest_secret_file = crc32c_final(crc);
+  return encode_data_to_image((char *)&encInfo->digest_secret_file, sizeof(uint), encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
+}
+
+/*
+ * Function: encode_secret_file_stride
+ * -----------------------------------
+ * With --spread, picks the largest stride at which the secret
+ * data still fits between the end of this field and the end of
+ * the pixel data, and encodes it as 4 bytes little endian.
+ */
+Status encode_secret_file_stride(EncodeInfo *encInfo)
+{
+  encInfo->spread_stride = 0;
+  if (!encInfo->spread)
+    return e_success;
+  uint unit = embed_unit_size(encInfo->embed_mode, encInfo->embed_param);
+  uint64 data_start = (uint64)ftello(encInfo->fptr_src_image) + STEGO_STRIDE_FIELD_BYTES * 8;
+  data_start += embed_data_pad(encInfo->embed_mode, encInfo->embed_param, data_start - BMP_HEADER_SIZE);
+  uint64 image_end = BMP_HEADER_SIZE + encInfo->image_capacity;
+  uint64 needed = (embed_image_bytes(encInfo->embed_mode, encInfo->embed_param, encInfo->size_secret_file) + unit - 1) / unit;
+  uint64 stride = image_end <= data_start ? 0 : needed ? (image_end - data_start) / unit / needed : 1;
+  if (stride == 0)
+    return e_failure;
+  encInfo->spread_stride = stride > 0xffffffffu ? 0xffffffffu : (uint)stride;
+  log_info("spreading the secret data every %u units", encInfo->spread_stride);
+  uint field = encInfo->spread_stride;
+  return encode_data_to_image((char *)&field, STEGO_STRIDE_FIELD_BYTES, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo);
 }
 
 /*
@@ -322,18 +670,43 @@ Status encode_secret_file_size(int file_size, EncodeInfo *encInfo)
  */
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
+  if (encInfo->secret_chunk == NULL)
+  {
+    encInfo->secret_chunk = arena_alloc(&encInfo->arena, STEGO_CHUNK_SIZE);
+    if (encInfo->secret_chunk == NULL)
+    {
+      log_error(e_err_memory, "Memory alocation failed");
+      return e_failure;
+    }
+  }
+  // pixel mode data starts on a whole pixel, the bytes up to it are copied as they are
+  unsigned char pad_bytes[4];
+  uint pad = embed_data_pad(encInfo->embed_mode, encInfo->embed_param, (uint64)ftello(encInfo->fptr_src_image) - BMP_HEADER_SIZE);
+  if (pad && (fread(pad_bytes, sizeof(char), pad, encInfo->fptr_src_image) != pad ||
+              fwrite(pad_bytes, sizeof(char), pad, encInfo->fptr_stego_image) != pad))
+    return e_failure;
+  // whole kernel chunks only, a partial one would pad a matrix block
+  uint chunk_size = encInfo->spread_stride ? embed_spread_chunk_size(encInfo->embed_mode, encInfo->embed_param, encInfo->spread_stride)
+                                           : embed_chunk_size(encInfo->embed_mode, encInfo->embed_param);
   // file pointer to point biggining of the file
-  fseek(encInfo->fptr_secret, 0, SEEK_SET);
-  for (int i = 0; i < encInfo->size_secret_file; i++)
+  fseeko(encInfo->fptr_secret, 0, SEEK_SET);
+  for (uint64 done = 0; done < encInfo->size_secret_file; )
   {
-    // read 8 byte from beautiful.bmp
-    fread(encInfo->image_data, sizeof(char), 8, encInfo->fptr_src_image);
-    // read 1 byte from secret.txt
-    fread(encInfo->secret_data, sizeof(char), 1, encInfo->fptr_secret);
-    // encode lsb bytes
-    encode_byte_to_lsb(encInfo->secret_data[0], encInfo->image_data);
-    // write 8 byte to stego.bmp
-    fwrite(encInfo->image_data, sizeof(char), 8, encInfo->fptr_stego_image);
+    uint count = chunk_size;
+    if (encInfo->size_secret_file - done < count)
+      count = (uint)(encInfo->size_secret_file - done);
+    // read a chunk from secret.txt
+    if (fread(encInfo->secret_chunk, sizeof(char), count, encInfo->fptr_secret) != count)
+      return e_failure;
+    // encode it into the next image bytes with the job's mode
+    if (encInfo->spread_stride)
+    {
+      if (encode_spread_data_to_image(encInfo->secret_chunk, count, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo) != e_success)
+        return e_failure;
+    }
+    else if (encode_mode_data_to_image(encInfo->secret_chunk, count, encInfo->embed_mode, encInfo->kernel, encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo) != e_success)
+      return e_failure;
+    done += count;
   }
   return e_success;
 }
@@ -342,12 +715,21 @@ Status encode_secret_file_data(EncodeInfo *encInfo)
  * Function: copy_remaining_img_data
  * ---------------------------------
  * Copies remaining image bytes from source image to stego image.
+ * A regular file source goes through copy_image_bytes, which
+ * keeps the holes of a sparse cover.
  */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
-  char ch;
-  while (fread(&ch, sizeof(char), 1, fptr_src) > 0)
-    fwrite(&ch, sizeof(char), 1, fptr_dest);
+  unsigned char buffer[STEGO_CHUNK_SIZE];
+  struct stat st;
+  off_t pos = ftello(fptr_src);
+  if (fileno(fptr_src) >= 0 && fstat(fileno(fptr_src), &st) == 0 && S_ISREG(st.st_mode) && pos >= 0 && pos <= st.st_size)
+    return copy_image_bytes(fptr_src, fptr_dest, (uint64)(st.st_size - pos), buffer, sizeof(buffer));
+
+  size_t count;
+  while ((count = fread(buffer, sizeof(char), sizeof(buffer), fptr_src)) > 0)
+    if (fwrite(buffer, sizeof(char), count, fptr_dest) != count)
+      return e_failure;
   return e_success;
 }
 
@@ -360,90 +742,119 @@ Status do_encoding(EncodeInfo *encInfo)
 {
   if (open_files(encInfo) == e_success)
   {
-    printf("opened file successfully\n");
-    printf("Encoding started\n");
+    log_info("opened file successfully");
+    log_info("Encoding started");
     if (check_capacity(encInfo) == e_success)
     {
-      printf("enough capacity to encode data\n");
+      log_info("enough capacity to encode data");
       if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
       {
-        printf("header copied successfully\n");
-        printf("Enter magic string:");
-        scanf("%s",MAGIC_STRING);
-        if (encode_magic_string(MAGIC_STRING, encInfo) == e_success)
+        log_info("header copied successfully");
+        // the daemon hands the magic string in, the CLI asks for it
+        if (encInfo->magic_string == NULL)
+        {
+          log_flush();
+          printf("Enter magic string:");
+          scanf("%19s",MAGIC_STRING);
+          encInfo->magic_string = MAGIC_STRING;
+        }
+        // the magic string doubles as the key for LSB matching
+        keystream_init(&encInfo->keystream, encInfo->magic_string);
+        if (encode_magic_string(encInfo->magic_string, encInfo) == e_success)
         {
-          printf("encode magic string successfully\n");
-          if (encode_secret_file_extn_size(strlen(".txt"), encInfo) == e_success)
+          log_info("encode magic string successfully");
+          // extension length plus the embedding mode of the secret data
+          if (encode_secret_file_extn_size(STEGO_FORMAT_WORD(strlen(".txt"), encInfo->embed_mode, encInfo->embed_param) | STEGO_FLAG_DIGEST | encInfo->format_flags |
+                                           (encInfo->size_secret_file > STEGO_MAX_SIZE32 ? STEGO_FLAG_SIZE64 : 0) |
+                                           (encInfo->spread ? STEGO_FLAG_STRIDE : 0), encInfo) == e_success)
           {
-            printf("encode secret file extension size successfully\n");
+            log_info("encode secret file extension size successfully");
             if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_success)
             {
-              printf("encode secret file extension successfully\n");
-              if (encode_secret_file_size((int)encInfo->size_secret_file, encInfo) == e_success)
+              log_info("encode secret file extension successfully");
+              if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_success)
               {
-                printf("encode secret file size successfully\n");
-                if (encode_secret_file_data(encInfo) == e_success)
+                log_info("encode secret file size successfully");
+                if (encode_secret_file_digest(encInfo) == e_success)
                 {
-                  printf("encoded secret file data successfully\n");
-                  if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+                  log_info("encode secret file digest %08x successfully", encInfo->digest_secret_file);
+                  if (encode_secret_file_stride(encInfo) == e_success)
                   {
-                    printf("copied remaining image data successfully\n");
-                    // free all file pointers
-                    fclose(encInfo->fptr_src_image);
-                    fclose(encInfo->fptr_secret);
-                    fclose(encInfo->fptr_stego_image);
+                    if (encode_secret_file_data(encInfo) == e_success)
+                    {
+                      log_info("encoded secret file data successfully");
+                      if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_success)
+                      {
+                        log_info("copied remaining image data successfully");
+                        // free all file pointers
+                        fclose(encInfo->fptr_src_image);
+                        fclose(encInfo->fptr_secret);
+                        fclose(encInfo->fptr_stego_image);
+                        encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+                      }
+                      else
+                      {
+                        log_failure(e_err_io, "failed to copy remaining image data");
+                        return e_failure;
+                      }
+                    }
+                    else
+                    {
+                      log_failure(e_err_io, "failed to encode secret file data");
+                      return e_failure;
+                    }
                   }
                   else
                   {
-                    fprintf(stderr, "failed to copy remaining image data\n");
+                    log_failure(e_err_io, "failed to encode secret file stride");
                     return e_failure;
                   }
                 }
                 else
                 {
-                  fprintf(stderr, "failed to encode secret file data\n");
+                  log_failure(e_err_io, "failed to encode secret file digest");
                   return e_failure;
                 }
               }
               else
               {
-                fprintf(stderr, "failed to encode secret file size\n");
+                log_failure(e_err_io, "failed to encode secret file size");
                 return e_failure;
               }
             }
             else
             {
-              fprintf(stderr, "failed to encode secret file extension\n");
+              log_failure(e_err_io, "failed to encode secret file extension");
               return e_failure;
             }
           }
           else
           {
-            fprintf(stderr, "failed to encode secret file extension size\n");
+            log_failure(e_err_io, "failed to encode secret file extension size");
             return e_failure;
           }
         }
         else
         {
-          fprintf(stderr, "failed to encode magic string successfully\n");
+          log_failure(e_err_io, "failed to encode magic string");
           return e_failure;
         }
       }
       else
       {
-        fprintf(stderr, "failed to copy header\n");
+        log_failure(e_err_io, "failed to copy header");
         return e_failure;
       }
     }
     else
     {
-      fprintf(stderr, "dont have enough capacity to encode data\n");
+      log_failure(e_err_capacity, "dont have enough capacity to encode data");
       return e_failure;
     }
   }
   else
   {
-    fprintf(stderr, "Error:opening file\n");
+    log_failure(e_err_io, "failed to open files");
     return e_failure;
   }
   return e_success;
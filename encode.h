@@ -2,6 +2,8 @@
 #define ENCODE_H
 
 #include "types.h" // Contains user defined types
+#include "arena.h" // Per-job allocator
+#include "kernel.h" // Embed kernels
 
 /* 
  * Structure to store information required for
@@ -19,22 +21,47 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname;
     FILE *fptr_src_image;
-    uint image_capacity;
+    uint64 image_capacity;
     uint bits_per_pixel;
     char image_data[MAX_IMAGE_BUF_SIZE];
 
     /* Secret File Info */
     char *secret_fname;
     FILE *fptr_secret;
-    char extn_secret_file[MAX_FILE_SUFFIX];
+    char extn_secret_file[MAX_FILE_SUFFIX + 1];
     char secret_data[MAX_SECRET_BUF_SIZE];
-    int size_secret_file;
-   
+    uint64 size_secret_file;
+    uint digest_secret_file;
+
+    /* Extra format word flags for the secret (STEGO_FLAG_CONTAINER) */
+    uint format_flags;
 
     /* Stego Image Info */
     char *stego_image_fname;
     FILE *fptr_stego_image;
 
+    /* Magic string, NULL to prompt for it */
+    const char *magic_string;
+
+    /* Embedding mode, its parameter and key stream; the kernels
+       for the secret data and the header fields are looked up
+       once the cover is checked */
+    EmbedMode embed_mode;
+    uint embed_param;
+    KeyStream keystream;
+    const EmbedKernel *kernel;
+    const EmbedKernel *header_kernel;
+
+    /* --spread, and the stride chosen for the secret data (0 = packed) */
+    int spread;
+    uint spread_stride;
+
+    /* Job scratch memory, reset between jobs */
+    Arena arena;
+    unsigned char *image_chunk;
+    char *secret_chunk;
+    unsigned char *spread_window;
+
 } EncodeInfo;
 
 
@@ -55,11 +82,17 @@ Status open_files(EncodeInfo *encInfo);
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
+/* Validate the cover for pixel embedding */
+Status check_pixel_format(EncodeInfo *encInfo);
+
 /* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+uint64 get_image_size_for_bmp(FILE *fptr_image);
+
+/* Get secret capacity of an image for an embedding mode */
+uint64 get_payload_capacity(uint64 image_size, EmbedMode mode, uint param);
 
 /* Get file size */
-uint get_file_size(FILE *fptr);
+uint64 get_file_size(FILE *fptr);
 
 /* Copy bmp image header */
 Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
@@ -74,13 +107,26 @@ Status encode_secret_file_extn_size(int file_size1, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
-Status encode_secret_file_size(int file_size, EncodeInfo *encInfo);
+Status encode_secret_file_size(uint64 file_size, EncodeInfo *encInfo);
+
+/* Encode CRC-32C of the secret file */
+Status encode_secret_file_digest(EncodeInfo *encInfo);
+
+/* Encode the stride of spread secret data */
+Status encode_secret_file_stride(EncodeInfo *encInfo);
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
 /* Encode function, which does the real encoding */
-Status encode_data_to_image(char *data, int size, FILE *fptr_src_image, FILE *fptr_stego_image,EncodeInfo *encInfo);
+Status encode_data_to_image(char *data, size_t size, FILE *fptr_src_image, FILE *fptr_stego_image,EncodeInfo *encInfo);
+
+/* Encode a data buffer with an explicit embedding mode */
+Status encode_mode_data_to_image(char *data, size_t size, EmbedMode mode, const EmbedKernel *kernel, FILE *fptr_src_image,
+                                 FILE *fptr_stego_image, EncodeInfo *encInfo);
+
+/* Encode a data buffer spread every spread_stride units */
+Status encode_spread_data_to_image(char *data, size_t size, FILE *fptr_src_image, FILE *fptr_stego_image, EncodeInfo *encInfo);
 
 /* Encode a byte into LSB of image data array */
 Status encode_byte_to_lsb(char data, char *image_buffer);
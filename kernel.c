@@ -0,0 +1,943 @@
+#include <stdio.h>
+#include <string.h>
+#include "kernel.h"
+#include "common.h"
+#include "types.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+/*
+ * Function: keystream_init
+ * ------------------------
+ * Seeds the key stream with an FNV-1a hash of the key, so
+ * the same magic string always produces the same choices.
+ */
+void keystream_init(KeyStream *ks, const char *key)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+  while (*key)
+  {
+    hash ^= (unsigned char)*key++;
+    hash *= 0x100000001b3ULL;
+  }
+  ks->state = hash;
+}
+
+/*
+ * Function: keystream_next
+ * ------------------------
+ * splitmix64 step, returns 64 pseudo random bits
+ */
+unsigned long long keystream_next(KeyStream *ks)
+{
+  unsigned long long z = (ks->state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/*
+ * Function: keystream_skip
+ * ------------------------
+ * Moves the key stream n words ahead in constant time: each
+ * splitmix64 step only adds the same constant to the state
+ */
+void keystream_skip(KeyStream *ks, uint64 n)
+{
+  ks->state += n * 0x9e3779b97f4a7c15ULL;
+}
+
+#ifdef __SSE2__
+/* Bit of the payload byte that lands in each of 16 image bytes */
+static const unsigned char bit_select[16] = {
+  0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+  0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+};
+
+/*
+ * Function: spread_bits
+ * ---------------------
+ * Turns two bytes into 16 byte masks, 0xFF where the bit
+ * for that image byte is set: b0 bit 7 first, b1 bit 0 last.
+ * With SSSE3 one pshufb does the broadcast.
+ */
+static inline __m128i spread_bits(uint b0, uint b1, __m128i select)
+{
+  __m128i v = _mm_cvtsi32_si128((int)(b0 | (b1 << 8)));
+#ifdef __SSSE3__
+  v = _mm_shuffle_epi8(v, _mm_set_epi8(1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0));
+#else
+  v = _mm_unpacklo_epi8(v, v);
+  v = _mm_unpacklo_epi16(v, v);
+  v = _mm_unpacklo_epi32(v, v);
+#endif
+  return _mm_cmpeq_epi8(_mm_and_si128(v, select), select);
+}
+#endif
+
+/*
+ * Function: embed_lsb_replace
+ * ---------------------------
+ * Clears bit 0 of each image byte and ORs in the payload bit.
+ * Same result as calling encode_byte_to_lsb for every byte.
+ */
+void embed_lsb_replace(const unsigned char *data, uint size, unsigned char *image_buffer)
+{
+  uint i = 0;
+#ifdef __SSE2__
+  const __m128i select = _mm_loadu_si128((const __m128i *)bit_select);
+  const __m128i one = _mm_set1_epi8(1);
+  for (; i + 2 <= size; i += 2)
+  {
+    __m128i bits = spread_bits(data[i], data[i + 1], select);
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(image_buffer + i * 8));
+    pixels = _mm_or_si128(_mm_andnot_si128(one, pixels), _mm_and_si128(bits, one));
+    _mm_storeu_si128((__m128i *)(image_buffer + i * 8), pixels);
+  }
+#endif
+  for (; i < size; i++)
+  {
+    for (int j = 0; j < 8; j++)
+    {
+      unsigned char bit = (data[i] >> (7 - j)) & 1;
+      image_buffer[i * 8 + j] = (image_buffer[i * 8 + j] & ~1) | bit;
+    }
+  }
+}
+
+/*
+ * Function: embed_lsb_match
+ * -------------------------
+ * LSB matching (+/-1 embedding). Where bit 0 already equals
+ * the payload bit the image byte is left alone, otherwise a
+ * key stream bit picks +1 or -1. 0 always goes up and 255
+ * always goes down, so nothing wraps. Bit 0 ends up equal to
+ * the payload bit either way, so decode_byte_from_lsb reads
+ * it back unchanged.
+ *
+ * Two key stream words are drawn per 16 payload bytes (128
+ * image bytes) and form 16 sign bytes; image byte g of the
+ * group uses bit (7 - g / 16) of sign byte g % 16. On the
+ * SSE2 path that is one add and one compare per 16 image
+ * bytes, the sign bit of each byte after shifting left by
+ * g / 16, instead of spreading key bits like payload bits.
+ * The scalar path uses the same layout.
+ */
+void embed_lsb_match(const unsigned char *data, uint size, unsigned char *image_buffer, KeyStream *ks)
+{
+  uint i = 0;
+#ifdef __SSE2__
+  const __m128i select = _mm_loadu_si128((const __m128i *)bit_select);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i full = _mm_set1_epi8(-1);
+  // whole groups of 16 payload bytes, 8 steps of 16 image bytes each
+  for (; i + 16 <= size; i += 16)
+  {
+    unsigned long long lo = keystream_next(ks);
+    unsigned long long hi = keystream_next(ks);
+    __m128i signs = _mm_set_epi64x((long long)hi, (long long)lo);
+    for (uint step = 0; step < 16; step += 2)
+    {
+      unsigned char *pixel_ptr = image_buffer + (i + step) * 8;
+      __m128i bits = spread_bits(data[i + step], data[i + step + 1], select);
+      // adding a byte to itself shifts it left within the byte
+      __m128i up = _mm_cmplt_epi8(signs, zero);
+      signs = _mm_add_epi8(signs, signs);
+      __m128i pixels = _mm_loadu_si128((const __m128i *)pixel_ptr);
+
+      // 0xFF in every byte whose LSB must flip
+      __m128i lsb = _mm_cmpeq_epi8(_mm_and_si128(pixels, one), one);
+      __m128i change = _mm_xor_si128(bits, lsb);
+
+      // saturation: 0 must go up, 255 must go down
+      up = _mm_or_si128(up, _mm_cmpeq_epi8(pixels, zero));
+      up = _mm_andnot_si128(_mm_cmpeq_epi8(pixels, full), up);
+
+      // -1 where going up, +1 where going down, subtracted where changing
+      pixels = _mm_sub_epi8(pixels, _mm_and_si128(change, _mm_or_si128(up, one)));
+      _mm_storeu_si128((__m128i *)pixel_ptr, pixels);
+    }
+  }
+#endif
+  unsigned long long signs[2] = { 0, 0 };
+  for (; i < size; i++)
+  {
+    if ((i & 15) == 0)
+    {
+      signs[0] = keystream_next(ks);
+      signs[1] = keystream_next(ks);
+    }
+    // image bytes g = (i & 15) * 8 + j of the group
+    for (int j = 0; j < 8; j++)
+    {
+      uint g = (i & 15) * 8 + j;
+      uint sign_byte = (signs[(g >> 3) & 1] >> ((g & 7) * 8)) & 0xff;
+      unsigned char *pixel = &image_buffer[i * 8 + j];
+      unsigned char bit = (data[i] >> (7 - j)) & 1;
+      if ((*pixel & 1) == bit)
+        continue;
+      if (*pixel == 0)
+        *pixel = 1;
+      else if (*pixel == 255)
+        *pixel = 254;
+      else if ((sign_byte >> (7 - g / 16)) & 1)
+        *pixel += 1;
+      else
+        *pixel -= 1;
+    }
+  }
+}
+
+/*
+ * Function: pack_lsbs
+ * -------------------
+ * Packs bit 0 of block[0..n-1] into words, block[p] going to
+ * bit p + 1 so that bit index equals the Hamming column index.
+ */
+static void pack_lsbs(const unsigned char *block, uint n, unsigned long long words[4])
+{
+  uint p = 0;
+  words[0] = words[1] = words[2] = words[3] = 0;
+#ifdef __SSE2__
+  for (; p + 16 <= n; p += 16)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(block + p));
+    unsigned long long bits = (uint)_mm_movemask_epi8(_mm_slli_epi16(pixels, 7));
+    uint pos = p + 1;
+    words[pos >> 6] |= bits << (pos & 63);
+    if ((pos & 63) > 48)
+      words[(pos >> 6) + 1] |= bits >> (64 - (pos & 63));
+  }
+  // a partial last group reloads the 16 bytes ending at the block
+  // end and drops the ones already packed
+  if (p < n && n >= 16)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(block + n - 16));
+    unsigned long long bits = (uint)_mm_movemask_epi8(_mm_slli_epi16(pixels, 7)) >> (p - (n - 16));
+    uint pos = p + 1;
+    words[pos >> 6] |= bits << (pos & 63);
+    if ((pos & 63) + (n - p) > 64)
+      words[(pos >> 6) + 1] |= bits >> (64 - (pos & 63));
+    p = n;
+  }
+#endif
+  for (; p < n; p++)
+  {
+    uint pos = p + 1;
+    words[pos >> 6] |= (unsigned long long)(block[p] & 1) << (pos & 63);
+  }
+}
+
+/*
+ * Function: matrix_syndrome
+ * -------------------------
+ * XOR of the (1 based) positions whose LSB is set, computed
+ * without tables: bit j of the syndrome is the parity of the
+ * LSBs at positions with bit j set. For j < 6 that is a fixed
+ * pattern inside every 64 bit word, for j >= 6 it selects
+ * whole words. Blocks of up to 15 bytes (k <= 4) are short
+ * enough to XOR the positions directly.
+ *
+ * syndrome_body is always inlined; the matrix kernels pass a
+ * constant rate, so every loop here is unrolled per rate.
+ */
+static inline __attribute__((always_inline))
+uint syndrome_body(const unsigned char *block, const uint rate)
+{
+  static const unsigned long long column[6] = {
+    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+  };
+  const uint n = (1u << rate) - 1;
+  if (rate <= 4)
+  {
+    uint syndrome = 0;
+    for (uint p = 0; p < n; p++)
+      syndrome ^= (0u - (block[p] & 1u)) & (p + 1);
+    return syndrome;
+  }
+
+  unsigned long long words[4];
+  const uint n_words = (n >> 6) + 1;
+  pack_lsbs(block, n, words);
+
+  uint syndrome = 0;
+  for (uint j = 0; j < rate && j < 6; j++)
+  {
+    uint parity = 0;
+    for (uint w = 0; w < n_words; w++)
+      parity ^= __builtin_popcountll(words[w] & column[j]);
+    syndrome |= (parity & 1) << j;
+  }
+  for (uint j = 6; j < rate; j++)
+  {
+    uint parity = 0;
+    for (uint w = 0; w < n_words; w++)
+      if ((w >> (j - 6)) & 1)
+        parity ^= __builtin_popcountll(words[w]);
+    syndrome |= (parity & 1) << j;
+  }
+  return syndrome;
+}
+
+uint matrix_syndrome(const unsigned char *block, uint rate)
+{
+  return syndrome_body(block, rate);
+}
+
+/*
+ * Function: BitReader / BitWriter
+ * -------------------------------
+ * Payload bit stream, MSB of data[0] first, through a 64 bit
+ * buffer: the reader refills 8 bytes at a time with one
+ * load and the writer stores whole bytes, so a k bit message
+ * costs a shift and a mask instead of k single bit steps.
+ * Bits past the end of the payload read as 0 and are dropped
+ * on write.
+ */
+typedef struct _BitReader
+{
+    const unsigned char *data;
+    uint size;
+    uint pos;
+    unsigned long long bits;
+    uint n_bits;
+} BitReader;
+
+static inline uint bit_reader_take(BitReader *br, uint count)
+{
+  if (br->n_bits < count)
+  {
+    if (br->pos + 8 <= br->size)
+    {
+      unsigned long long word;
+      memcpy(&word, br->data + br->pos, sizeof(word));
+      br->bits |= __builtin_bswap64(word) >> br->n_bits;
+      br->pos += (63 - br->n_bits) >> 3;
+      br->n_bits |= 56;
+    }
+    else
+    {
+      for (; br->n_bits <= 56; br->n_bits += 8, br->pos++)
+        br->bits |= (unsigned long long)(br->pos < br->size ? br->data[br->pos] : 0) << (56 - br->n_bits);
+    }
+  }
+  uint value = (uint)(br->bits >> (64 - count));
+  br->bits <<= count;
+  br->n_bits -= count;
+  return value;
+}
+
+typedef struct _BitWriter
+{
+    unsigned char *data;
+    uint size;
+    uint pos;
+    unsigned long long bits;
+    uint n_bits;
+} BitWriter;
+
+static inline void bit_writer_put(BitWriter *bw, uint count, uint value)
+{
+  bw->bits = (bw->bits << count) | value;
+  bw->n_bits += count;
+  while (bw->n_bits >= 8)
+  {
+    bw->n_bits -= 8;
+    if (bw->pos < bw->size)
+      bw->data[bw->pos] = (unsigned char)(bw->bits >> bw->n_bits);
+    bw->pos++;
+  }
+}
+
+/* Last partial byte, zero padded */
+static inline void bit_writer_flush(BitWriter *bw)
+{
+  if (bw->n_bits && bw->pos < bw->size)
+    bw->data[bw->pos] = (unsigned char)(bw->bits << (8 - bw->n_bits));
+}
+
+/*
+ * Function: embed_matrix
+ * ----------------------
+ * Hamming code matrix embedding. The payload bit stream is cut
+ * into k bit messages m, each owning a block of n = 2^k - 1
+ * image bytes. If the block's syndrome s differs from m, the
+ * byte at position s ^ m is moved by +/-1 (key stream picks
+ * the direction, 0/255 saturate), which flips exactly that
+ * LSB and makes the syndrome equal m. So k bits cost at most
+ * one changed byte instead of k / 2 on average.
+ *
+ * image_buffer must hold embed_image_bytes(e_embed_matrix, k, size) bytes.
+ */
+static inline __attribute__((always_inline))
+void matrix_embed_body(const unsigned char *data, uint size, unsigned char *image_buffer, const uint rate, KeyStream *ks)
+{
+  const uint n = (1u << rate) - 1;
+  uint n_blocks = (size * 8 + rate - 1) / rate;
+  BitReader br = { data, size, 0, 0, 0 };
+  unsigned char *block = image_buffer;
+
+  // one key stream word per 64 blocks, bit b & 63 for block b
+  for (uint b = 0; b < n_blocks; b += 64)
+  {
+    unsigned long long signs = keystream_next(ks);
+    uint end = n_blocks - b < 64 ? n_blocks : b + 64;
+    for (uint c = b; c < end; c++, signs >>= 1, block += n)
+    {
+      uint message = bit_reader_take(&br, rate);
+      uint position = syndrome_body(block, rate) ^ message;
+
+      // branch free: whether a byte changes is as random as the payload,
+      // so a position of 0 rewrites block[0] with its own value
+      unsigned char *pixel = &block[position ? position - 1 : 0];
+      uint value = *pixel;
+      uint up = ((signs & 1) | (value == 0)) & (value != 255);
+      *pixel = (unsigned char)(position ? value + 2 * up - 1 : value);
+    }
+  }
+}
+
+static inline __attribute__((always_inline))
+void matrix_extract_body(const unsigned char *image_buffer, uint size, unsigned char *data, const uint rate)
+{
+  const uint n = (1u << rate) - 1;
+  uint n_blocks = (size * 8 + rate - 1) / rate;
+  BitWriter bw = { data, size, 0, 0, 0 };
+  for (uint b = 0; b < n_blocks; b++)
+    bit_writer_put(&bw, rate, syndrome_body(image_buffer + b * n, rate));
+  bit_writer_flush(&bw);
+}
+
+/* One instance per supported rate, so the rate is a constant in each */
+#define MATRIX_KERNEL(k)                                                                                  \
+  static void embed_matrix_##k(const unsigned char *data, uint size, unsigned char *image, KeyStream *ks) \
+  {                                                                                                       \
+    matrix_embed_body(data, size, image, k, ks);                                                          \
+  }                                                                                                       \
+  static void extract_matrix_##k(const unsigned char *image, uint size, unsigned char *data)              \
+  {                                                                                                       \
+    matrix_extract_body(image, size, data, k);                                                            \
+  }
+
+MATRIX_KERNEL(2)
+MATRIX_KERNEL(3)
+MATRIX_KERNEL(4)
+MATRIX_KERNEL(5)
+MATRIX_KERNEL(6)
+MATRIX_KERNEL(7)
+MATRIX_KERNEL(8)
+
+/* Indexed by rate - MATRIX_MIN_RATE */
+static const EmbedKernel matrix_kernels[MATRIX_MAX_RATE - MATRIX_MIN_RATE + 1] = {
+  { embed_matrix_2, extract_matrix_2 }, { embed_matrix_3, extract_matrix_3 }, { embed_matrix_4, extract_matrix_4 },
+  { embed_matrix_5, extract_matrix_5 }, { embed_matrix_6, extract_matrix_6 }, { embed_matrix_7, extract_matrix_7 },
+  { embed_matrix_8, extract_matrix_8 }
+};
+
+void embed_matrix(const unsigned char *data, uint size, unsigned char *image_buffer, uint rate, KeyStream *ks)
+{
+  matrix_kernels[rate - MATRIX_MIN_RATE].embed(data, size, image_buffer, ks);
+}
+
+/*
+ * Function: extract_lsb
+ * ---------------------
+ * Inverse of embed_lsb_replace / embed_lsb_match
+ */
+void extract_lsb(const unsigned char *image_buffer, uint size, unsigned char *data)
+{
+  uint i = 0;
+#ifdef __SSE2__
+  // 16 image bytes -> 2 payload bytes. Reversing the bytes of each
+  // 8 byte group first puts the first image byte's LSB into the
+  // top bit, so one movemask yields both payload bytes in order.
+  for (; i + 8 <= size; i += 8)
+  {
+    for (uint step = 0; step < 8; step += 2)
+    {
+      __m128i pixels = _mm_loadu_si128((const __m128i *)(image_buffer + (i + step) * 8));
+      pixels = _mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+      pixels = _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(0, 1, 2, 3));
+      pixels = _mm_shufflehi_epi16(pixels, _MM_SHUFFLE(0, 1, 2, 3));
+      uint bits = (uint)_mm_movemask_epi8(_mm_slli_epi16(pixels, 7));
+      data[i + step] = bits & 0xff;
+      data[i + step + 1] = bits >> 8;
+    }
+  }
+#endif
+  for (; i < size; i++)
+  {
+    unsigned char byte = 0;
+    for (int j = 0; j < 8; j++)
+      byte = (byte << 1) | (image_buffer[i * 8 + j] & 1);
+    data[i] = byte;
+  }
+}
+
+/*
+ * Function: extract_matrix
+ * ------------------------
+ * Inverse of embed_matrix: each block's syndrome is the next
+ * k bits of the payload.
+ */
+void extract_matrix(const unsigned char *image_buffer, uint size, unsigned char *data, uint rate)
+{
+  matrix_kernels[rate - MATRIX_MIN_RATE].extract(image_buffer, size, data);
+}
+
+/*
+ * Pixel LSB kernels.
+ * The payload is read as a bit stream, MSB of data[0] first
+ * (bit 0 first with PIXEL_LSB_FIRST), in groups of 3 bytes:
+ * 24 bits fill 24 / k channel slots. With c of the 3 colour
+ * channels in use a group is 24 / (k * c) pixels, a whole
+ * number for every supported k (1, 2, 4) and c (1, 2, 3), so
+ * a group always ends on a pixel. Slot s is the (s % c)-th
+ * used channel of pixel s / c; skipped channels and a 4th
+ * (alpha) byte are never touched.
+ *
+ * pixel_embed_body / pixel_extract_body take the layout as
+ * arguments but are always inlined: every PIXEL_KERNEL
+ * instance below passes constants, so the compiler folds the
+ * slot offsets and shifts and fully unrolls the slot loop.
+ * Nothing is decided per payload byte. The unroll hint is
+ * only given when optimizing; unoptimized builds would just
+ * warn that they ignore it.
+ */
+#if !defined(__OPTIMIZE__)
+#define PIXEL_UNROLL
+#elif defined(__clang__)
+#define PIXEL_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define PIXEL_UNROLL _Pragma("GCC unroll 24")
+#else
+#define PIXEL_UNROLL
+#endif
+
+#define PIXEL_CHANNELS(skip) (3 - __builtin_popcount(skip))
+
+/* Byte offset in its pixel of slot s, the (s % c)-th channel not skipped */
+static inline __attribute__((always_inline))
+uint pixel_slot_offset(uint slot, const uint bpp, const uint skip)
+{
+  const uint channels = PIXEL_CHANNELS(skip);
+  uint n = slot % channels;
+  uint channel = 0;
+  for (; channel < 3; channel++)
+    if (!((skip >> channel) & 1) && n-- == 0)
+      break;
+  return slot / channels * bpp + channel;
+}
+
+/* Reverses the bits of each byte of a 24 bit group, for PIXEL_LSB_FIRST */
+static inline uint reverse_byte_bits(uint word)
+{
+  word = ((word >> 1) & 0x555555) | ((word & 0x555555) << 1);
+  word = ((word >> 2) & 0x333333) | ((word & 0x333333) << 2);
+  return ((word >> 4) & 0x0f0f0f) | ((word & 0x0f0f0f) << 4);
+}
+
+static inline __attribute__((always_inline))
+void pixel_embed_body(const unsigned char *data, uint size, unsigned char *image_buffer, const uint bits, const uint bpp,
+                      const uint skip, const uint lsb_first)
+{
+  const uint mask = (1u << bits) - 1;
+  const uint group_bytes = 24 / (bits * PIXEL_CHANNELS(skip)) * bpp;
+  uint i = 0;
+  for (; i + 3 <= size; i += 3, image_buffer += group_bytes)
+  {
+    uint word = ((uint)data[i] << 16) | ((uint)data[i + 1] << 8) | data[i + 2];
+    if (lsb_first)
+      word = reverse_byte_bits(word);
+    PIXEL_UNROLL
+    for (uint slot = 0; slot < 24 / bits; slot++)
+    {
+      unsigned char *channel = image_buffer + pixel_slot_offset(slot, bpp, skip);
+      *channel = (*channel & ~mask) | ((word >> (24 - bits * (slot + 1))) & mask);
+    }
+  }
+  // 1 or 2 trailing bytes; k divides 8, so no slot straddles them
+  if (i < size)
+  {
+    uint word = ((uint)data[i] << 16) | (i + 1 < size ? (uint)data[i + 1] << 8 : 0);
+    if (lsb_first)
+      word = reverse_byte_bits(word);
+    for (uint slot = 0; slot < (size - i) * 8 / bits; slot++)
+    {
+      unsigned char *channel = image_buffer + pixel_slot_offset(slot, bpp, skip);
+      *channel = (*channel & ~mask) | ((word >> (24 - bits * (slot + 1))) & mask);
+    }
+  }
+}
+
+static inline __attribute__((always_inline))
+void pixel_extract_body(const unsigned char *image_buffer, uint size, unsigned char *data, const uint bits, const uint bpp,
+                        const uint skip, const uint lsb_first)
+{
+  const uint mask = (1u << bits) - 1;
+  const uint group_bytes = 24 / (bits * PIXEL_CHANNELS(skip)) * bpp;
+  uint i = 0;
+  for (; i + 3 <= size; i += 3, image_buffer += group_bytes)
+  {
+    uint word = 0;
+    PIXEL_UNROLL
+    for (uint slot = 0; slot < 24 / bits; slot++)
+      word = (word << bits) | (image_buffer[pixel_slot_offset(slot, bpp, skip)] & mask);
+    if (lsb_first)
+      word = reverse_byte_bits(word);
+    data[i] = word >> 16;
+    data[i + 1] = word >> 8;
+    data[i + 2] = word;
+  }
+  if (i < size)
+  {
+    uint slots = (size - i) * 8 / bits;
+    uint word = 0;
+    for (uint slot = 0; slot < slots; slot++)
+      word = (word << bits) | (image_buffer[pixel_slot_offset(slot, bpp, skip)] & mask);
+    word <<= 24 - slots * bits;
+    if (lsb_first)
+      word = reverse_byte_bits(word);
+    data[i] = word >> 16;
+    if (i + 1 < size)
+      data[i + 1] = word >> 8;
+  }
+}
+
+/*
+ * One specialized embed/extract pair per (bits, bytes per pixel,
+ * skipped channels, bit order). PIXEL_LAYOUTS expands X for
+ * every supported combination, in the order of the
+ * pixel_kernels table that pixel_kernel_index computes.
+ */
+#define PIXEL_ORDERS(X, bits, bpp, skip) X(bits, bpp, skip, 0) X(bits, bpp, skip, 1)
+#define PIXEL_SKIPS(X, bits, bpp)                                                           \
+  PIXEL_ORDERS(X, bits, bpp, 0) PIXEL_ORDERS(X, bits, bpp, 1) PIXEL_ORDERS(X, bits, bpp, 2) \
+  PIXEL_ORDERS(X, bits, bpp, 3) PIXEL_ORDERS(X, bits, bpp, 4) PIXEL_ORDERS(X, bits, bpp, 5) \
+  PIXEL_ORDERS(X, bits, bpp, 6)
+#define PIXEL_FORMATS(X, bits) PIXEL_SKIPS(X, bits, 3) PIXEL_SKIPS(X, bits, 4)
+#define PIXEL_LAYOUTS(X) PIXEL_FORMATS(X, 1) PIXEL_FORMATS(X, 2) PIXEL_FORMATS(X, 4)
+
+#define PIXEL_KERNEL(bits, bpp, skip, lsb_first)                                                                              \
+  static void embed_pixel_##bits##_##bpp##_##skip##_##lsb_first(const unsigned char *data, uint size, unsigned char *image,   \
+                                                                KeyStream *ks)                                                \
+  {                                                                                                                           \
+    (void)ks;                                                                                                                 \
+    pixel_embed_body(data, size, image, bits, bpp, skip, lsb_first);                                                          \
+  }                                                                                                                           \
+  static void extract_pixel_##bits##_##bpp##_##skip##_##lsb_first(const unsigned char *image, uint size, unsigned char *data) \
+  {                                                                                                                           \
+    pixel_extract_body(image, size, data, bits, bpp, skip, lsb_first);                                                        \
+  }
+#define PIXEL_ENTRY(bits, bpp, skip, lsb_first) \
+  { embed_pixel_##bits##_##bpp##_##skip##_##lsb_first, extract_pixel_##bits##_##bpp##_##skip##_##lsb_first },
+
+PIXEL_LAYOUTS(PIXEL_KERNEL)
+
+/* 3 depths, 2 pixel sizes, 7 channel masks, 2 bit orders */
+static const EmbedKernel pixel_kernels[3 * 2 * PIXEL_SKIP_ALL * 2] = { PIXEL_LAYOUTS(PIXEL_ENTRY) };
+
+/*
+ * Function: pixel_kernel_index
+ * ----------------------------
+ * Position of a PIXEL_PARAM in pixel_kernels
+ *
+ * Returns: the index, or -1 for an unsupported depth, pixel
+ * size or channel mask
+ */
+static int pixel_kernel_index(uint param)
+{
+  uint bits = PIXEL_PARAM_BITS(param);
+  uint bpp = PIXEL_PARAM_BPP(param);
+  uint skip = PIXEL_PARAM_SKIP(param);
+  if ((bits != 1 && bits != 2 && bits != 4) || (bpp != 3 && bpp != 4) || skip == PIXEL_SKIP_ALL ||
+      (param >> 11) != 0)
+    return -1;
+  return ((int)((bits >> 1) * 2 + bpp - 3) * PIXEL_SKIP_ALL + (int)skip) * 2 + ((param & PIXEL_LSB_FIRST) != 0);
+}
+
+/*
+ * Function: pixel_group_bytes
+ * ---------------------------
+ * Image bytes a 3 byte payload group takes: 24 / (k * c)
+ * pixels for k bits in c channels
+ */
+uint pixel_group_bytes(uint param)
+{
+  return 24 / (PIXEL_PARAM_BITS(param) * PIXEL_CHANNELS(PIXEL_PARAM_SKIP(param))) * PIXEL_PARAM_BPP(param);
+}
+
+/*
+ * Function: embed_pixel_runtime
+ * -----------------------------
+ * The pixel kernel body with its layout only known at run
+ * time, so the benchmark can show what the specialization
+ * saves
+ */
+void embed_pixel_runtime(const unsigned char *data, uint size, unsigned char *image_buffer, uint param)
+{
+  pixel_embed_body(data, size, image_buffer, PIXEL_PARAM_BITS(param), PIXEL_PARAM_BPP(param), PIXEL_PARAM_SKIP(param),
+                   (param & PIXEL_LSB_FIRST) != 0);
+}
+
+/*
+ * Function: gather_strided / scatter_strided
+ * ------------------------------------------
+ * Spread embedding keeps its carrier units every stride units
+ * apart. gather_strided copies n_units of them out of a span
+ * that starts on a unit into a dense buffer for the kernels
+ * above, scatter_strided puts them back. The unit (1 byte, or
+ * the pixel size) and the common small strides are compile
+ * time constants in their own loops, so the compiler can turn
+ * the strided loads into vector shuffles.
+ */
+static inline __attribute__((always_inline))
+void gather_body(const unsigned char *span, uint n_units, unsigned char *dense, const uint unit, const uint stride)
+{
+  for (uint i = 0; i < n_units; i++)
+    for (uint j = 0; j < unit; j++)
+      dense[i * unit + j] = span[i * stride * unit + j];
+}
+
+static inline __attribute__((always_inline))
+void scatter_body(const unsigned char *dense, uint n_units, unsigned char *span, const uint unit, const uint stride)
+{
+  for (uint i = 0; i < n_units; i++)
+    for (uint j = 0; j < unit; j++)
+      span[i * stride * unit + j] = dense[i * unit + j];
+}
+
+void gather_strided(const unsigned char *span, uint n_units, uint unit, uint stride, unsigned char *dense)
+{
+  if (stride == 1)
+    memcpy(dense, span, (size_t)n_units * unit);
+  else if (unit == 1 && stride == 2)
+    gather_body(span, n_units, dense, 1, 2);
+  else if (unit == 1 && stride == 3)
+    gather_body(span, n_units, dense, 1, 3);
+  else if (unit == 1 && stride == 4)
+    gather_body(span, n_units, dense, 1, 4);
+  else if (unit == 1)
+    gather_body(span, n_units, dense, 1, stride);
+  else if (unit == 3)
+    gather_body(span, n_units, dense, 3, stride);
+  else if (unit == 4)
+    gather_body(span, n_units, dense, 4, stride);
+  else
+    gather_body(span, n_units, dense, unit, stride);
+}
+
+void scatter_strided(const unsigned char *dense, uint n_units, uint unit, uint stride, unsigned char *span)
+{
+  if (stride == 1)
+    memcpy(span, dense, (size_t)n_units * unit);
+  else if (unit == 1 && stride == 2)
+    scatter_body(dense, n_units, span, 1, 2);
+  else if (unit == 1 && stride == 3)
+    scatter_body(dense, n_units, span, 1, 3);
+  else if (unit == 1 && stride == 4)
+    scatter_body(dense, n_units, span, 1, 4);
+  else if (unit == 1)
+    scatter_body(dense, n_units, span, 1, stride);
+  else if (unit == 3)
+    scatter_body(dense, n_units, span, 3, stride);
+  else if (unit == 4)
+    scatter_body(dense, n_units, span, 4, stride);
+  else
+    scatter_body(dense, n_units, span, unit, stride);
+}
+
+/* Job kernels of the LSB modes; LSB replacement ignores the key stream */
+static void embed_lsb_kernel(const unsigned char *data, uint size, unsigned char *image_buffer, KeyStream *ks)
+{
+  (void)ks;
+  embed_lsb_replace(data, size, image_buffer);
+}
+
+static const EmbedKernel lsb_kernel = { embed_lsb_kernel, extract_lsb };
+static const EmbedKernel lsb_match_kernel = { embed_lsb_match, extract_lsb };
+
+/*
+ * Function: embed_kernel_select
+ * -----------------------------
+ * Looks up the specialized kernel of a job. param is the code
+ * rate for matrix embedding, a complete PIXEL_PARAM for pixel
+ * embedding and unused otherwise. Jobs call this once and keep
+ * the pointer, so the chunk loops make one indirect call per
+ * chunk and nothing is dispatched per byte.
+ *
+ * Returns: the kernel, or NULL for an unsupported mode or parameter
+ */
+const EmbedKernel *embed_kernel_select(EmbedMode mode, uint param)
+{
+  switch (mode)
+  {
+    case e_embed_lsb:
+      return &lsb_kernel;
+    case e_embed_lsb_match:
+      return &lsb_match_kernel;
+    case e_embed_matrix:
+      if (param < MATRIX_MIN_RATE || param > MATRIX_MAX_RATE)
+        return NULL;
+      return &matrix_kernels[param - MATRIX_MIN_RATE];
+    case e_embed_pixel:
+    {
+      int index = pixel_kernel_index(param);
+      return index < 0 ? NULL : &pixel_kernels[index];
+    }
+    default:
+      return NULL;
+  }
+}
+
+/*
+ * Function: embed_bytes / extract_bytes
+ * -------------------------------------
+ * Look the kernel up and run it once, for the benchmark, the
+ * header fields and the tests. The mode and parameter must be
+ * supported.
+ */
+void embed_bytes(EmbedMode mode, uint param, const unsigned char *data, uint size, unsigned char *image_buffer, KeyStream *ks)
+{
+  embed_kernel_select(mode, param)->embed(data, size, image_buffer, ks);
+}
+
+void extract_bytes(EmbedMode mode, uint param, const unsigned char *image_buffer, uint size, unsigned char *data)
+{
+  embed_kernel_select(mode, param)->extract(image_buffer, size, data);
+}
+
+/*
+ * Function: embed_data_pad
+ * ------------------------
+ * Pixel mode slots are counted from the first byte of a pixel,
+ * but the header ends wherever its length puts it. The secret
+ * data therefore starts after the image bytes left to the next
+ * whole pixel, which keep their value. header_bytes counts the
+ * image bytes from the first pixel to the end of the header
+ * (stride field included). Other modes never pad.
+ */
+uint embed_data_pad(EmbedMode mode, uint param, uint64 header_bytes)
+{
+  uint bpp = PIXEL_PARAM_BPP(param);
+  if (mode != e_embed_pixel || bpp == 0)
+    return 0;
+  return (uint)((bpp - header_bytes % bpp) % bpp);
+}
+
+/*
+ * Function: embed_keystream_words
+ * -------------------------------
+ * Key stream words that one embed call of size payload bytes
+ * draws: two per started group of 16 bytes for LSB matching,
+ * one per started run of 64 blocks for matrix embedding, none
+ * for the kernels that never choose a direction. Lets a caller
+ * resume the key stream where an earlier job left it.
+ */
+uint64 embed_keystream_words(EmbedMode mode, uint param, uint64 size)
+{
+  if (mode == e_embed_lsb_match)
+    return (size + 15) / 16 * 2;
+  if (mode == e_embed_matrix)
+    return ((size * 8 + param - 1) / param + 63) / 64;
+  return 0;
+}
+
+/*
+ * Function: embed_image_bytes
+ * ---------------------------
+ * Image bytes consumed by size payload bytes
+ */
+uint64 embed_image_bytes(EmbedMode mode, uint param, uint64 size)
+{
+  if (mode == e_embed_matrix)
+    return (size * 8 + param - 1) / param * ((1u << param) - 1);
+  if (mode == e_embed_pixel)
+  {
+    // a partial last pixel ends on the channel of its last slot
+    uint bpp = PIXEL_PARAM_BPP(param);
+    uint skip = PIXEL_PARAM_SKIP(param);
+    uint tail_slots = (uint)(size % 3) * 8 / PIXEL_PARAM_BITS(param);
+    uint64 bytes = size / 3 * pixel_group_bytes(param);
+    if (tail_slots)
+      bytes += pixel_slot_offset(tail_slots - 1, bpp, skip) + 1;
+    return bytes;
+  }
+  return size * 8;
+}
+
+/*
+ * Function: embed_chunk_size
+ * --------------------------
+ * Payload bytes per chunk. Chunks use at most STEGO_CHUNK_SIZE * 8
+ * image bytes; for matrix embedding the block count per chunk
+ * is a multiple of 8 so a chunk always ends on a byte and a
+ * block boundary at the same time, and for pixel embedding a
+ * chunk is whole 3 byte groups so it always ends on a pixel.
+ */
+uint embed_chunk_size(EmbedMode mode, uint param)
+{
+  if (mode == e_embed_matrix)
+  {
+    uint blocks = (STEGO_CHUNK_SIZE * 8 / ((1u << param) - 1)) & ~7u;
+    return blocks * param / 8;
+  }
+  if (mode == e_embed_pixel)
+  {
+    uint groups = STEGO_CHUNK_SIZE * 8 / pixel_group_bytes(param);
+    if (groups > STEGO_CHUNK_SIZE / 3)
+      groups = STEGO_CHUNK_SIZE / 3;
+    return groups * 3;
+  }
+  return STEGO_CHUNK_SIZE;
+}
+
+/*
+ * Function: embed_unit_size
+ * -------------------------
+ * Image bytes that stay together when the secret data is
+ * spread: whole pixels in pixel mode, so alpha is still
+ * skipped, single bytes otherwise.
+ */
+uint embed_unit_size(EmbedMode mode, uint param)
+{
+  return mode == e_embed_pixel ? PIXEL_PARAM_BPP(param) : 1;
+}
+
+/*
+ * Function: embed_spread_chunk_size
+ * ---------------------------------
+ * Payload bytes per chunk of spread data: as many whole chunks
+ * of the mode (1 byte, a matrix byte group or a 3 byte pixel
+ * group) as keep the strided span within STEGO_SPREAD_WINDOW,
+ * at least one and never more than embed_chunk_size.
+ */
+uint embed_spread_chunk_size(EmbedMode mode, uint param, uint stride)
+{
+  uint granule = mode == e_embed_matrix ? param : mode == e_embed_pixel ? 3 : 1;
+  uint chunk_size = embed_chunk_size(mode, param);
+  uint64 granule_span = embed_image_bytes(mode, param, granule) * stride;
+  if (granule_span >= STEGO_SPREAD_WINDOW)
+    return granule;
+  uint64 size = STEGO_SPREAD_WINDOW / granule_span * granule;
+  return size < chunk_size ? (uint)size : chunk_size;
+}
+
+/*
+ * Function: embed_header_mode
+ * ---------------------------
+ * The magic string and header fields are read before the
+ * format word is known, so they are written 1 bit per image
+ * byte: LSB matching keeps its own kernel, every other mode
+ * falls back to LSB replacement.
+ */
+EmbedMode embed_header_mode(EmbedMode mode)
+{
+  return mode == e_embed_lsb_match ? e_embed_lsb_match : e_embed_lsb;
+}
@@ -0,0 +1,125 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Bulk embed/extract kernels.
+ * In the LSB modes each payload byte is spread over 8 image
+ * bytes, most significant bit first, exactly like
+ * encode_byte_to_lsb. Matrix embedding reads the payload as
+ * one bit stream in the same order, k bits per block.
+ * The kernels work on whole buffers so the inner loop can
+ * be vectorized; an SSE2 path handles 2 payload bytes
+ * (16 image bytes) per step when the compiler targets it.
+ * Pixel LSB embedding packs k bits into each colour channel.
+ * Spread embedding gathers strided carrier bytes into a dense
+ * buffer around the same kernels.
+ */
+
+/* Matrix embedding code rates: k bits in 2^k - 1 image bytes */
+#define MATRIX_MIN_RATE 2
+#define MATRIX_MAX_RATE 8
+#define MATRIX_DEFAULT_RATE 3
+
+/*
+ * Pixel LSB embedding: the k low bits of the chosen colour
+ * channels carry payload, alpha is skipped. The parameter packs
+ * k, the bit order, the bytes per pixel of the cover and the
+ * channels left alone (bit 0 blue, 1 green, 2 red); every
+ * supported combination has its own kernel, specialized at
+ * compile time. A parameter without the order and channel bits
+ * is the layout of images from before they existed.
+ */
+#define PIXEL_PARAM(bits, bytes_per_pixel) ((bits) | ((bytes_per_pixel) << 4))
+#define PIXEL_PARAM_BITS(param) ((param) & 0x7)
+#define PIXEL_PARAM_BPP(param) (((param) >> 4) & 0xf)
+#define PIXEL_PARAM_SKIP(param) (((param) >> 8) & 0x7)
+#define PIXEL_PARAM_SET_BPP(param, bytes_per_pixel) (((param) & ~0xf0u) | ((bytes_per_pixel) << 4))
+#define PIXEL_LSB_FIRST 0x8 // payload bytes are read bit 0 first
+#define PIXEL_SKIP(mask) ((mask) << 8) // colour channels that carry nothing
+#define PIXEL_SKIP_ALL 7
+#define PIXEL_DEFAULT_BITS 1
+
+/* Key stream driving the +/-1 choice of LSB matching */
+typedef struct _KeyStream
+{
+    unsigned long long state;
+} KeyStream;
+
+/* Specialized embed/extract pair, looked up once per job */
+typedef struct _EmbedKernel
+{
+    void (*embed)(const unsigned char *data, uint size, unsigned char *image_buffer, KeyStream *ks);
+    void (*extract)(const unsigned char *image_buffer, uint size, unsigned char *data);
+} EmbedKernel;
+
+
+/* Kernel function prototype */
+
+/* Seed the key stream from the user's key (the magic string) */
+void keystream_init(KeyStream *ks, const char *key);
+
+/* Next 64 pseudo random bits */
+unsigned long long keystream_next(KeyStream *ks);
+
+/* Skip n words, as if keystream_next had been called n times */
+void keystream_skip(KeyStream *ks, uint64 n);
+
+/* LSB replacement: overwrite bit 0 of each image byte */
+void embed_lsb_replace(const unsigned char *data, uint size, unsigned char *image_buffer);
+
+/* LSB matching: add or subtract 1 where bit 0 differs, saturating at 0/255 */
+void embed_lsb_match(const unsigned char *data, uint size, unsigned char *image_buffer, KeyStream *ks);
+
+/* Matrix embedding: k payload bits per block, at most one change per block */
+void embed_matrix(const unsigned char *data, uint size, unsigned char *image_buffer, uint rate, KeyStream *ks);
+
+/* Syndrome of one block of 2^rate - 1 image bytes */
+uint matrix_syndrome(const unsigned char *block, uint rate);
+
+/* Extract LSB embedded bytes */
+void extract_lsb(const unsigned char *image_buffer, uint size, unsigned char *data);
+
+/* Extract matrix embedded bytes */
+void extract_matrix(const unsigned char *image_buffer, uint size, unsigned char *data, uint rate);
+
+/* Kernel for a mode and its parameter, NULL if the combination is not supported */
+const EmbedKernel *embed_kernel_select(EmbedMode mode, uint param);
+
+/* Image bytes that carry one 3 byte payload group in pixel mode */
+uint pixel_group_bytes(uint param);
+
+/* Same pixel kernel with run time parameters, for the benchmark */
+void embed_pixel_runtime(const unsigned char *data, uint size, unsigned char *image_buffer, uint param);
+
+/* Move carrier units between a strided span and a dense buffer */
+void gather_strided(const unsigned char *span, uint n_units, uint unit, uint stride, unsigned char *dense);
+void scatter_strided(const unsigned char *dense, uint n_units, uint unit, uint stride, unsigned char *span);
+
+/* Look the kernel up and run it, for callers without a job */
+void embed_bytes(EmbedMode mode, uint param, const unsigned char *data, uint size, unsigned char *image_buffer, KeyStream *ks);
+void extract_bytes(EmbedMode mode, uint param, const unsigned char *image_buffer, uint size, unsigned char *data);
+
+/* Image bytes needed to carry size payload bytes */
+uint64 embed_image_bytes(EmbedMode mode, uint param, uint64 size);
+
+/* Image bytes skipped after a header of header_bytes so the data starts on a pixel */
+uint embed_data_pad(EmbedMode mode, uint param, uint64 header_bytes);
+
+/* Key stream words one embed call of size payload bytes draws */
+uint64 embed_keystream_words(EmbedMode mode, uint param, uint64 size);
+
+/* Payload bytes per chunk, so a chunk never splits a matrix block */
+uint embed_chunk_size(EmbedMode mode, uint param);
+
+/* Image bytes moved together when spreading, 1 or the pixel size */
+uint embed_unit_size(EmbedMode mode, uint param);
+
+/* Payload bytes per chunk of spread data at the given stride */
+uint embed_spread_chunk_size(EmbedMode mode, uint param, uint stride);
+
+/* Mode of the header fields, which stay 1 bit per byte */
+EmbedMode embed_header_mode(EmbedMode mode);
+
+#endif
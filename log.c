@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "log.h"
+
+LogLevel log_level = e_log_error;
+__thread LogCode log_last_code;
+static int log_json;
+
+// each thread formats into its own buffer, no lock is shared
+static __thread char log_buffer[LOG_BUFFER_SIZE];
+static __thread size_t log_used;
+
+static const char *log_level_names[] = { "off", "error", "warn", "info", "debug" };
+static const char *log_code_names[e_err_count] = {
+  "none", "args", "io", "format", "capacity", "magic", "header", "digest", "memory", "container", "daemon"
+};
+
+/*
+ * Function: log_init
+ * ------------------
+ * Sets the level and the output format, before any thread
+ * starts logging
+ */
+void log_init(LogLevel level, int json)
+{
+  log_level = level;
+  log_json = json;
+}
+
+const char *log_level_name(LogLevel level)
+{
+  return level <= e_log_debug ? log_level_names[level] : "?";
+}
+
+const char *log_code_name(LogCode code)
+{
+  return code < e_err_count ? log_code_names[code] : "?";
+}
+
+/*
+ * Function: log_flush
+ * -------------------
+ * Writes the calling thread's buffer to stderr. Lines are
+ * whole, so one write() keeps them together.
+ */
+void log_flush(void)
+{
+  size_t done = 0;
+  while (done < log_used)
+  {
+    ssize_t n = write(STDERR_FILENO, log_buffer + done, log_used - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += (size_t)n;
+  }
+  log_used = 0;
+}
+
+/*
+ * Function: log_json_escape
+ * -------------------------
+ * Copies msg into out as the body of a JSON string
+ *
+ * Returns: bytes written, out is always terminated
+ */
+static size_t log_json_escape(const char *msg, char *out, size_t size)
+{
+  size_t n = 0;
+  for (; *msg && n + 7 < size; msg++)
+  {
+    unsigned char c = (unsigned char)*msg;
+    if (c == '"' || c == '\\')
+    {
+      out[n++] = '\\';
+      out[n++] = (char)c;
+    }
+    else if (c == '\n')
+    {
+      out[n++] = '\\';
+      out[n++] = 'n';
+    }
+    else if (c < 0x20)
+    {
+      n += (size_t)snprintf(out + n, size - n, "\\u%04x", c);
+    }
+    else
+    {
+      out[n++] = (char)c;
+    }
+  }
+  out[n] = '\0';
+  return n;
+}
+
+/*
+ * Function: log_write
+ * -------------------
+ * Formats one line into the calling thread's buffer. Errors
+ * and warnings are flushed right away, other lines when the
+ * buffer fills or on log_flush.
+ */
+void log_write(LogLevel level, LogCode code, const char *fmt, ...)
+{
+  char msg[LOG_LINE_MAX];
+  char line[LOG_LINE_MAX * 2];
+  int len;
+  va_list args;
+
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  if (log_json)
+  {
+    char escaped[LOG_LINE_MAX + 16];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    log_json_escape(msg, escaped, sizeof(escaped));
+    if (code != e_err_none)
+      len = snprintf(line, sizeof(line), "{\"ts\":%lld.%03ld,\"level\":\"%s\",\"code\":\"%s\",\"msg\":\"%s\"}\n",
+                     (long long)now.tv_sec, now.tv_nsec / 1000000, log_level_name(level), log_code_name(code), escaped);
+    else
+      len = snprintf(line, sizeof(line), "{\"ts\":%lld.%03ld,\"level\":\"%s\",\"msg\":\"%s\"}\n",
+                     (long long)now.tv_sec, now.tv_nsec / 1000000, log_level_name(level), escaped);
+  }
+  else if (level <= e_log_warn && code != e_err_none)
+  {
+    len = snprintf(line, sizeof(line), "%s [%s]: %s\n", level == e_log_error ? "ERROR" : "WARNING", log_code_name(code), msg);
+  }
+  else if (level <= e_log_warn)
+  {
+    len = snprintf(line, sizeof(line), "%s: %s\n", level == e_log_error ? "ERROR" : "WARNING", msg);
+  }
+  else
+  {
+    len = snprintf(line, sizeof(line), "%s\n", msg);
+  }
+  if (len < 0)
+    return;
+  if ((size_t)len >= sizeof(line))
+  {
+    len = sizeof(line) - 1;
+    line[len - 1] = '\n';
+  }
+
+  if (log_used + (size_t)len > sizeof(log_buffer))
+    log_flush();
+  memcpy(log_buffer + log_used, line, (size_t)len);
+  log_used += (size_t)len;
+  if (level <= e_log_warn)
+    log_flush();
+}
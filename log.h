@@ -0,0 +1,87 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Leveled logging.
+ * Lines are formatted into a per-thread buffer and written to
+ * stderr with one write() per flush, so lines from daemon
+ * workers never interleave and threads share no lock. Errors
+ * and warnings are flushed at once; info and debug lines wait
+ * for log_flush() or a full buffer. Levels above the current
+ * one cost a single compare, the arguments are not evaluated.
+ *
+ * Text lines look like "ERROR [capacity]: ...", JSON lines like
+ * {"ts":1700000000.123,"level":"error","code":"capacity","msg":"..."}
+ * Lines logged with e_err_none carry no code.
+ */
+
+#define LOG_BUFFER_SIZE 8192
+#define LOG_LINE_MAX 1024
+
+typedef enum
+{
+    e_log_off,   // nothing, not even errors
+    e_log_error,
+    e_log_warn,
+    e_log_info,
+    e_log_debug
+} LogLevel;
+
+/* Error codes carried by error and warning lines */
+typedef enum
+{
+    e_err_none,
+    e_err_args,      // bad command line
+    e_err_io,        // open, read, write or seek failed
+    e_err_format,    // not a usable BMP image
+    e_err_capacity,  // secret does not fit the cover
+    e_err_magic,     // magic string mismatch
+    e_err_header,    // damaged stego header field
+    e_err_digest,    // CRC-32C mismatch
+    e_err_memory,    // allocation failed
+    e_err_container, // damaged container directory or missing entry
+    e_err_daemon,    // daemon socket or protocol
+    e_err_count
+} LogCode;
+
+/* Current level, read by the macros below */
+extern LogLevel log_level;
+
+/* Code of the calling thread's last error, logged or filtered,
+   so a caller can report the failure of a whole job with it */
+extern __thread LogCode log_last_code;
+
+/* Log function prototype */
+
+/* Set the level and output format (json != 0 for JSON lines) */
+void log_init(LogLevel level, int json);
+
+/* Format one line into the calling thread's buffer */
+void log_write(LogLevel level, LogCode code, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/* Write out the calling thread's buffer */
+void log_flush(void);
+
+/* Name of a level or code, as used in the output */
+const char *log_level_name(LogLevel level);
+const char *log_code_name(LogCode code);
+
+#define log_error(code, ...) \
+  do { log_last_code = (code); if (log_level >= e_log_error) log_write(e_log_error, log_last_code, __VA_ARGS__); } while (0)
+#define log_warn(code, ...) \
+  do { if (log_level >= e_log_warn) log_write(e_log_warn, code, __VA_ARGS__); } while (0)
+#define log_info(...) \
+  do { if (log_level >= e_log_info) log_write(e_log_info, e_err_none, __VA_ARGS__); } while (0)
+#define log_debug(...) \
+  do { if (log_level >= e_log_debug) log_write(e_log_debug, e_err_none, __VA_ARGS__); } while (0)
+
+/* A step failed: an error with code if nothing under it logged one
+   yet, a debug line otherwise, so only the innermost error of a job
+   is printed and log_last_code keeps its code. A job starts with
+   log_last_code = e_err_none. */
+#define log_failure(code, ...) \
+  do { if (log_last_code == e_err_none) log_error(code, __VA_ARGS__); else log_debug(__VA_ARGS__); } while (0)
+
+#endif
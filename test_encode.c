@@ -3,12 +3,35 @@
 #include "types.h"
 #include "decode.h"
 #include "common.h"
+#include "arena.h"
+#include "cover_index.h"
+#include "bench.h"
+#include "daemon.h"
+#include "container.h"
+#include "append.h"
+#include "log.h"
 #include <string.h>
+#include <stdlib.h>
 int main(int argc,char **argv)
 {
    EncodeInfo encInfo;
    DecodeInfo decInfo;
-   char MAGIC_STRING[20];
+   StegoOptions opts;
+   // every operation sets this, it becomes the exit code
+   Status status=e_failure;
+   memset(&encInfo,0,sizeof(encInfo));
+   memset(&decInfo,0,sizeof(decInfo));
+
+  argc=strip_stego_options(argc,argv,&opts);
+  if(argc<0)
+  {
+    return 1;
+  }
+  log_init(opts.log_level,opts.log_json);
+  atexit(log_flush);
+  encInfo.embed_mode=opts.embed_mode;
+  encInfo.embed_param=opts.embed_param;
+  encInfo.spread=opts.spread;
    
   if(argc>=2)
   {
@@ -18,73 +41,238 @@ int main(int argc,char **argv)
         case e_encode:
           if(argc<4)
           {
-            fprintf(stderr,"not enough arguments for encoding\n");
+            log_error(e_err_args,"not enough arguments for encoding");
             printf("For Encode:./a.out -e beautiful.bmp sectret.txt [optionalfile.bmp]\n");
-            return 0;
+            return 1;
           }
 
-            printf("Encoding selected\n");
+            log_info("Encoding selected");
+              if(arena_init(&encInfo.arena,ARENA_DEFAULT_SIZE)!=e_success)
+              {
+                return 1;
+              }
               if(read_and_validate_encode_args(argv,&encInfo)==e_success)
               {
-              printf("read and validated encode arguments successfully\n");
+              log_info("read and validated encode arguments successfully");
              
-                if(do_encoding(&encInfo)==e_success)
+                if((status=do_encoding(&encInfo))==e_success)
                 {
-                  printf("Encoding completed successfully\n");
+                  log_info("Encoding completed successfully");
                 }
                 else
                 {
-                  fprintf(stderr,"Error failed to encode\n");
+                  log_failure(e_err_io,"failed to encode");
                 }
               } 
               else
               {
-              fprintf(stderr,"Error:source image file should be .bmp\n"); 
-              fprintf(stderr,"Error:secret file should be .txt\n"); 
+              log_error(e_err_args,"source image file should be .bmp"); 
+              log_error(e_err_args,"secret file should be .txt"); 
               }
+              arena_free(&encInfo.arena);
             
             break;
 
         case e_decode:
           if(argc<3)
           {
-            fprintf(stderr,"not enough arguments for decoding\n");
+            log_error(e_err_args,"not enough arguments for decoding");
             printf("For Decode:./a.out -d stego.bmp [optionalfile.txt]\n");
-            return 0;
+            return 1;
           }
-            printf("Decoding selected\n");
+            log_info("Decoding selected");
+              if(arena_init(&decInfo.arena,ARENA_DEFAULT_SIZE)!=e_success)
+              {
+                return 1;
+              }
               if(read_and_validate_decode_args(argv,&decInfo)==e_success)
               {
-              printf("read and validated encode arguments successfully\n");
-                if(do_decoding(&decInfo)==e_success)
+              log_info("read and validated encode arguments successfully");
+                if(opts.verify)
+                {
+                  decInfo.verify=1;
+                  decInfo.has_expected_digest=opts.has_expected_digest;
+                  decInfo.expected_digest=opts.expected_digest;
+                  if((status=do_verify(&decInfo))!=e_success)
+                  {
+                    log_failure(e_err_digest,"verification failed");
+                  }
+                }
+                else if((status=do_decoding(&decInfo))==e_success)
                 {
-                  printf("decoding completed successfully\n");
+                  log_info("decoding completed successfully");
                 }
                 else
                 {
-                  fprintf(stderr,"Error failed to decode\n");
+                  log_failure(e_err_io,"failed to decode");
                 }
               } 
               else
               {
-              fprintf(stderr,"Error:source image file should be .bmp\n"); 
-              fprintf(stderr,"Error:output file should be .txt\n");
+              log_error(e_err_args,"source image file should be .bmp"); 
+              log_error(e_err_args,"output file should be .txt");
+              }
+              arena_free(&decInfo.arena);
+            break;
+
+        case e_index:
+          if(argc<3)
+          {
+            log_error(e_err_args,"not enough arguments for indexing");
+            printf("For Index:./a.out -i covers_dir [optional.idx]\n");
+            return 1;
+          }
+            if((status=do_cover_index(argv))!=e_success)
+            {
+              log_failure(e_err_io,"failed to index covers");
+            }
+            break;
+
+        case e_query:
+          if(argc<4)
+          {
+            log_error(e_err_args,"not enough arguments for query");
+            printf("For Query:./a.out -q covers.idx secret.txt|size [--mode=lsb|match|matrix|pixel] [--rate=2..8] [--bits=1|2|4] [--channels=bgr] [--bit-order=msb|lsb]\n");
+            return 1;
+          }
+            if((status=do_cover_query(argv,opts.embed_mode,opts.embed_param))!=e_success)
+            {
+              log_failure(e_err_args,"failed to find a cover");
+            }
+            break;
+
+        case e_bench:
+            if((status=do_benchmark(argv))!=e_success)
+            {
+              log_failure(e_err_io,"failed to run benchmark");
+            }
+            break;
+
+        case e_bundle:
+          if(argc<5)
+          {
+            log_error(e_err_args,"not enough arguments for bundling");
+            printf("For Bundle:./a.out -m beautiful.bmp stego.bmp file1 [file2 ...]\n");
+            return 1;
+          }
+            log_info("Bundling selected");
+              if(arena_init(&encInfo.arena,CONTAINER_ARENA_SIZE)!=e_success)
+              {
+                return 1;
+              }
+              if((status=do_container_encode(argv,&encInfo))==e_success)
+              {
+                log_info("Bundling completed successfully");
+              }
+              else
+              {
+                log_failure(e_err_container,"failed to bundle");
+              }
+              arena_free(&encInfo.arena);
+            break;
+
+        case e_list:
+        case e_extract:
+          if(argc<(op_type==e_list ? 3 : 4))
+          {
+            log_error(e_err_args,"not enough arguments for %s",op_type==e_list ? "listing" : "extracting");
+            printf("For List:./a.out -l stego.bmp\n");
+            printf("For Extract:./a.out -x stego.bmp name [optional_output]\n");
+            return 1;
+          }
+              if(arena_init(&decInfo.arena,CONTAINER_ARENA_SIZE)!=e_success)
+              {
+                return 1;
+              }
+              if((status=op_type==e_list ? do_container_list(argv,&decInfo) : do_container_extract(argv,&decInfo))!=e_success)
+              {
+                log_failure(e_err_container,"failed to read container");
+              }
+              arena_free(&decInfo.arena);
+            break;
+
+        case e_append:
+          if(argc<4)
+          {
+            log_error(e_err_args,"not enough arguments for appending");
+            printf("For Append:./a.out -a stego.bmp more.txt\n");
+            return 1;
+          }
+            log_info("Appending selected");
+              if(arena_init(&decInfo.arena,ARENA_DEFAULT_SIZE)!=e_success)
+              {
+                return 1;
               }
+              if((status=do_append(argv,&decInfo))==e_success)
+              {
+                log_info("Appending completed successfully");
+              }
+              else
+              {
+                log_failure(e_err_io,"failed to append");
+              }
+              arena_free(&decInfo.arena);
+            break;
+
+        case e_daemon:
+          if(argc<3)
+          {
+            log_error(e_err_args,"not enough arguments for daemon");
+            printf("For Daemon:./a.out -D socket_path [workers] [--cache-mb=N]\n");
+            return 1;
+          }
+            if((status=do_daemon(argv,&opts))!=e_success)
+            {
+              log_failure(e_err_daemon,"failed to run daemon");
+            }
+            break;
+
+        case e_client:
+          if(argc<4)
+          {
+            log_error(e_err_args,"not enough arguments for client");
+            printf("For Client:./a.out -c socket_path e cover.bmp secret.txt [optional.bmp] | d stego.bmp [optional.txt] | p stego.bmp | s [--repeat=N]\n");
+            return 1;
+          }
+            if((status=do_daemon_client(argv,&opts))!=e_success)
+            {
+              log_failure(e_err_daemon,"daemon request failed");
+            }
             break;
 
           default:
-              fprintf(stderr,"Error:Unsupported operation %s\n",argv[1]);
+              log_error(e_err_args,"Unsupported operation %s",argv[1]);
               printf("Usage:\n");
-              printf("For Encode:./a.out -e beautiful.bmp sectret.txt [optional.bmp]\n");
-              printf("For Decode:./a.out -d stego.bmp [optional.txt]\n");
+              printf("For Encode:./a.out -e beautiful.bmp sectret.txt [optional.bmp] [--mode=lsb|match|matrix|pixel] [--rate=2..8] [--bits=1|2|4] [--channels=bgr] [--bit-order=msb|lsb] [--spread]\n");
+              printf("For Decode:./a.out -d stego.bmp [optional.txt] [--verify[=crc32c]]\n");
+              printf("For Index:./a.out -i covers_dir [optional.idx]\n");
+              printf("For Query:./a.out -q covers.idx secret.txt|size [--mode=lsb|match|matrix|pixel] [--rate=2..8] [--bits=1|2|4] [--channels=bgr] [--bit-order=msb|lsb]\n");
+              printf("For Benchmark:./a.out -b [image_megabytes]\n");
+              printf("For Bundle:./a.out -m beautiful.bmp stego.bmp file1 [file2 ...]\n");
+              printf("For List:./a.out -l stego.bmp\n");
+              printf("For Extract:./a.out -x stego.bmp name [optional_output]\n");
+              printf("For Append:./a.out -a stego.bmp more.txt\n");
+              printf("For Daemon:./a.out -D socket_path [workers] [--cache-mb=N]\n");
+              printf("For Client:./a.out -c socket_path e cover.bmp secret.txt [optional.bmp] | d stego.bmp [optional.txt] | p stego.bmp | s [--repeat=N]\n");
+              printf("Logging:[--quiet|--verbose|--log=off|error|warn|info|debug] [--log-json]\n");
             break;  
       }
   }  
   else 
   {
   printf("Usage:\n");
-  printf("For Encode:./a.out -e beautiful.bmp sectret.txt [optional.bmp]\n");
-  printf("For Decode:./a.out -d stego.bmp [optional.txt]\n");
+  printf("For Encode:./a.out -e beautiful.bmp sectret.txt [optional.bmp] [--mode=lsb|match|matrix|pixel] [--rate=2..8] [--bits=1|2|4] [--channels=bgr] [--bit-order=msb|lsb] [--spread]\n");
+  printf("For Decode:./a.out -d stego.bmp [optional.txt] [--verify[=crc32c]]\n");
+  printf("For Index:./a.out -i covers_dir [optional.idx]\n");
+  printf("For Query:./a.out -q covers.idx secret.txt|size [--mode=lsb|match|matrix|pixel] [--rate=2..8] [--bits=1|2|4] [--channels=bgr] [--bit-order=msb|lsb]\n");
+  printf("For Benchmark:./a.out -b [image_megabytes]\n");
+  printf("For Bundle:./a.out -m beautiful.bmp stego.bmp file1 [file2 ...]\n");
+  printf("For List:./a.out -l stego.bmp\n");
+  printf("For Extract:./a.out -x stego.bmp name [optional_output]\n");
+  printf("For Append:./a.out -a stego.bmp more.txt\n");
+  printf("For Daemon:./a.out -D socket_path [workers] [--cache-mb=N]\n");
+  printf("For Client:./a.out -c socket_path e cover.bmp secret.txt [optional.bmp] | d stego.bmp [optional.txt] | p stego.bmp | s [--repeat=N]\n");
+  printf("Logging:[--quiet|--verbose|--log=off|error|warn|info|debug] [--log-json]\n");
   }
-return 0;
+return status==e_success ? 0 : 1;
 }
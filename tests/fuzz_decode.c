@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decode.h"
+#include "arena.h"
+#include "log.h"
+#include "test_util.h"
+
+/*
+ * Fuzz target for decode_stego_buffer, the in-memory decode
+ * entry point. Every input is decoded with the magic string
+ * "#*" and no output file, so only the header parsing, the
+ * kernels and the digest run.
+ *
+ * With -DSTEG_FUZZ=ON and clang this links against libFuzzer:
+ *   fuzz_decode corpus/
+ * Otherwise main below is the driver. Given files it decodes
+ * each one (AFL: afl-fuzz -i in -o out -- fuzz_decode @@);
+ * given none it builds valid stego images in every mode,
+ * checks that they decode, and decodes a fixed set of random
+ * mutations of them (-n count, default 20000), which is what
+ * ctest runs.
+ */
+
+#define MAGIC "#*"
+#define DEFAULT_MUTATIONS 20000
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  static DecodeInfo decInfo;
+  static int ready;
+  if (!ready)
+  {
+    if (arena_init(&decInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+      abort();
+    log_init(e_log_off, 0);
+    ready = 1;
+  }
+  Arena arena = decInfo.arena;
+  memset(&decInfo, 0, sizeof(decInfo));
+  decInfo.arena = arena;
+  arena_reset(&decInfo.arena);
+  decInfo.magic_string = MAGIC;
+  decode_stego_buffer(data, size, &decInfo);
+  return 0;
+}
+
+#ifndef STEG_LIBFUZZER
+
+static unsigned long long seed = 0xf022037ULL;
+
+static int replay_file(const char *path)
+{
+  FILE *fptr = fopen(path, "rb");
+  if (fptr == NULL)
+  {
+    perror(path);
+    return 1;
+  }
+  size_t used = 0, size = 1 << 16;
+  unsigned char *data = malloc(size);
+  size_t n;
+  while (data && (n = fread(data + used, 1, size - used, fptr)) > 0)
+  {
+    used += n;
+    if (used == size)
+      data = realloc(data, size *= 2);
+  }
+  fclose(fptr);
+  if (data == NULL)
+    return 1;
+  LLVMFuzzerTestOneInput(data, used);
+  free(data);
+  return 0;
+}
+
+/*
+ * Function: mutate
+ * ----------------
+ * One random change: flip header LSBs (which rewrites header
+ * fields), overwrite random bytes anywhere, or truncate
+ *
+ * Returns: the length of the mutated input
+ */
+static size_t mutate(unsigned char *data, size_t size)
+{
+  size_t header_end = BMP_HEADER_SIZE + (MAX_STEGO_HEADER_BYTES + STEGO_STRIDE_FIELD_BYTES) * 8;
+  switch (test_rand(&seed) % 4)
+  {
+    case 0:
+    case 1:
+      for (uint i = 1 + test_rand(&seed) % 8; i > 0; i--)
+        data[BMP_HEADER_SIZE + test_rand(&seed) % (header_end - BMP_HEADER_SIZE)] ^= 1;
+      return size;
+    case 2:
+      for (uint i = 1 + test_rand(&seed) % 8; i > 0; i--)
+        data[test_rand(&seed) % size] = (unsigned char)test_rand(&seed);
+      return size;
+    default:
+      return test_rand(&seed) % size;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int mutations = DEFAULT_MUTATIONS;
+  if (argc == 3 && strcmp(argv[1], "-n") == 0)
+  {
+    mutations = atoi(argv[2]);
+  }
+  else if (argc > 1)
+  {
+    int status = 0;
+    for (int i = 1; i < argc; i++)
+      status |= replay_file(argv[i]);
+    return status;
+  }
+
+  // one seed image per mode, and a spread one
+  static const struct { EmbedMode mode; uint param; uint stride; } seeds[] = {
+    { e_embed_lsb, 0, 0 },
+    { e_embed_matrix, 3, 0 },
+    { e_embed_pixel, PIXEL_PARAM(2, 3), 0 },
+    { e_embed_pixel, PIXEL_PARAM(1, 3) | PIXEL_SKIP(2) | PIXEL_LSB_FIRST, 0 },
+    { e_embed_lsb, 0, 2 },
+  };
+  uint n_seeds = sizeof(seeds) / sizeof(seeds[0]);
+  unsigned char *images[sizeof(seeds) / sizeof(seeds[0])];
+  unsigned char secret[300];
+  size_t bmp_size;
+  unsigned char *bmp = test_bmp(64, 32, 24, &bmp_size, &seed);
+  unsigned char *input = malloc(bmp_size);
+  CHECK(bmp != NULL && input != NULL);
+  if (bmp == NULL || input == NULL)
+    return 1;
+  test_fill(secret, sizeof(secret), &seed);
+
+  DecodeInfo decInfo;
+  memset(&decInfo, 0, sizeof(decInfo));
+  if (arena_init(&decInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+    return 1;
+  for (uint s = 0; s < n_seeds; s++)
+  {
+    images[s] = test_stego(bmp, bmp_size, MAGIC, seeds[s].mode, seeds[s].param, secret, sizeof(secret), seeds[s].stride);
+    CHECK(images[s] != NULL);
+    if (images[s] == NULL)
+      return test_result("fuzz_decode");
+    // the unchanged seeds must decode, or the mutations test little
+    decInfo.image_chunk = decInfo.secret_chunk = NULL;
+    decInfo.spread_window = NULL;
+    arena_reset(&decInfo.arena);
+    decInfo.magic_string = MAGIC;
+    CHECK(decode_stego_buffer(images[s], bmp_size, &decInfo) == e_success && decInfo.size_secret_file == sizeof(secret));
+  }
+  arena_free(&decInfo.arena);
+
+  for (int i = 0; i < mutations; i++)
+  {
+    uint s = test_rand(&seed) % n_seeds;
+    memcpy(input, images[s], bmp_size);
+    size_t size = mutate(input, bmp_size);
+    LLVMFuzzerTestOneInput(input, size);
+  }
+  printf("fuzz_decode: %d mutations of %u seed images\n", mutations, n_seeds);
+
+  for (uint s = 0; s < n_seeds; s++)
+    free(images[s]);
+  free(input);
+  free(bmp);
+  return test_result("fuzz_decode");
+}
+
+#endif
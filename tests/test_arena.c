@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+#include "decode.h"
+#include "container.h"
+#include "arena.h"
+#include "kernel.h"
+#include "test_util.h"
+
+/*
+ * Runs a stream of encode, decode and container jobs the way
+ * a daemon worker does: one arena per context, reset between
+ * jobs. After the first job the job path must not call the
+ * heap at all, and no arena allocation may fail. Heap calls
+ * are counted by wrapping malloc, calloc, realloc and free at
+ * link time (-Wl,--wrap, see CMakeLists.txt); the C library's
+ * own allocations, such as the FILE behind fmemopen, are not
+ * ours and are not counted.
+ */
+
+#define N_JOBS 48
+#define SECRET_SIZE 3000
+
+static unsigned long long seed = 0xa7e9a026ULL;
+
+/* Heap calls made by the code linked into this test */
+static uint heap_calls;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+  heap_calls++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+  heap_calls++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  heap_calls++;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+  heap_calls++;
+  __real_free(ptr);
+}
+
+/* Same as the daemon: keep the arena block, clear everything else */
+static void reset_encode(EncodeInfo *encInfo)
+{
+  Arena arena = encInfo->arena;
+  memset(encInfo, 0, sizeof(*encInfo));
+  encInfo->arena = arena;
+  arena_reset(&encInfo->arena);
+}
+
+static void reset_decode(DecodeInfo *decInfo)
+{
+  Arena arena = decInfo->arena;
+  memset(decInfo, 0, sizeof(*decInfo));
+  decInfo->arena = arena;
+  arena_reset(&decInfo->arena);
+}
+
+/* Encodes secret into cover, all in memory; returns the stego image size */
+static size_t encode_job(EncodeInfo *encInfo, const unsigned char *cover, size_t cover_size,
+                         const unsigned char *secret, size_t secret_size, unsigned char *stego,
+                         EmbedMode mode, uint param, int spread)
+{
+  reset_encode(encInfo);
+  encInfo->magic_string = "#*";
+  encInfo->embed_mode = mode;
+  encInfo->embed_param = param;
+  encInfo->spread = spread;
+  encInfo->src_image_fname = encInfo->secret_fname = encInfo->stego_image_fname = "<memory>";
+  strcpy(encInfo->extn_secret_file, ".txt");
+  encInfo->fptr_src_image = fmemopen((void *)cover, cover_size, "rb");
+  encInfo->fptr_secret = fmemopen((void *)secret, secret_size, "rb");
+  encInfo->fptr_stego_image = fmemopen(stego, cover_size, "wb");
+  Status status = do_encoding(encInfo);
+  CHECK(status == e_success);
+  if (encInfo->fptr_src_image)
+    fclose(encInfo->fptr_src_image);
+  if (encInfo->fptr_secret)
+    fclose(encInfo->fptr_secret);
+  if (encInfo->fptr_stego_image)
+    fclose(encInfo->fptr_stego_image);
+  return status == e_success ? cover_size : 0;
+}
+
+static void decode_job(DecodeInfo *decInfo, const unsigned char *stego, size_t stego_size,
+                       const unsigned char *secret, size_t secret_size)
+{
+  unsigned char back[SECRET_SIZE];
+  reset_decode(decInfo);
+  decInfo->magic_string = "#*";
+  decInfo->fptr_decode = fmemopen(back, sizeof(back), "wb");
+  CHECK(decode_stego_buffer(stego, stego_size, decInfo) == e_success);
+  CHECK(decInfo->size_secret_file == secret_size);
+  fclose(decInfo->fptr_decode);
+  decInfo->fptr_decode = NULL;
+  CHECK(memcmp(back, secret, secret_size) == 0);
+}
+
+/* Bundles two files, then reads the directory back */
+static void container_job(EncodeInfo *encInfo, DecodeInfo *decInfo, char *files[], size_t cover_size, unsigned char *stego)
+{
+  Container container;
+  reset_encode(encInfo);
+  FILE *fptr = tmpfile();
+  CHECK(fptr != NULL);
+  if (fptr == NULL)
+    return;
+  CHECK(container_build(files, 2, fptr, &container, &encInfo->arena) == e_success);
+  fclose(fptr);
+
+  reset_decode(decInfo);
+  decInfo->magic_string = "#*";
+  decInfo->stego_image_fname = "<memory>";
+  decInfo->fptr_stego_image = fmemopen(stego, cover_size, "rb");
+  if (decode_stego_header(decInfo) == e_success &&
+      container_read_directory(decInfo, ftello(decInfo->fptr_stego_image), &container) == e_success)
+  {
+    CHECK(container.n_entries == 2);
+    CHECK(strcmp(container.entries[1].name, "arena_b.txt") == 0);
+  }
+  else
+  {
+    CHECK(!"container directory");
+  }
+  fclose(decInfo->fptr_stego_image);
+  decInfo->fptr_stego_image = NULL;
+}
+
+int main(void)
+{
+  EncodeInfo encInfo;
+  DecodeInfo decInfo;
+  size_t cover_size;
+  unsigned char secret[SECRET_SIZE];
+  memset(&encInfo, 0, sizeof(encInfo));
+  memset(&decInfo, 0, sizeof(decInfo));
+
+  unsigned char *cover = test_bmp(160, 120, 24, &cover_size, &seed);
+  unsigned char *stego = malloc(cover_size);
+  heap_calls = 0;
+  if (cover == NULL || stego == NULL ||
+      arena_init(&encInfo.arena, ARENA_DEFAULT_SIZE) != e_success ||
+      arena_init(&decInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+    return 1;
+  // the arena blocks themselves, which shows the wrappers are linked in
+  CHECK(heap_calls == 2);
+
+  const EmbedMode modes[] = { e_embed_lsb, e_embed_lsb_match, e_embed_matrix, e_embed_pixel };
+  const uint params[] = { 0, 0, MATRIX_DEFAULT_RATE, PIXEL_PARAM(2, 0) };
+  for (uint job = 0; job < N_JOBS; job++)
+  {
+    size_t secret_size = 1 + test_rand(&seed) % SECRET_SIZE;
+    test_fill(secret, secret_size, &seed);
+    uint m = job % 4;
+    int spread = (job / 4) % 2;
+    // the first job may set up lazily, every later one must not
+    if (job == 1)
+      heap_calls = 0;
+    size_t stego_size = encode_job(&encInfo, cover, cover_size, secret, secret_size, stego, modes[m], params[m], spread);
+    if (stego_size)
+      decode_job(&decInfo, stego, stego_size, secret, secret_size);
+  }
+  CHECK(heap_calls == 0);
+  CHECK(encInfo.arena.n_failed == 0);
+  CHECK(decInfo.arena.n_failed == 0);
+  CHECK(encInfo.arena.n_allocs >= N_JOBS);
+  CHECK(decInfo.arena.n_allocs >= N_JOBS);
+  CHECK(encInfo.arena.high_water <= ARENA_DEFAULT_SIZE);
+  arena_free(&encInfo.arena);
+  arena_free(&decInfo.arena);
+
+  // container jobs: the directory and entries live on the arena too
+  char *files[] = { "arena_a.txt", "arena_b.txt", NULL };
+  for (int f = 0; f < 2; f++)
+  {
+    FILE *fptr = fopen(files[f], "wb");
+    if (fptr == NULL)
+      return 1;
+    fwrite(secret, 1, 100 + f * 200, fptr);
+    fclose(fptr);
+  }
+  if (arena_init(&encInfo.arena, CONTAINER_ARENA_SIZE) != e_success ||
+      arena_init(&decInfo.arena, CONTAINER_ARENA_SIZE) != e_success)
+    return 1;
+  for (uint job = 0; job < N_JOBS / 4; job++)
+  {
+    // the stego image comes from the CLI path, which embeds the same container
+    reset_encode(&encInfo);
+    encInfo.magic_string = "#*";
+    encInfo.embed_mode = modes[job % 3];
+    encInfo.embed_param = params[job % 3];
+    encInfo.src_image_fname = "<memory>";
+    FILE *bundle = tmpfile();
+    Container container;
+    CHECK(bundle && container_build(files, 2, bundle, &container, &encInfo.arena) == e_success);
+    if (bundle == NULL)
+      break;
+    rewind(bundle);
+    encInfo.format_flags = STEGO_FLAG_CONTAINER;
+    encInfo.secret_fname = encInfo.stego_image_fname = "<memory>";
+    strcpy(encInfo.extn_secret_file, CONTAINER_EXTN);
+    encInfo.fptr_src_image = fmemopen(cover, cover_size, "rb");
+    encInfo.fptr_secret = bundle;
+    encInfo.fptr_stego_image = fmemopen(stego, cover_size, "wb");
+    if (job == 1)
+      heap_calls = 0;
+    CHECK(do_encoding(&encInfo) == e_success);
+    container_job(&encInfo, &decInfo, files, cover_size, stego);
+  }
+  CHECK(heap_calls == 0);
+  CHECK(encInfo.arena.n_failed == 0);
+  CHECK(decInfo.arena.n_failed == 0);
+  arena_free(&encInfo.arena);
+  arena_free(&decInfo.arena);
+
+  remove(files[0]);
+  remove(files[1]);
+  free(cover);
+  free(stego);
+  return test_result("test_arena");
+}
@@ -0,0 +1,113 @@
+#!/bin/sh
+# End to end: every embedding mode through the steg binary,
+# plus verify, append, containers and spread, on the repo's
+# sample cover. Usage: test_cli.sh <steg> <source dir>
+steg=$1
+src=$2
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 1
+cp "$src/beautiful.bmp" "$src/secret.txt" .
+head -c 6000 "$src/beautiful.bmp" | od -An -tx1 > mid.txt
+
+fail=0
+check()
+{
+  if [ "$1" != 0 ]; then
+    echo "FAIL: $2"
+    cat err
+    fail=1
+  fi
+}
+
+for m in "--mode=lsb" "--mode=match" "--mode=matrix --rate=3" "--mode=pixel --bits=2" "--mode=pixel --bits=4" \
+         "--mode=pixel --bits=2 --channels=gr --bit-order=lsb"; do
+  printf 'key\n' | "$steg" -e beautiful.bmp mid.txt o.bmp $m >/dev/null 2>err
+  check $? "encode $m"
+  printf 'key\n' | "$steg" -d o.bmp out.txt --verify >/dev/null 2>err
+  check $? "verify $m"
+  printf 'key\n' | "$steg" -d o.bmp out.txt --verify=0badf00d >/dev/null 2>err
+  [ $? != 0 ]
+  check $? "verify against a wrong digest $m"
+  printf 'key\n' | "$steg" -d o.bmp out.txt >/dev/null 2>err && cmp -s out.txt mid.txt
+  check $? "decode $m"
+  printf 'key\n' | "$steg" -a o.bmp secret.txt >/dev/null 2>err
+  check $? "append $m"
+  cat mid.txt secret.txt > want.txt
+  printf 'key\n' | "$steg" -d o.bmp out.txt >/dev/null 2>err && cmp -s out.txt want.txt
+  check $? "decode appended $m"
+  printf 'key\n' | "$steg" -m beautiful.bmp c.bmp secret.txt mid.txt $m >/dev/null 2>err
+  check $? "bundle $m"
+  printf 'key\n' | "$steg" -x c.bmp mid.txt x.out >/dev/null 2>err && cmp -s x.out mid.txt
+  check $? "extract $m"
+  printf 'key\n' | "$steg" -e beautiful.bmp mid.txt sp.bmp $m --spread >/dev/null 2>err
+  check $? "spread encode $m"
+  printf 'key\n' | "$steg" -d sp.bmp sp.txt >/dev/null 2>err && cmp -s sp.txt mid.txt
+  check $? "spread decode $m"
+done
+
+# Appending carries on with the key stream where the secret
+# ended, so LSB matching makes the same choices as encoding the
+# whole secret at once; only the size and digest fields differ
+printf 'key\n' | "$steg" -e beautiful.bmp mid.txt ap.bmp --mode=match >/dev/null 2>err &&
+  printf 'key\n' | "$steg" -a ap.bmp secret.txt >/dev/null 2>err &&
+  printf 'key\n' | "$steg" -e beautiful.bmp want.txt whole.bmp --mode=match >/dev/null 2>err &&
+  cmp -s -i 1000 ap.bmp whole.bmp
+check $? "append continues the key stream"
+
+# A top-down cover (negative height) has the capacity of its
+# pixels: a small secret round trips, one over capacity is refused
+cp beautiful.bmp td.bmp
+printf '\000\375\377\377' | dd of=td.bmp bs=1 seek=22 conv=notrunc 2>/dev/null
+printf 'key\n' | "$steg" -e td.bmp mid.txt tdo.bmp >/dev/null 2>err &&
+  printf 'key\n' | "$steg" -d tdo.bmp td.txt >/dev/null 2>err && cmp -s td.txt mid.txt
+check $? "top-down cover"
+head -c 300000 beautiful.bmp > big.txt
+printf 'key\n' | "$steg" -e td.bmp big.txt tdbig.bmp >/dev/null 2>err
+[ $? != 0 ] && grep -q "ERROR \[capacity\]" err
+check $? "top-down cover capacity"
+
+# Channel and bit order options only go with pixel mode
+"$steg" -e beautiful.bmp mid.txt o2.bmp --channels=gr >/dev/null 2>err </dev/null
+[ $? != 0 ] && [ ! -e o2.bmp ]
+check $? "channels without pixel mode"
+
+# A stego image that cannot be written fails the job
+ln -s /dev/full full.bmp
+printf 'key\n' | "$steg" -e beautiful.bmp mid.txt full.bmp >/dev/null 2>err
+[ $? != 0 ] && grep -q "ERROR \[io\]: Unable to write full.bmp" err
+check $? "write error"
+
+# A wrong key fails the job instead of writing garbage
+printf 'nope\n' | "$steg" -d o.bmp bad.txt >/dev/null 2>err
+[ $? != 0 ] && [ ! -e bad.txt ] && [ "$(grep -c ERROR err)" = 1 ] && grep -q "ERROR \[magic\]" err
+check $? "wrong key"
+
+# A decode that fails after the output is created leaves an
+# existing file as it was and no temporary file behind
+cp o.bmp bad.bmp
+dd if=/dev/zero of=bad.bmp bs=1 seek=4000 count=256 conv=notrunc 2>/dev/null
+printf 'keep\n' > keep.txt
+printf 'key\n' | "$steg" -d bad.bmp keep.txt >/dev/null 2>err
+[ $? != 0 ] && [ "$(cat keep.txt)" = keep ] && [ "$(ls keep.txt*)" = keep.txt ]
+check $? "failed decode keeps the existing output"
+# the digest mismatch is the one error printed, not the io of the step around it
+grep -q "ERROR \[digest\]" err && ! grep -q "ERROR \[io\]" err && [ "$(grep -c ERROR err)" = 1 ]
+check $? "a digest mismatch reports the digest code"
+printf 'key\n' | "$steg" -d o.bmp keep.txt >/dev/null 2>err && cmp -s keep.txt want.txt && [ "$(ls keep.txt*)" = keep.txt ]
+check $? "decode replaces the existing output"
+
+# A container entry that fails its CRC leaves the output as it was
+printf 'key\n' | "$steg" -m beautiful.bmp cl.bmp secret.txt mid.txt >/dev/null 2>err
+dd if=/dev/zero of=cl.bmp bs=1 seek=20000 count=256 conv=notrunc 2>/dev/null
+printf 'key\n' | "$steg" -x cl.bmp mid.txt keep.txt >/dev/null 2>err
+[ $? != 0 ] && grep -q "ERROR \[digest\]" err && [ "$(ls keep.txt*)" = keep.txt ] && cmp -s keep.txt want.txt
+check $? "failed extract keeps the existing output"
+
+# Entries are named by base name, two files with the same one are refused
+mkdir sub && cp secret.txt sub/
+printf 'key\n' | "$steg" -m beautiful.bmp dup.bmp secret.txt sub/secret.txt >/dev/null 2>err
+[ $? != 0 ] && [ ! -e dup.bmp ]
+check $? "duplicate entry names"
+
+exit $fail
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cover_index.h"
+#include "encode.h"
+#include "kernel.h"
+#include "test_util.h"
+
+/*
+ * Scans a directory of generated covers and checks the stored
+ * capacities, the persisted index and the best-fit queries
+ * against a linear search over the entries.
+ */
+
+static unsigned long long seed = 0xc0de2027ULL;
+
+/* Writes a cover whose pixels start at data_offset */
+static void write_cover(const char *dir, const char *name, uint width, uint height, uint bits_per_pixel, uint data_offset)
+{
+  char path[512];
+  unsigned char header[BMP_HEADER_SIZE];
+  size_t image_size = (size_t)width * height * (bits_per_pixel / 8);
+  unsigned char *pixels = malloc(image_size);
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *fptr = fopen(path, "wb");
+  if (pixels == NULL || fptr == NULL)
+    exit(1);
+  test_bmp_header(header, width, height, bits_per_pixel);
+  header[BMP_OFFSET_DATA] = (unsigned char)data_offset;
+  test_fill(pixels, image_size, &seed);
+  fwrite(header, 1, sizeof(header), fptr);
+  for (uint i = BMP_HEADER_SIZE; i < data_offset; i++)
+    fputc(0, fptr);
+  fwrite(pixels, 1, image_size, fptr);
+  fclose(fptr);
+  free(pixels);
+}
+
+static const CoverEntry *find_entry(const CoverIndex *index, const char *name)
+{
+  for (uint i = 0; i < index->n_entries; i++)
+    if (strcmp(index->entries[i].name, name) == 0)
+      return &index->entries[i];
+  return NULL;
+}
+
+/* Reference answer for cover_index_best_fit */
+static uint64 linear_best_fit(const CoverIndex *index, uint64 payload_size, EmbedMode mode, uint param)
+{
+  uint64 best = 0;
+  for (uint i = 0; i < index->n_entries; i++)
+  {
+    uint64 capacity = cover_capacity(&index->entries[i], mode, param);
+    if (capacity >= payload_size && (best == 0 || capacity < best))
+      best = capacity;
+  }
+  return best;
+}
+
+static void check_queries(const CoverIndex *index)
+{
+  const EmbedMode modes[] = { e_embed_lsb, e_embed_lsb_match, e_embed_matrix, e_embed_matrix,
+                              e_embed_pixel, e_embed_pixel, e_embed_pixel, e_embed_pixel, e_embed_pixel };
+  const uint params[] = { 0, 0, MATRIX_DEFAULT_RATE, 5, 1, 2, 4, 2 | PIXEL_SKIP(1), 1 | PIXEL_SKIP(3) | PIXEL_LSB_FIRST };
+  for (uint m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    for (uint q = 0; q < 200; q++)
+    {
+      uint64 payload_size = test_rand(&seed) % 40000;
+      const CoverEntry *entry = cover_index_best_fit(index, payload_size, modes[m], params[m]);
+      uint64 want = linear_best_fit(index, payload_size, modes[m], params[m]);
+      CHECK(entry == NULL ? want == 0 : cover_capacity(entry, modes[m], params[m]) == want);
+    }
+}
+
+int main(void)
+{
+  char dir[] = "/tmp/steg_covers.XXXXXX";
+  char index_fname[600];
+  CoverIndex index, loaded;
+  if (mkdtemp(dir) == NULL)
+    return TEST_SKIPPED;
+  snprintf(index_fname, sizeof(index_fname), "%s/covers.idx", dir);
+
+  // pixels after a larger (v5) header, and an 8-bit cover
+  write_cover(dir, "offset.bmp", 64, 64, 24, 138);
+  write_cover(dir, "palette.bmp", 64, 64, 8, 54);
+  // 24 and 32-bit covers of many sizes, so pixel capacity and
+  // data size disagree on the order
+  char name[32];
+  for (uint i = 0; i < 40; i++)
+  {
+    snprintf(name, sizeof(name), "c%02u.bmp", i);
+    write_cover(dir, name, 8 + test_rand(&seed) % 120, 8 + test_rand(&seed) % 120, i % 2 ? 32 : 24, 54);
+  }
+
+  CHECK(cover_index_scan(dir, index_fname, &index) == e_success);
+  CHECK(index.n_entries == 42);
+  const CoverEntry *offset = find_entry(&index, "offset.bmp");
+  const CoverEntry *palette = find_entry(&index, "palette.bmp");
+  CHECK(offset != NULL && palette != NULL);
+  for (int mode = 0; mode < e_embed_mode_count && offset && palette; mode++)
+  {
+    CHECK(offset->capacity[mode] == 0);
+    CHECK(palette->capacity[mode] == 0);
+    CHECK(cover_capacity(offset, (EmbedMode)mode, 2) == 0);
+  }
+  const CoverEntry *cover = find_entry(&index, "c00.bmp");
+  CHECK(cover != NULL && cover->capacity[e_embed_lsb] == get_payload_capacity(cover->image_size, e_embed_lsb, 0));
+  check_queries(&index);
+
+  CHECK(cover_index_save(&index) == e_success);
+  CHECK(cover_index_load(index_fname, &loaded) == e_success);
+  CHECK(loaded.n_entries == index.n_entries);
+  for (uint i = 0; i < loaded.n_entries && i < index.n_entries; i++)
+  {
+    CHECK(strcmp(loaded.entries[i].name, index.entries[i].name) == 0);
+    CHECK(memcmp(loaded.entries[i].capacity, index.entries[i].capacity, sizeof(index.entries[i].capacity)) == 0);
+  }
+  check_queries(&loaded);
+  cover_index_free(&loaded);
+
+  // a rescan reuses every entry
+  cover_index_free(&index);
+  CHECK(cover_index_scan(dir, index_fname, &index) == e_success);
+  CHECK(index.n_reused == 42 && index.n_scanned == 0);
+  cover_index_free(&index);
+
+  char cmd[700];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+  if (system(cmd) != 0)
+    fprintf(stderr, "could not remove %s\n", dir);
+  return test_result("test_cover_index");
+}
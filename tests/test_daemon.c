@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "daemon.h"
+#include "test_util.h"
+
+/*
+ * Runs the steg binary as a daemon with a single worker and
+ * talks to it over its socket: idle connections must not hold
+ * the worker, a short request must be rejected without being
+ * read past its end, and an existing file that is not a socket
+ * must never be removed. Usage: test_daemon <steg>
+ */
+
+#define N_IDLE 32
+#define TIMEOUT_MS 5000
+
+static pid_t start_daemon(const char *steg, const char *path)
+{
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    execl(steg, steg, "-D", path, "1", (char *)NULL);
+    _exit(127);
+  }
+  return pid;
+}
+
+/* Reaps the daemon, killing it if it is still up after TIMEOUT_MS */
+static int wait_daemon(pid_t pid, int *status)
+{
+  for (int waited = 0; waited < TIMEOUT_MS; waited += 10)
+  {
+    if (waitpid(pid, status, WNOHANG) == pid)
+      return 1;
+    usleep(10000);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, status, 0);
+  return 0;
+}
+
+static int connect_daemon(const char *path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  for (int tries = 0; tries < 500; tries++)
+  {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+      return sock;
+    close(sock);
+    usleep(10000);
+  }
+  return -1;
+}
+
+/* Sends size bytes of a stats request; returns the response status, -1 on timeout */
+static int request(int sock, size_t size)
+{
+  DaemonRequest req;
+  DaemonResponse resp;
+  memset(&req, 0, sizeof(req));
+  req.proto_magic = DAEMON_PROTO_MAGIC;
+  req.op = e_daemon_stats;
+  if (send(sock, &req, size, MSG_NOSIGNAL) != (ssize_t)size)
+    return -1;
+  struct pollfd pfd = { sock, POLLIN, 0 };
+  if (poll(&pfd, 1, TIMEOUT_MS) != 1 || recv(sock, &resp, sizeof(resp), 0) != sizeof(resp))
+    return -1;
+  return (int)resp.status;
+}
+
+int main(int argc, char **argv)
+{
+  char dir[] = "/tmp/steg_daemon.XXXXXX";
+  char path[128];
+  int status;
+  if (argc < 2 || mkdtemp(dir) == NULL)
+    return TEST_SKIPPED;
+  snprintf(path, sizeof(path), "%s/sock", dir);
+
+  // a regular file in the way stays untouched
+  FILE *fptr = fopen(path, "w");
+  CHECK(fptr != NULL);
+  if (fptr)
+  {
+    fputs("keep me\n", fptr);
+    fclose(fptr);
+  }
+  pid_t pid = start_daemon(argv[1], path);
+  CHECK(pid > 0 && wait_daemon(pid, &status));
+  struct stat st;
+  CHECK(lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == 8);
+  unlink(path);
+
+  pid = start_daemon(argv[1], path);
+  CHECK(pid > 0);
+  int idle[N_IDLE];
+  for (int i = 0; i < N_IDLE; i++)
+    idle[i] = connect_daemon(path);
+  CHECK(idle[0] >= 0 && idle[N_IDLE - 1] >= 0);
+  // only the daemon's user may connect, whatever the umask
+  CHECK(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) && (st.st_mode & 0777) == 0600);
+
+  // one worker, many idle clients: the active client is still served
+  int sock = connect_daemon(path);
+  CHECK(sock >= 0);
+  CHECK(request(sock, sizeof(DaemonRequest)) == e_success);
+  CHECK(request(sock, sizeof(DaemonRequest)) == e_success);
+
+  // a truncated request is answered as bad, and the connection survives
+  CHECK(request(sock, sizeof(uint)) == e_failure);
+  CHECK(request(sock, sizeof(DaemonRequest)) == e_success);
+
+  // an idle client can still send later
+  CHECK(request(idle[N_IDLE / 2], sizeof(DaemonRequest)) == e_success);
+
+  // hanging up while idle frees the slot
+  for (int i = 0; i < N_IDLE; i++)
+    close(idle[i]);
+  CHECK(request(sock, sizeof(DaemonRequest)) == e_success);
+  close(sock);
+
+  if (pid > 0)
+  {
+    kill(pid, SIGTERM);
+    CHECK(wait_daemon(pid, &status) && WIFEXITED(status));
+  }
+  CHECK(lstat(path, &st) != 0);
+  rmdir(dir);
+  return test_result("test_daemon");
+}
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include "decode.h"
+#include "arena.h"
+#include "log.h"
+#include "test_util.h"
+
+/*
+ * Work gate for damaged stego images: decoding one must cost
+ * O(image size), whatever its header claims. Each input is
+ * decoded from a counting stream, the way decode_stego_buffer
+ * decodes from memory, and fails the test if it reads more
+ * than WORK_READ_FACTOR times the image, makes more than one
+ * read or seek per WORK_CALLS_PER_BYTE image bytes, or takes
+ * more CPU time than WORK_TIME_FACTOR times the slowest full
+ * decode of an intact image of the same size.
+ * Inputs: size fields far past the image, truncations inside
+ * the header and the data, and random header bit flips, on a
+ * packed, a spread and a matrix image.
+ */
+
+#define WIDTH 1024
+#define HEIGHT 512
+#define MAGIC "#*"
+#define WORK_TIME_FACTOR 4
+#define WORK_TIME_SLACK 0.01 // seconds, for timer and scheduler noise
+#define WORK_READ_FACTOR 2 // stdio refills its buffer after each seek
+#define WORK_READ_SLACK (64 << 10)
+#define WORK_CALLS_PER_BYTE 512 // one read or seek per this many image bytes
+#define WORK_CALLS_SLACK 256
+#define WORK_ALARM_SECONDS 10 // a decode that spins fails here instead of hanging ctest
+#define HEADER_FLIPS 300
+
+static unsigned long long seed = 0x90a7e037ULL;
+
+typedef struct
+{
+    const unsigned char *data;
+    size_t size;
+    off_t pos;
+    uint64 bytes; // bytes read
+    uint64 calls; // reads and seeks
+} CountedImage;
+
+static ssize_t counted_read(void *cookie, char *buf, size_t size)
+{
+  CountedImage *img = cookie;
+  img->calls++;
+  size_t left = (size_t)img->pos < img->size ? img->size - (size_t)img->pos : 0;
+  if (size > left)
+    size = left;
+  memcpy(buf, img->data + img->pos, size);
+  img->pos += (off_t)size;
+  img->bytes += size;
+  return (ssize_t)size;
+}
+
+static int counted_seek(void *cookie, off64_t *offset, int whence)
+{
+  CountedImage *img = cookie;
+  img->calls++;
+  off_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? img->pos : (off_t)img->size;
+  if (base + *offset < 0)
+    return -1;
+  img->pos = base + *offset;
+  *offset = img->pos;
+  return 0;
+}
+
+static double cpu_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Function: decode_counted
+ * ------------------------
+ * Decodes size bytes of image through a counting stream
+ *
+ * Returns: CPU seconds spent, the counts are left in *img
+ */
+static double decode_counted(const unsigned char *image, size_t size, CountedImage *img, Status *status)
+{
+  static const cookie_io_functions_t funcs = { .read = counted_read, .seek = counted_seek };
+  DecodeInfo decInfo;
+  memset(&decInfo, 0, sizeof(decInfo));
+  memset(img, 0, sizeof(*img));
+  img->data = image;
+  img->size = size;
+  *status = e_failure;
+  if (arena_init(&decInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+    return 0;
+  decInfo.magic_string = MAGIC;
+  decInfo.fptr_stego_image = fopencookie(img, "rb", funcs);
+  if (decInfo.fptr_stego_image == NULL)
+  {
+    arena_free(&decInfo.arena);
+    return 0;
+  }
+  double start = cpu_now();
+  if (decode_stego_header(&decInfo) == e_success && decode_secret_file_data(&decInfo) == e_success)
+    *status = e_success;
+  double elapsed = cpu_now() - start;
+  fclose(decInfo.fptr_stego_image);
+  arena_free(&decInfo.arena);
+  return elapsed;
+}
+
+static double worst_bytes, worst_calls, worst_time;
+
+static void work_alarm(int sig)
+{
+  static const char msg[] = "test_decode_work: a damaged image was still decoding after WORK_ALARM_SECONDS\n";
+  (void)sig;
+  write(STDERR_FILENO, msg, sizeof(msg) - 1);
+  _exit(1);
+}
+
+/* Decodes one damaged input and checks its work against the bounds */
+static void check_damaged(const char *what, const unsigned char *image, size_t size, double budget)
+{
+  CountedImage img;
+  Status status;
+  alarm(WORK_ALARM_SECONDS);
+  double elapsed = decode_counted(image, size, &img, &status);
+  alarm(0);
+  uint64 max_bytes = WORK_READ_FACTOR * size + WORK_READ_SLACK;
+  uint64 max_calls = size / WORK_CALLS_PER_BYTE + WORK_CALLS_SLACK;
+  double bytes = (double)img.bytes / max_bytes;
+  double calls = (double)img.calls / max_calls;
+  if (bytes > worst_bytes)
+    worst_bytes = bytes;
+  if (calls > worst_calls)
+    worst_calls = calls;
+  if (elapsed / budget > worst_time)
+    worst_time = elapsed / budget;
+  if (img.bytes > max_bytes || img.calls > max_calls || elapsed > budget)
+  {
+    fprintf(stderr, "%s: %zu byte image, %llu bytes read in %llu calls, %.3f ms of %.3f ms\n", what, size,
+            img.bytes, img.calls, elapsed * 1e3, budget * 1e3);
+    CHECK(0);
+  }
+}
+
+/* Rewrites the 4 byte size field of a test_stego image */
+static void set_size_field(unsigned char *image, uint size)
+{
+  embed_lsb_replace((const unsigned char *)&size, 4, image + BMP_HEADER_SIZE + (strlen(MAGIC) + 8) * 8);
+}
+
+int main(void)
+{
+  static const struct { EmbedMode mode; uint param; uint stride; } seeds[] = {
+    { e_embed_lsb, 0, 0 },
+    { e_embed_lsb, 0, 4 },
+    { e_embed_matrix, 4, 0 },
+  };
+  enum { n_seeds = sizeof(seeds) / sizeof(seeds[0]) };
+  unsigned char *stego[n_seeds];
+  uint secret_size[n_seeds];
+  size_t bmp_size;
+  unsigned char *bmp = test_bmp(WIDTH, HEIGHT, 24, &bmp_size, &seed);
+  size_t pixel_bytes = bmp_size - BMP_HEADER_SIZE - (MAX_STEGO_HEADER_BYTES + STEGO_STRIDE_FIELD_BYTES) * 8;
+  unsigned char *secret = malloc(pixel_bytes / 8);
+  unsigned char *damaged = malloc(bmp_size);
+  if (bmp == NULL || secret == NULL || damaged == NULL)
+    return 1;
+  test_fill(secret, pixel_bytes / 8, &seed);
+  // damaged inputs log an error each
+  log_init(e_log_off, 0);
+  signal(SIGALRM, work_alarm);
+
+  // every seed's secret fills its image, the slowest intact
+  // decode sets the time budget
+  double full = 0;
+  for (uint s = 0; s < n_seeds; s++)
+  {
+    uint stride = seeds[s].stride ? seeds[s].stride : 1;
+    uint64 per_kb = embed_image_bytes(seeds[s].mode, seeds[s].param, 1024) * stride;
+    secret_size[s] = (uint)(pixel_bytes / per_kb * 1024);
+    stego[s] = test_stego(bmp, bmp_size, MAGIC, seeds[s].mode, seeds[s].param, secret, secret_size[s], seeds[s].stride);
+    CHECK(stego[s] != NULL);
+    if (stego[s] == NULL)
+      return test_result("test_decode_work");
+    for (int round = 0; round < 5; round++)
+    {
+      CountedImage img;
+      Status status;
+      double elapsed = decode_counted(stego[s], bmp_size, &img, &status);
+      CHECK(status == e_success);
+      if (elapsed > full)
+        full = elapsed;
+    }
+  }
+  double budget = WORK_TIME_FACTOR * full + WORK_TIME_SLACK;
+
+  for (uint s = 0; s < n_seeds; s++)
+  {
+    char what[96];
+    static const uint sizes[] = { (uint)STEGO_MAX_SIZE32, 0xffffffffu, 1u << 24, 0 };
+    for (uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+      memcpy(damaged, stego[s], bmp_size);
+      set_size_field(damaged, sizes[i] ? sizes[i] : secret_size[s] + 1);
+      snprintf(what, sizeof(what), "seed %u, size field %u", s, sizes[i]);
+      check_damaged(what, damaged, bmp_size, budget);
+    }
+
+    // cut inside every header byte, then inside the data
+    for (size_t cut = BMP_HEADER_SIZE; cut < BMP_HEADER_SIZE + (MAX_STEGO_HEADER_BYTES + 4) * 8; cut += 5)
+    {
+      snprintf(what, sizeof(what), "seed %u, cut at %zu", s, cut);
+      check_damaged(what, stego[s], cut, budget);
+    }
+    check_damaged("cut in half", stego[s], bmp_size / 2, budget);
+    check_damaged("cut before the end", stego[s], bmp_size - 1, budget);
+
+    for (int i = 0; i < HEADER_FLIPS; i++)
+    {
+      memcpy(damaged, stego[s], bmp_size);
+      for (uint flips = 1 + test_rand(&seed) % 4; flips > 0; flips--)
+        damaged[BMP_HEADER_SIZE + test_rand(&seed) % ((MAX_STEGO_HEADER_BYTES + 4) * 8)] ^= 1;
+      snprintf(what, sizeof(what), "seed %u, header flips %d", s, i);
+      check_damaged(what, damaged, bmp_size, budget);
+    }
+    free(stego[s]);
+  }
+
+  printf("test_decode_work: worst case %.2f of the read bound, %.2f of the call bound, %.2f of the time budget\n",
+         worst_bytes, worst_calls, worst_time);
+  free(bmp);
+  free(secret);
+  free(damaged);
+  return test_result("test_decode_work");
+}
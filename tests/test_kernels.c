@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernel.h"
+#include "encode.h"
+#include "test_util.h"
+
+/*
+ * Embed/extract round trips for every kernel, on random
+ * payloads of awkward sizes, plus the invariants each mode
+ * promises about the carrier bytes it changes.
+ */
+
+#define MAX_PAYLOAD 1000
+
+static unsigned long long seed = 0x5eed2026ULL;
+
+/* Round trip one payload; returns the carrier after embedding */
+static void round_trip(EmbedMode mode, uint param, uint size, unsigned char *before, unsigned char *after)
+{
+  unsigned char data[MAX_PAYLOAD], back[MAX_PAYLOAD];
+  uint64 image_bytes = embed_image_bytes(mode, param, size);
+  KeyStream ks;
+
+  test_fill(data, size, &seed);
+  test_fill(before, image_bytes, &seed);
+  memcpy(after, before, image_bytes);
+  keystream_init(&ks, "#*");
+  embed_bytes(mode, param, data, size, after, &ks);
+  extract_bytes(mode, param, after, size, back);
+  CHECK(memcmp(data, back, size) == 0);
+}
+
+static void test_lsb(unsigned char *before, unsigned char *after)
+{
+  for (uint size = 1; size < MAX_PAYLOAD; size += 37)
+  {
+    round_trip(e_embed_lsb, 0, size, before, after);
+    // Same bytes as the one-byte-at-a-time reference
+    unsigned char data[MAX_PAYLOAD];
+    extract_lsb(after, size, data);
+    for (uint i = 0; i < size; i++)
+      encode_byte_to_lsb((char)data[i], (char *)before + i * 8);
+    CHECK(memcmp(before, after, (size_t)size * 8) == 0);
+  }
+}
+
+static void test_lsb_match(unsigned char *before, unsigned char *after)
+{
+  for (uint size = 1; size < MAX_PAYLOAD; size += 41)
+  {
+    round_trip(e_embed_lsb_match, 0, size, before, after);
+    for (uint i = 0; i < size * 8; i++)
+    {
+      int delta = (int)after[i] - (int)before[i];
+      CHECK(delta >= -1 && delta <= 1);
+    }
+  }
+  // Saturated carriers never wrap around
+  unsigned char data[64], image[512];
+  KeyStream ks;
+  keystream_init(&ks, "#*");
+  test_fill(data, sizeof data, &seed);
+  for (uint i = 0; i < sizeof image; i++)
+    image[i] = i & 1 ? 255 : 0;
+  embed_lsb_match(data, sizeof data, image, &ks);
+  for (uint i = 0; i < sizeof image; i++)
+    CHECK(i & 1 ? image[i] >= 254 : image[i] <= 1);
+}
+
+static void test_matrix(unsigned char *before, unsigned char *after)
+{
+  for (uint rate = MATRIX_MIN_RATE; rate <= MATRIX_MAX_RATE; rate++)
+    for (uint size = 1; size < MAX_PAYLOAD; size += 53)
+    {
+      round_trip(e_embed_matrix, rate, size, before, after);
+      // At most one change per block, by +/-1
+      uint block = (1u << rate) - 1;
+      uint64 image_bytes = embed_image_bytes(e_embed_matrix, rate, size);
+      for (uint64 b = 0; b < image_bytes; b += block)
+      {
+        uint changes = 0;
+        for (uint j = 0; j < block; j++)
+        {
+          int delta = (int)after[b + j] - (int)before[b + j];
+          CHECK(delta >= -1 && delta <= 1);
+          changes += delta != 0;
+        }
+        CHECK(changes <= 1);
+      }
+    }
+}
+
+static void test_syndrome(void)
+{
+  unsigned char block[255];
+  for (uint rate = MATRIX_MIN_RATE; rate <= MATRIX_MAX_RATE; rate++)
+    for (uint round = 0; round < 100; round++)
+    {
+      uint n = (1u << rate) - 1, want = 0;
+      test_fill(block, n, &seed);
+      for (uint p = 0; p < n; p++)
+        if (block[p] & 1)
+          want ^= p + 1;
+      CHECK(matrix_syndrome(block, rate) == want);
+    }
+}
+
+static void test_pixel(unsigned char *before, unsigned char *after)
+{
+  const uint bits[] = { 1, 2, 4 };
+  for (uint b = 0; b < 3; b++)
+    for (uint bpp = 3; bpp <= 4; bpp++)
+      for (uint skip = 0; skip < PIXEL_SKIP_ALL; skip++)
+        for (uint order = 0; order <= PIXEL_LSB_FIRST; order += PIXEL_LSB_FIRST)
+        {
+          uint param = PIXEL_PARAM(bits[b], bpp) | PIXEL_SKIP(skip) | order;
+          CHECK(embed_kernel_select(e_embed_pixel, param) != NULL);
+          for (uint size = 1; size < MAX_PAYLOAD; size += 29)
+          {
+            round_trip(e_embed_pixel, param, size, before, after);
+            uint64 image_bytes = embed_image_bytes(e_embed_pixel, param, size);
+            for (uint64 i = 0; i < image_bytes; i++)
+            {
+              // Only the k low bits of used channels change, alpha not at all
+              uint channel = i % bpp;
+              uint keep = channel == 3 || ((skip >> channel) & 1) ? 0xff : 0xff & ~((1u << bits[b]) - 1);
+              CHECK((after[i] & keep) == (before[i] & keep));
+            }
+          }
+        }
+
+  // Bit order: the first used channel gets the first k bits of data[0]
+  unsigned char data[3] = { 0x06, 0, 0 }, image[96];
+  memset(image, 0, sizeof(image));
+  embed_bytes(e_embed_pixel, PIXEL_PARAM(2, 4) | PIXEL_SKIP(1), data, 3, image, NULL);
+  CHECK(image[0] == 0 && image[1] == 0 && image[2] == 0 && image[5] == 1 && image[6] == 2);
+  memset(image, 0, sizeof(image));
+  embed_bytes(e_embed_pixel, PIXEL_PARAM(2, 4) | PIXEL_SKIP(1) | PIXEL_LSB_FIRST, data, 3, image, NULL);
+  CHECK(image[0] == 0 && image[1] == 1 && image[2] == 2 && image[5] == 0 && image[6] == 0);
+
+  CHECK(embed_kernel_select(e_embed_pixel, PIXEL_PARAM(3, 3)) == NULL);
+  CHECK(embed_kernel_select(e_embed_pixel, PIXEL_PARAM(1, 3) | PIXEL_SKIP(PIXEL_SKIP_ALL)) == NULL);
+  CHECK(embed_kernel_select(e_embed_matrix, MATRIX_MAX_RATE + 1) == NULL);
+}
+
+/* embed_keystream_words matches what every kernel draws */
+static void test_keystream_words(unsigned char *after)
+{
+  const EmbedMode modes[] = { e_embed_lsb, e_embed_lsb_match, e_embed_matrix, e_embed_matrix, e_embed_matrix, e_embed_pixel };
+  const uint params[] = { 0, 0, 2, 5, MATRIX_MAX_RATE, PIXEL_PARAM(2, 3) };
+  unsigned char data[MAX_PAYLOAD];
+  for (uint m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    for (uint size = 1; size < MAX_PAYLOAD; size += 13)
+    {
+      KeyStream drawn, skipped;
+      test_fill(data, size, &seed);
+      test_fill(after, embed_image_bytes(modes[m], params[m], size), &seed);
+      keystream_init(&drawn, "#*");
+      keystream_init(&skipped, "#*");
+      embed_bytes(modes[m], params[m], data, size, after, &drawn);
+      keystream_skip(&skipped, embed_keystream_words(modes[m], params[m], size));
+      CHECK(drawn.state == skipped.state);
+    }
+}
+
+int main(void)
+{
+  // Rate 8 matrix embedding is the most wasteful mode
+  size_t image_bytes = embed_image_bytes(e_embed_matrix, MATRIX_MAX_RATE, MAX_PAYLOAD);
+  unsigned char *before = malloc(image_bytes);
+  unsigned char *after = malloc(image_bytes);
+  if (before == NULL || after == NULL)
+    return 1;
+
+  test_lsb(before, after);
+  test_lsb_match(before, after);
+  test_syndrome();
+  test_matrix(before, after);
+  test_pixel(before, after);
+  test_keystream_words(after);
+
+  free(before);
+  free(after);
+  return test_result("test_kernels");
+}
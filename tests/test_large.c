@@ -0,0 +1,170 @@
+#define _GNU_SOURCE // SEEK_HOLE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "encode.h"
+#include "decode.h"
+#include "arena.h"
+#include "test_util.h"
+
+/*
+ * Round trips through a cover over 4 GB. The cover is a sparse
+ * file: header, random pixels at the start and past the 4 GB
+ * mark, holes in between, so the test costs little disk and
+ * time. A spread secret has carrier bytes across the whole
+ * image, past 4 GB too; a packed one checks that the pixels
+ * after it are copied to the same offsets and that the holes
+ * stay holes. Skipped where the file system cannot hold the
+ * file or does not report holes.
+ */
+
+#define WIDTH 40000
+#define HEIGHT 40000 // 4.8 GB of 24-bit pixels
+#define IMAGE_SIZE ((uint64)WIDTH * HEIGHT * 3)
+#define SECRET_SIZE 3000
+#define DATA_SPAN (1 << 20)
+#define HIGH_OFFSET (4500ULL << 20) // random pixels past 4 GB
+
+static unsigned long long seed = 0x1a46e036ULL;
+
+/* Sparse cover; returns TEST_SKIPPED if the file system cannot take it */
+static int write_cover(const char *path)
+{
+  unsigned char header[BMP_HEADER_SIZE];
+  unsigned char *pixels = malloc(DATA_SPAN);
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int status = 1;
+  if (pixels && fd >= 0)
+  {
+    test_bmp_header(header, WIDTH, HEIGHT, 24);
+    test_fill(pixels, DATA_SPAN, &seed);
+    if (ftruncate(fd, (off_t)(BMP_HEADER_SIZE + IMAGE_SIZE)) != 0)
+      status = errno == EFBIG || errno == ENOSPC || errno == EINVAL ? TEST_SKIPPED : 1;
+    else if (pwrite(fd, header, sizeof(header), 0) == sizeof(header) &&
+             pwrite(fd, pixels, DATA_SPAN, BMP_HEADER_SIZE) == DATA_SPAN &&
+             pwrite(fd, pixels, DATA_SPAN, (off_t)(BMP_HEADER_SIZE + HIGH_OFFSET)) == DATA_SPAN)
+      // without hole reporting every copy would write 4.8 GB
+      status = lseek(fd, BMP_HEADER_SIZE + DATA_SPAN, SEEK_HOLE) < (off_t)(BMP_HEADER_SIZE + IMAGE_SIZE) ? 0 : TEST_SKIPPED;
+  }
+  if (fd >= 0)
+    close(fd);
+  free(pixels);
+  return status;
+}
+
+static Status encode_file(const char *cover, const char *secret, const char *stego, int spread)
+{
+  EncodeInfo encInfo;
+  memset(&encInfo, 0, sizeof(encInfo));
+  if (arena_init(&encInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+    return e_failure;
+  encInfo.magic_string = "#*";
+  encInfo.embed_mode = e_embed_lsb;
+  encInfo.spread = spread;
+  encInfo.src_image_fname = (char *)cover;
+  encInfo.secret_fname = (char *)secret;
+  encInfo.stego_image_fname = (char *)stego;
+  strcpy(encInfo.extn_secret_file, ".txt");
+  Status status = do_encoding(&encInfo);
+  if (encInfo.fptr_src_image)
+    fclose(encInfo.fptr_src_image);
+  if (encInfo.fptr_secret)
+    fclose(encInfo.fptr_secret);
+  if (encInfo.fptr_stego_image)
+    fclose(encInfo.fptr_stego_image);
+  arena_free(&encInfo.arena);
+  return status;
+}
+
+static Status decode_file(const char *stego, char *out)
+{
+  DecodeInfo decInfo;
+  memset(&decInfo, 0, sizeof(decInfo));
+  if (arena_init(&decInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+    return e_failure;
+  decInfo.magic_string = "#*";
+  decInfo.stego_image_fname = (char *)stego;
+  decInfo.decode_fname = out;
+  Status status = do_decoding(&decInfo);
+  if (decInfo.fptr_stego_image)
+    fclose(decInfo.fptr_stego_image);
+  arena_free(&decInfo.arena);
+  return status;
+}
+
+/*
+ * The stego image has the cover's size, bits 1..7 of its pixels
+ * and its holes, except for the blocks a spread secret writes
+ */
+static void check_stego(const char *cover, const char *stego, int spread)
+{
+  struct stat st;
+  unsigned char *a = malloc(DATA_SPAN), *b = malloc(DATA_SPAN);
+  int fa = open(cover, O_RDONLY), fb = open(stego, O_RDONLY);
+  CHECK(stat(stego, &st) == 0 && (uint64)st.st_size == BMP_HEADER_SIZE + IMAGE_SIZE);
+  CHECK((uint64)st.st_blocks * 512 < (64ULL << 20) + (spread ? SECRET_SIZE * 8ULL * 2 * 4096 : 0));
+  if (a && b && fa >= 0 && fb >= 0)
+  {
+    CHECK(pread(fa, a, DATA_SPAN, (off_t)(BMP_HEADER_SIZE + HIGH_OFFSET)) == DATA_SPAN);
+    CHECK(pread(fb, b, DATA_SPAN, (off_t)(BMP_HEADER_SIZE + HIGH_OFFSET)) == DATA_SPAN);
+    uint changed = 0;
+    for (uint i = 0; i < DATA_SPAN; i++)
+    {
+      CHECK(((a[i] ^ b[i]) & 0xfe) == 0);
+      changed += a[i] != b[i];
+    }
+    printf("%s: %u pixel bytes past 4 GB changed\n", stego, changed);
+  }
+  if (fa >= 0)
+    close(fa);
+  if (fb >= 0)
+    close(fb);
+  free(a);
+  free(b);
+}
+
+int main(void)
+{
+  char dir[] = "large.XXXXXX";
+  char cover[64], secret[64], stego[64], out[64];
+  unsigned char data[SECRET_SIZE], back[SECRET_SIZE + 1];
+  if (mkdtemp(dir) == NULL)
+    return 1;
+  snprintf(cover, sizeof(cover), "%s/cover.bmp", dir);
+  snprintf(secret, sizeof(secret), "%s/secret.txt", dir);
+  snprintf(stego, sizeof(stego), "%s/stego.bmp", dir);
+  snprintf(out, sizeof(out), "%s/out.txt", dir);
+
+  int status = write_cover(cover);
+  FILE *fptr = fopen(secret, "wb");
+  test_fill(data, sizeof(data), &seed);
+  if (status == 0 && (fptr == NULL || fwrite(data, 1, sizeof(data), fptr) != sizeof(data)))
+    status = 1;
+  if (fptr)
+    fclose(fptr);
+
+  // packed, then spread over the whole 4.8 GB
+  for (int spread = 0; spread <= 1 && status == 0; spread++)
+  {
+    CHECK(encode_file(cover, secret, stego, spread) == e_success);
+    check_stego(cover, stego, spread);
+    CHECK(decode_file(stego, out) == e_success);
+    fptr = fopen(out, "rb");
+    CHECK(fptr != NULL && fread(back, 1, sizeof(back), fptr) == SECRET_SIZE && memcmp(back, data, SECRET_SIZE) == 0);
+    if (fptr)
+      fclose(fptr);
+    unlink(stego);
+    unlink(out);
+  }
+
+  unlink(cover);
+  unlink(secret);
+  rmdir(dir);
+  if (status == TEST_SKIPPED)
+    printf("test_large: skipped, no sparse files over 4 GB here\n");
+  return status ? status : test_result("test_large");
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "arena.h"
+#include "log.h"
+#include "test_util.h"
+
+/*
+ * Property test: for random covers, payloads and embedding
+ * settings, a secret that fits the cover decodes back to the
+ * same bytes from the stego image in memory, and one byte more
+ * than the capacity is refused. Covers are 24 or 32-bit,
+ * modes are lsb, match, matrix at every rate and pixel with
+ * every bit count, channel mask and bit order, each packed or
+ * spread, under magic strings of several lengths. Pixel mode
+ * must also leave every skipped channel and alpha byte after
+ * the header as it was in the cover. Usage: test_roundtrip [cases]
+ */
+
+#define DEFAULT_CASES 400
+
+static unsigned long long seed = 0x2f00d037ULL;
+
+typedef struct
+{
+    EmbedMode mode;
+    uint param;
+    int spread;
+    uint bits_per_pixel;
+    const char *magic;
+} RoundTrip;
+
+/* Random embedding settings and cover format for one case */
+static RoundTrip pick_case(void)
+{
+  static const uint pixel_bits[] = { 1, 2, 4 };
+  // header lengths that leave the data at every pixel phase
+  static const char *magics[] = { "#*", "abc", "k3y!", "mag1c" };
+  RoundTrip rt;
+  rt.magic = magics[test_rand(&seed) % 4];
+  rt.mode = (EmbedMode)(test_rand(&seed) % 4);
+  rt.spread = test_rand(&seed) & 1;
+  rt.bits_per_pixel = test_rand(&seed) & 1 ? 32 : 24;
+  rt.param = 0;
+  if (rt.mode == e_embed_matrix)
+  {
+    rt.param = MATRIX_MIN_RATE + test_rand(&seed) % (MATRIX_MAX_RATE - MATRIX_MIN_RATE + 1);
+  }
+  else if (rt.mode == e_embed_pixel)
+  {
+    // any mask but the one that leaves no channel
+    uint mask = test_rand(&seed) % PIXEL_SKIP_ALL;
+    rt.param = PIXEL_PARAM(pixel_bits[test_rand(&seed) % 3], rt.bits_per_pixel / 8) | PIXEL_SKIP(mask);
+    if (test_rand(&seed) & 1)
+      rt.param |= PIXEL_LSB_FIRST;
+  }
+  return rt;
+}
+
+/* What check_capacity allows for this case */
+static uint64 case_capacity(const RoundTrip *rt, uint64 image_size)
+{
+  if (rt->spread)
+    image_size = image_size > STEGO_STRIDE_FIELD_BYTES * 8 ? image_size - STEGO_STRIDE_FIELD_BYTES * 8 : 0;
+  return get_payload_capacity(image_size, rt->mode, rt->param);
+}
+
+static int write_file(const char *path, const unsigned char *data, size_t size)
+{
+  FILE *fptr = fopen(path, "wb");
+  int ok = fptr && fwrite(data, 1, size, fptr) == size;
+  if (fptr && fclose(fptr) != 0)
+    ok = 0;
+  return ok;
+}
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+  FILE *fptr = fopen(path, "rb");
+  unsigned char *data = NULL;
+  if (fptr && fseek(fptr, 0, SEEK_END) == 0 && (*size = (size_t)ftell(fptr)) > 0 &&
+      (data = malloc(*size)) != NULL)
+  {
+    rewind(fptr);
+    if (fread(data, 1, *size, fptr) != *size)
+    {
+      free(data);
+      data = NULL;
+    }
+  }
+  if (fptr)
+    fclose(fptr);
+  return data;
+}
+
+static Status encode_case(const RoundTrip *rt, const char *cover, const char *secret, const char *stego)
+{
+  EncodeInfo encInfo;
+  memset(&encInfo, 0, sizeof(encInfo));
+  if (arena_init(&encInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+    return e_failure;
+  encInfo.magic_string = rt->magic;
+  encInfo.embed_mode = rt->mode;
+  encInfo.embed_param = rt->param;
+  encInfo.spread = rt->spread;
+  encInfo.src_image_fname = (char *)cover;
+  encInfo.secret_fname = (char *)secret;
+  encInfo.stego_image_fname = (char *)stego;
+  strcpy(encInfo.extn_secret_file, ".txt");
+  Status status = do_encoding(&encInfo);
+  if (encInfo.fptr_src_image)
+    fclose(encInfo.fptr_src_image);
+  if (encInfo.fptr_secret)
+    fclose(encInfo.fptr_secret);
+  if (encInfo.fptr_stego_image)
+    fclose(encInfo.fptr_stego_image);
+  arena_free(&encInfo.arena);
+  return status;
+}
+
+/* Decodes the stego file from memory and compares it with the secret */
+static int decode_matches(const char *stego, const char *magic, const unsigned char *secret, size_t secret_size)
+{
+  size_t image_size = 0, out_size = 0;
+  char *out = NULL;
+  unsigned char *image = read_file(stego, &image_size);
+  DecodeInfo decInfo;
+  memset(&decInfo, 0, sizeof(decInfo));
+  if (image == NULL || arena_init(&decInfo.arena, ARENA_DEFAULT_SIZE) != e_success)
+  {
+    free(image);
+    return 0;
+  }
+  decInfo.magic_string = magic;
+  decInfo.fptr_decode = open_memstream(&out, &out_size);
+  Status status = decInfo.fptr_decode ? decode_stego_buffer(image, image_size, &decInfo) : e_failure;
+  if (decInfo.fptr_decode)
+    fclose(decInfo.fptr_decode);
+  int ok = status == e_success && out_size == secret_size && memcmp(out, secret, secret_size) == 0;
+  free(out);
+  free(image);
+  arena_free(&decInfo.arena);
+  return ok;
+}
+
+/*
+ * Checks that pixel mode changed no skipped channel and no
+ * alpha byte of the pixels after the header. The header itself
+ * is written 1 bit per image byte into every channel.
+ */
+static int channels_untouched(const RoundTrip *rt, const unsigned char *cover, size_t cover_size, const char *stego)
+{
+  if (rt->mode != e_embed_pixel)
+    return 1;
+  size_t size = 0;
+  unsigned char *image = read_file(stego, &size);
+  uint bpp = rt->bits_per_pixel / 8;
+  uint skip = PIXEL_PARAM_SKIP(rt->param);
+  size_t header_end = BMP_HEADER_SIZE + (strlen(rt->magic) + 16 + (rt->spread ? STEGO_STRIDE_FIELD_BYTES : 0)) * 8;
+  int ok = image != NULL && size == cover_size;
+  for (size_t pixel = (header_end - BMP_HEADER_SIZE + bpp - 1) / bpp; ok && BMP_HEADER_SIZE + (pixel + 1) * bpp <= size; pixel++)
+    for (uint c = 0; c < bpp && ok; c++)
+    {
+      size_t at = BMP_HEADER_SIZE + pixel * bpp + c;
+      if (c == 3 || ((skip >> c) & 1))
+        ok = image[at] == cover[at];
+    }
+  free(image);
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  int cases = argc > 1 ? atoi(argv[1]) : DEFAULT_CASES;
+  char dir[] = "roundtrip.XXXXXX";
+  char cover[64], secret[64], stego[64];
+  if (mkdtemp(dir) == NULL)
+    return 1;
+  snprintf(cover, sizeof(cover), "%s/cover.bmp", dir);
+  snprintf(secret, sizeof(secret), "%s/secret.txt", dir);
+  snprintf(stego, sizeof(stego), "%s/stego.bmp", dir);
+  // refused oversize secrets log an error each
+  log_init(e_log_off, 0);
+
+  uint decoded = 0, refused = 0;
+  for (int i = 0; i < cases; i++)
+  {
+    RoundTrip rt = pick_case();
+    uint width = 16 + test_rand(&seed) % 97, height = 16 + test_rand(&seed) % 49;
+    size_t bmp_size;
+    unsigned char *bmp = test_bmp(width, height, rt.bits_per_pixel, &bmp_size, &seed);
+    uint64 capacity = case_capacity(&rt, bmp_size - BMP_HEADER_SIZE);
+    // every 8th case is one byte over, the others fit
+    int over = i % 8 == 7;
+    size_t size = over ? capacity + 1 : capacity ? 1 + test_rand(&seed) % capacity : 0;
+    unsigned char *data = malloc(size + 1);
+    if (bmp == NULL || data == NULL)
+      return 1;
+    test_fill(data, size, &seed);
+    if (size > 0 && write_file(cover, bmp, bmp_size) && write_file(secret, data, size))
+    {
+      Status status = encode_case(&rt, cover, secret, stego);
+      if (over)
+      {
+        CHECK(status == e_failure);
+        refused += status == e_failure;
+      }
+      else if (status != e_success || !decode_matches(stego, rt.magic, data, size) ||
+               !channels_untouched(&rt, bmp, bmp_size, stego))
+      {
+        fprintf(stderr, "case %d: mode %d param %#x spread %d magic %s, %ux%u %u-bit, %zu of %llu bytes\n", i, rt.mode,
+                rt.param, rt.spread, rt.magic, width, height, rt.bits_per_pixel, size, capacity);
+        CHECK(0);
+      }
+      else
+      {
+        decoded++;
+      }
+    }
+    unlink(stego);
+    free(bmp);
+    free(data);
+  }
+
+  unlink(cover);
+  unlink(secret);
+  rmdir(dir);
+  printf("test_roundtrip: %u decoded, %u oversize secrets refused\n", decoded, refused);
+  return test_result("test_roundtrip");
+}
@@ -0,0 +1,151 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "bmp.h"
+#include "common.h"
+#include "kernel.h"
+#include "crc32c.h"
+
+/*
+ * Helpers shared by the test programs.
+ * A failed CHECK prints the expression and its location and
+ * counts the failure; main returns test_result() so ctest sees
+ * a non-zero exit. Images are built in memory with a fixed
+ * seed, so every run sees the same bytes.
+ */
+
+/* ctest treats this exit code as "skipped" (SKIP_RETURN_CODE) */
+#define TEST_SKIPPED 77
+
+static int test_failures;
+
+#define CHECK(expr)                                                          \
+  do {                                                                       \
+    if (!(expr))                                                             \
+    {                                                                        \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #expr); \
+      test_failures++;                                                       \
+    }                                                                        \
+  } while (0)
+
+static inline int test_result(const char *name)
+{
+  if (test_failures)
+    fprintf(stderr, "%s: %d checks failed\n", name, test_failures);
+  else
+    printf("%s: ok\n", name);
+  return test_failures ? 1 : 0;
+}
+
+/* xorshift64*, deterministic test data */
+static inline unsigned long long test_rand(unsigned long long *state)
+{
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static inline void test_fill(unsigned char *buf, size_t size, unsigned long long *state)
+{
+  for (size_t i = 0; i < size; i++)
+    buf[i] = (unsigned char)(test_rand(state) >> 56);
+}
+
+/*
+ * Function: test_bmp_header
+ * -------------------------
+ * Writes a 54 byte header for an uncompressed width x height
+ * image with bits_per_pixel 24 or 32, pixels right after it
+ */
+static inline void test_bmp_header(unsigned char *header, uint width, uint height, uint bits_per_pixel)
+{
+  uint64 image_size = (uint64)width * height * (bits_per_pixel / 8);
+  uint fields[] = { (uint)(BMP_HEADER_SIZE + image_size), 0, BMP_HEADER_SIZE, 40, width, height };
+  memset(header, 0, BMP_HEADER_SIZE);
+  header[0] = 'B';
+  header[1] = 'M';
+  for (int f = 0; f < 6; f++)
+    for (int b = 0; b < 4; b++)
+      header[2 + f * 4 + b] = (unsigned char)(fields[f] >> (b * 8));
+  header[26] = 1;
+  header[BMP_OFFSET_BPP] = (unsigned char)bits_per_pixel;
+}
+
+/*
+ * Function: test_bmp
+ * ------------------
+ * Random width x height BMP in a malloc'd buffer
+ */
+static inline unsigned char *test_bmp(uint width, uint height, uint bits_per_pixel, size_t *size, unsigned long long *state)
+{
+  *size = BMP_HEADER_SIZE + (size_t)width * height * (bits_per_pixel / 8);
+  unsigned char *bmp = malloc(*size);
+  if (bmp == NULL)
+    return NULL;
+  test_bmp_header(bmp, width, height, bits_per_pixel);
+  test_fill(bmp + BMP_HEADER_SIZE, *size - BMP_HEADER_SIZE, state);
+  return bmp;
+}
+
+/*
+ * Function: test_stego
+ * --------------------
+ * Hides size bytes of data in a copy of a test_bmp image the
+ * way the encoder lays it out: magic string, format word,
+ * ".txt", 4 byte size, CRC-32C, then the secret data with the
+ * mode's kernel from the next whole pixel. A non-zero stride
+ * spreads LSB data with a stride field, as --spread does.
+ *
+ * Returns: malloc'd stego image, NULL if the data does not fit
+ */
+static inline unsigned char *test_stego(const unsigned char *bmp, size_t bmp_size, const char *magic, EmbedMode mode,
+                                        uint param, const unsigned char *data, uint size, uint stride)
+{
+  uint magic_len = strlen(magic);
+  uint header_len = magic_len + 16 + (stride ? STEGO_STRIDE_FIELD_BYTES : 0);
+  uint data_start = header_len * 8 + embed_data_pad(mode, param, header_len * 8);
+  uint image_bytes = (uint)embed_image_bytes(mode, param, size);
+  uint64 span = (uint64)image_bytes * (stride ? stride : 1);
+  if ((stride && mode != e_embed_lsb) || BMP_HEADER_SIZE + data_start + span > bmp_size)
+    return NULL;
+  unsigned char *stego = malloc(bmp_size);
+  unsigned char header[MAX_STEGO_HEADER_BYTES + STEGO_STRIDE_FIELD_BYTES];
+  if (stego == NULL)
+    return NULL;
+  memcpy(stego, bmp, bmp_size);
+  uint word = STEGO_FORMAT_WORD(4, mode, param) | STEGO_FLAG_DIGEST | (stride ? STEGO_FLAG_STRIDE : 0);
+  uint digest = crc32c_final(crc32c_update(CRC32C_INIT, data, size));
+  memcpy(header, magic, magic_len);
+  memcpy(header + magic_len, &word, 4);
+  memcpy(header + magic_len + 4, ".txt", 4);
+  memcpy(header + magic_len + 8, &size, 4);
+  memcpy(header + magic_len + 12, &digest, 4);
+  memcpy(header + magic_len + 16, &stride, 4);
+  unsigned char *pixels = stego + BMP_HEADER_SIZE;
+  embed_lsb_replace(header, header_len, pixels);
+  KeyStream ks;
+  keystream_init(&ks, magic);
+  if (stride == 0)
+  {
+    embed_bytes(mode, param, data, size, pixels + data_start, &ks);
+    return stego;
+  }
+  unsigned char *dense = malloc(image_bytes);
+  if (dense == NULL)
+  {
+    free(stego);
+    return NULL;
+  }
+  gather_strided(pixels + data_start, image_bytes, 1, stride, dense);
+  embed_lsb_replace(data, size, dense);
+  scatter_strided(dense, image_bytes, 1, stride, pixels + data_start);
+  free(dense);
+  return stego;
+}
+
+#endif
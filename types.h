@@ -4,6 +4,9 @@
 /* User defined types */
 typedef unsigned int uint;
 
+/* Image and secret sizes, which can pass 4 GB */
+typedef unsigned long long uint64;
+
 /* Status will be used in fn. return type */
 typedef enum
 {
@@ -15,7 +18,26 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_index,
+    e_query,
+    e_bench,
+    e_bundle,
+    e_list,
+    e_extract,
+    e_append,
+    e_daemon,
+    e_client,
     e_unsupported
 } OperationType;
 
+/* Embedding mode, selects how payload bits are written to pixel bytes */
+typedef enum
+{
+    e_embed_lsb,
+    e_embed_lsb_match,
+    e_embed_matrix,
+    e_embed_pixel,
+    e_embed_mode_count
+} EmbedMode;
+
 #endif